@@ -0,0 +1,314 @@
+// Measures how fast wallClockProfiler parses the frames in GDB's
+// -stack-list-frames responses, against the split/sscanf parser it used
+// to have, and counts the names the old parser cut short.
+//
+// Build like this (from util/):
+//
+// g++ -O2 -o benchMIParse benchMIParse.cpp
+//
+// Run like this:
+//
+// ./benchMIParse  [responses.txt]  [passes]
+//
+// With no file, 200 responses of 5 to 40 frames are made up, the same
+// ones each run, with long libstdc++-style template names.  A file of
+// real responses (one ^done,stack=[...] line each, as GDB prints them)
+// can be given instead.
+
+
+#define main wallClockProfilerMain
+#include "../wallClockProfiler.cpp"
+#undef main
+
+
+
+// the old parser, kept here as the baseline
+// it splits the tuple on every comma, and reads names with %499s, so it
+// stops at the first comma or space in a name
+static StackFrame oldParseFrame( char *inFrameString ) {
+    StackFrame newF;
+
+    char *openPos = strstr( inFrameString, "{" );
+
+    if( openPos == NULL ) {
+        printf( "Error parsing stack frame:  %s\n", inFrameString );
+        exit( 1 );
+        }
+    openPos = &( openPos[1] );
+
+    char *closePos = strstr( openPos, "}" );
+
+    if( closePos == NULL ) {
+        printf( "Error parsing stack frame:  %s\n", inFrameString );
+        exit( 1 );
+        }
+    closePos[0] ='\0';
+
+    int numVals;
+    char **vals = split( openPos, ",", &numVals );
+
+    void *address = NULL;
+
+    for( int i=0; i<numVals; i++ ) {
+        if( strstr( vals[i], "addr=" ) == vals[i] ) {
+            sscanf( vals[i], "addr=\"%p\"", &address );
+            break;
+            }
+        }
+
+    newF.address = address;
+    newF.lineNum = -1;
+    newF.funcName = NULL;
+    newF.fileName = NULL;
+
+    for( int i=0; i<numVals; i++ ) {
+        if( strstr( vals[i], "func=" ) == vals[i] ) {
+            char *name = new char[ 500 ];
+            sscanf( vals[i], "func=\"%499s\"", name );
+            newF.funcName = name;
+            }
+        else if( strstr( vals[i], "file=" ) == vals[i] ) {
+            char *name = new char[ 500 ];
+            sscanf( vals[i], "file=\"%499s\"", name );
+            newF.fileName = name;
+            }
+        else if( strstr( vals[i], "line=" ) == vals[i] ) {
+            sscanf( vals[i], "line=\"%d\"", &newF.lineNum );
+            }
+        }
+
+    if( newF.fileName == NULL ) {
+        newF.fileName = stringDuplicate( "" );
+        }
+    if( newF.funcName == NULL ) {
+        newF.funcName = stringDuplicate( "" );
+        }
+
+    char *quotePos = (char*)strstr( newF.fileName, "\"" );
+    if( quotePos != NULL ) {
+        quotePos[0] ='\0';
+        }
+    quotePos = (char*)strstr( newF.funcName, "\"" );
+    if( quotePos != NULL ) {
+        quotePos[0] ='\0';
+        }
+
+
+    for( int i=0; i<numVals; i++ ) {
+        delete [] vals[i];
+        }
+    delete [] vals;
+
+    return newF;
+    }
+
+
+
+// names like the ones GDB shows for a C++ program
+static const char *benchFuncNames[] = {
+    "main",
+    "__GI___poll",
+    "nanosleep",
+    "Worker::run()",
+    "operator new(unsigned long)",
+    "std::map<int, Foo, std::less<int>, std::allocator<std::pair<int const, "
+    "Foo> > >::find(int const&)",
+    "std::vector<std::__cxx11::basic_string<char, std::char_traits<char>, "
+    "std::allocator<char> >, std::allocator<std::__cxx11::basic_string<"
+    "char, std::char_traits<char>, std::allocator<char> > > >::push_back("
+    "std::__cxx11::basic_string<char, std::char_traits<char>, "
+    "std::allocator<char> > const&)",
+    "std::_Hashtable<unsigned long, std::pair<unsigned long const, Entry>, "
+    "std::allocator<std::pair<unsigned long const, Entry> > >::_M_find_"
+    "before_node(unsigned long, unsigned long const&, unsigned long) const",
+    "Server::handleRequest(Request const&, Response*)",
+    "(anonymous namespace)::flushQueue(int)" };
+
+#define NUM_BENCH_FUNC_NAMES \
+    (int)( sizeof( benchFuncNames ) / sizeof( const char* ) )
+
+
+// one made-up response, as a line
+static char *makeResponse() {
+    int numFrames = 5 + lrand48() % 36;
+
+    SimpleVector<char> line;
+    line.appendElementString( "^done,stack=[" );
+
+    for( int f=0; f<numFrames; f++ ) {
+        if( f > 0 ) {
+            line.push_back( ',' );
+            }
+        char *frame = autoSprintf(
+            "frame={level=\"%d\",addr=\"0x%lx\",func=\"%s\","
+            "file=\"src/worker.cpp\","
+            "fullname=\"/home/u/proj/src/worker.cpp\",line=\"%ld\","
+            "arch=\"i386:x86-64\"}",
+            f, 0x555555554000 + lrand48() % 0x100000,
+            benchFuncNames[ lrand48() % NUM_BENCH_FUNC_NAMES ],
+            1 + lrand48() % 1000 );
+        line.appendElementString( frame );
+        delete [] frame;
+        }
+    line.appendElementString( "]\n" );
+
+    return line.getElementString();
+    }
+
+
+
+int main( int inNumArgs, char **inArgs ) {
+    SimpleVector<char*> responses;
+
+    int passes = 50;
+
+    if( inNumArgs > 2 ) {
+        sscanf( inArgs[2], "%d", &passes );
+        }
+
+    if( inNumArgs > 1 ) {
+        FILE *f = fopen( inArgs[1], "r" );
+
+        if( f == NULL ) {
+            printf( "Could not open %s\n", inArgs[1] );
+            return 1;
+            }
+
+        static char line[ 1 << 22 ];
+
+        while( fgets( line, sizeof( line ), f ) != NULL ) {
+            if( strstr( line, "stack=[" ) != NULL ) {
+                responses.push_back( stringDuplicate( line ) );
+                }
+            }
+        fclose( f );
+        }
+    else {
+        srand48( 1 );
+
+        for( int i=0; i<200; i++ ) {
+            responses.push_back( makeResponse() );
+            }
+        }
+
+    long numBytes = 0;
+    for( int i=0; i<responses.size(); i++ ) {
+        numBytes += strlen( responses.getElementDirect( i ) );
+        }
+
+    printf( "%d responses, %.1f KB, %d passes\n",
+            responses.size(), numBytes / 1024.0, passes );
+
+
+    long oldFrames = 0;
+    double oldStart = getMonotonicTime();
+
+    for( int p=0; p<passes; p++ ) {
+        for( int i=0; i<responses.size(); i++ ) {
+            char *copy = stringDuplicate( responses.getElementDirect( i ) );
+
+            char *list = strstr( copy, "stack=[" ) + strlen( "stack=[" );
+            char *listEnd = strrchr( list, ']' );
+            listEnd[0] = '\0';
+
+            int numParts;
+            char **parts = split( list, "frame=", &numParts );
+
+            for( int k=0; k<numParts; k++ ) {
+                if( strstr( parts[k], "{" ) != NULL ) {
+                    StackFrame sf = oldParseFrame( parts[k] );
+                    delete [] sf.funcName;
+                    delete [] sf.fileName;
+                    oldFrames++;
+                    }
+                delete [] parts[k];
+                }
+            delete [] parts;
+            delete [] copy;
+            }
+        }
+
+    double oldSeconds = getMonotonicTime() - oldStart;
+
+
+    long newFrames = 0;
+    double newStart = getMonotonicTime();
+
+    for( int p=0; p<passes; p++ ) {
+        for( int i=0; i<responses.size(); i++ ) {
+            const char *line = responses.getElementDirect( i );
+
+            MIValue stack;
+            stack.type = '[';
+            stack.start = strstr( line, "stack=[" ) + strlen( "stack=" );
+            stack.end = strrchr( line, ']' ) + 1;
+
+            const char *pos, *end;
+            getMIContents( &stack, &pos, &end );
+
+            const char *name;
+            int nameLength;
+            MIValue frame;
+
+            while( nextMIItem( &pos, end, &name, &nameLength, &frame ) ) {
+                parseFrame( &frame );
+                newFrames++;
+                }
+            }
+        }
+
+    double newSeconds = getMonotonicTime() - newStart;
+
+
+    // names the old parser got wrong, in one pass
+    int numCut = 0;
+    int numNames = 0;
+
+    for( int i=0; i<responses.size(); i++ ) {
+        const char *line = responses.getElementDirect( i );
+
+        MIValue stack;
+        stack.type = '[';
+        stack.start = strstr( line, "stack=[" ) + strlen( "stack=" );
+        stack.end = strrchr( line, ']' ) + 1;
+
+        const char *pos, *end;
+        getMIContents( &stack, &pos, &end );
+
+        const char *name;
+        int nameLength;
+        MIValue frame;
+
+        while( nextMIItem( &pos, end, &name, &nameLength, &frame ) ) {
+            StackFrame good = parseFrame( &frame );
+
+            char *frameString = new char[ frame.end - frame.start + 1 ];
+            memcpy( frameString, frame.start, frame.end - frame.start );
+            frameString[ frame.end - frame.start ] = '\0';
+
+            StackFrame old = oldParseFrame( frameString );
+
+            if( strcmp( old.funcName, good.funcName ) != 0 ) {
+                numCut++;
+                }
+            numNames++;
+
+            delete [] old.funcName;
+            delete [] old.fileName;
+            delete [] frameString;
+            }
+        }
+
+    printf( "old split/sscanf:  %.0f frames/s  (%.1f MB/s)\n",
+            oldFrames / oldSeconds, passes * numBytes / oldSeconds / 1e6 );
+    printf( "MI parser:         %.0f frames/s  (%.1f MB/s)\n",
+            newFrames / newSeconds, passes * numBytes / newSeconds / 1e6 );
+    printf( "old parser got %d of %d function names wrong\n",
+            numCut, numNames );
+
+    for( int i=0; i<responses.size(); i++ ) {
+        delete [] responses.getElementDirect( i );
+        }
+
+    return 0;
+    }
@@ -0,0 +1,185 @@
+// Measures how fast wallClockProfiler takes in sampled stacks as the
+// number of unique stacks grows, to check that finding a known stack
+// doesn't get slower with more stacks.
+//
+// Build like this (from util/):
+//
+// g++ -O2 -o benchStackTable benchStackTable.cpp
+//
+// Run like this:
+//
+// ./benchStackTable  [unique_stacks ...]
+//
+// Default sizes are 10000, 100000 and 1000000.  Each stack is 20 frames
+// of addresses, and each unique stack is sampled 3 times, in 3 passes,
+// so 2 of every 3 samples find a stack that's already known.
+//
+// For comparison, a plain linear scan over the same stacks (the way
+// stackLog used to be searched, not counting its scans of each root
+// depth) is also timed, at up to 30000 unique stacks.
+
+
+#define main wallClockProfilerMain
+#include "../wallClockProfiler.cpp"
+#undef main
+
+
+#define BENCH_STACK_DEPTH 20
+#define BENCH_PASSES 3
+#define BENCH_MAX_LINEAR 30000
+
+
+
+// frame addresses of unique stack inNumber, innermost first
+// the first three frames spell out inNumber, the rest are shared
+static void getBenchStack( int inNumber, uintptr_t *outAddresses ) {
+    for( int d=0; d<BENCH_STACK_DEPTH; d++ ) {
+        outAddresses[d] = 0x400000 + d * 0x1000;
+        }
+    outAddresses[0] += inNumber % 4096;
+    outAddresses[1] += ( inNumber / 4096 ) % 4096;
+    outAddresses[2] += inNumber / ( 4096 * 4096 );
+    }
+
+
+
+// samples per second through the profiler's own stack table
+static double benchStackTable( int inNumUnique ) {
+    // don't re-read the maps of a target we don't have
+    targetMapsStale = true;
+
+    uintptr_t addresses[ BENCH_STACK_DEPTH ];
+
+    long numSamples = 0;
+    double start = getMonotonicTime();
+
+    for( int p=0; p<BENCH_PASSES; p++ ) {
+        for( int u=0; u<inNumUnique; u++ ) {
+            getBenchStack( u, addresses );
+
+            clearSampleStacks();
+            startSampleStack( -1 );
+
+            for( int d=0; d<BENCH_STACK_DEPTH; d++ ) {
+                addSampleFrame( makeAddressFrame( addresses[d] ) );
+                }
+            addSampleStack( 0, 1, 0.01 );
+            numSamples++;
+            }
+        }
+
+    double seconds = getMonotonicTime() - start;
+
+    long totalCount = 0;
+    for( int i=0; i<stackLog.size(); i++ ) {
+        totalCount += stackLog.getElement( i )->sampleCount;
+        }
+
+    if( stackLog.size() != inNumUnique || totalCount != numSamples ) {
+        printf( "Expected %d stacks with %ld samples, got %d with %ld\n",
+                inNumUnique, numSamples, stackLog.size(), totalCount );
+        exit( 1 );
+        }
+
+    // start the next size from nothing
+    finishStackLogs();
+
+    for( int i=0; i<stackLog.size(); i++ ) {
+        freeStack( stackLog.getElement( i ) );
+        }
+    stackLog.deleteAll();
+    callTree.deleteAll();
+    frameTable.deleteAll();
+
+    return numSamples / seconds;
+    }
+
+
+
+// samples per second, searching the same stacks one by one
+static double benchLinearScan( int inNumUnique ) {
+    SimpleVector<uintptr_t*> stacks;
+    SimpleVector<int> counts;
+
+    uintptr_t addresses[ BENCH_STACK_DEPTH ];
+
+    long numSamples = 0;
+    double start = getMonotonicTime();
+
+    for( int p=0; p<BENCH_PASSES; p++ ) {
+        for( int u=0; u<inNumUnique; u++ ) {
+            getBenchStack( u, addresses );
+
+            int found = -1;
+
+            for( int i=0; i<stacks.size(); i++ ) {
+                if( memcmp( stacks.getElementDirect( i ), addresses,
+                            sizeof( addresses ) ) == 0 ) {
+                    found = i;
+                    break;
+                    }
+                }
+
+            if( found == -1 ) {
+                uintptr_t *copy = new uintptr_t[ BENCH_STACK_DEPTH ];
+                memcpy( copy, addresses, sizeof( addresses ) );
+                stacks.push_back( copy );
+                counts.push_back( 1 );
+                }
+            else {
+                ( *( counts.getElement( found ) ) )++;
+                }
+            numSamples++;
+            }
+        }
+
+    double seconds = getMonotonicTime() - start;
+
+    for( int i=0; i<stacks.size(); i++ ) {
+        delete [] stacks.getElementDirect( i );
+        }
+
+    return numSamples / seconds;
+    }
+
+
+
+int main( int inNumArgs, char **inArgs ) {
+    SimpleVector<int> sizes;
+
+    for( int i=1; i<inNumArgs; i++ ) {
+        int size = 0;
+        sscanf( inArgs[i], "%d", &size );
+
+        if( size > 0 ) {
+            sizes.push_back( size );
+            }
+        }
+
+    if( sizes.size() == 0 ) {
+        sizes.push_back( 10000 );
+        sizes.push_back( 100000 );
+        sizes.push_back( 1000000 );
+        }
+
+    printf( "%-15s%15s%15s\n", "unique stacks", "linear scan", "stack table" );
+
+    for( int i=0; i<sizes.size(); i++ ) {
+        int size = sizes.getElementDirect( i );
+
+        char linear[30] = "-";
+
+        if( size <= BENCH_MAX_LINEAR ) {
+            snprintf( linear, sizeof( linear ), "%.0f/s",
+                      benchLinearScan( size ) );
+            }
+
+        char table[30];
+        snprintf( table, sizeof( table ), "%.0f/s",
+                  benchStackTable( size ) );
+
+        printf( "%-15d%15s%15s\n", size, linear, table );
+        }
+
+    return 0;
+    }
@@ -0,0 +1,147 @@
+// Writes a made-up wallClockProfiler report, of about the size asked
+// for, for timing reportToCallgrind on reports bigger than any we have.
+//
+// Build like this (from util/):
+//
+// g++ -O2 -o makeBenchReport makeBenchReport.cpp
+//
+// Run like this:
+//
+// ./makeBenchReport  report.txt  megabytes  [--noSpaces]
+//
+// The report is the same for the same size each run.  It has 20000
+// functions in 400 files, and its stacks are built from 5000 base call
+// chains, each cut off at a random depth and topped with a few random
+// frames, so frame lines repeat a lot and call edges spread out, like
+// a long attach to a big program.  One function name in 7 has spaces in
+// it, like a template or an operator would, unless --noSpaces is given,
+// which the old split/fscanf converter needs.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+
+#define NUM_FUNCTIONS 20000
+#define NUM_CHAINS 5000
+#define MAX_CHAIN 40
+#define MAX_EXTRA 6
+
+
+void usage() {
+    printf( "Usage:\n\n" );
+    
+    printf( "makeBenchReport report_file megabytes [--noSpaces]\n\n" );
+    
+    printf( "Example:\n\n" );
+    
+    
+    printf( "makeBenchReport bigReport.txt 1000\n\n" );
+    exit( 0 );
+    }
+
+
+
+int main( int inNumArgs, char **inArgs ) {
+    if( inNumArgs < 3 ) {
+        usage();
+        }
+    
+    double megabytes = 0;
+    sscanf( inArgs[2], "%lf", &megabytes );
+    
+    if( megabytes <= 0 ) {
+        usage();
+        }
+    
+    char spaces = true;
+    
+    if( inNumArgs > 3 && strcmp( inArgs[3], "--noSpaces" ) == 0 ) {
+        spaces = false;
+        }
+    
+    FILE *reportFile = fopen( inArgs[1], "w" );
+    
+    if( reportFile == NULL ) {
+        printf( "Failed to open %s for writing\n", inArgs[1] );
+        return 1;
+        }
+    
+    srand48( 2 );
+    
+    int *chains[ NUM_CHAINS ];
+    int chainLengths[ NUM_CHAINS ];
+    
+    for( int c=0; c<NUM_CHAINS; c++ ) {
+        chainLengths[c] = 4 + lrand48() % ( MAX_CHAIN - 4 );
+        chains[c] = new int[ chainLengths[c] ];
+        
+        for( int i=0; i<chainLengths[c]; i++ ) {
+            chains[c][i] = lrand48() % NUM_FUNCTIONS;
+            }
+        }
+    
+    fprintf( reportFile,
+             "Report:\n\n\n\nFull stacks with at least one sample:\n\n" );
+    
+    long long targetSize = (long long)( megabytes * 1024 * 1024 );
+    long long size = 0;
+    int numStacks = 0;
+    
+    int frames[ MAX_CHAIN + MAX_EXTRA ];
+    
+    while( size < targetSize ) {
+        int c = lrand48() % NUM_CHAINS;
+        int numFrames = 1 + lrand48() % chainLengths[c];
+        
+        // outermost first here
+        memcpy( frames, chains[c], numFrames * sizeof( int ) );
+        
+        int numExtra = lrand48() % MAX_EXTRA;
+        for( int i=0; i<numExtra; i++ ) {
+            frames[ numFrames++ ] = lrand48() % NUM_FUNCTIONS;
+            }
+        
+        size += fprintf( reportFile,
+                         "%7.3f%% ===================================== "
+                         "(%d samples)\n",
+                         drand48() * 0.01, 1 + (int)( lrand48() % 49 ) );
+        
+        // innermost first in the report
+        for( int j=0; j<numFrames; j++ ) {
+            int f = frames[ numFrames - 1 - j ];
+            
+            if( spaces && f % 7 == 0 ) {
+                size += fprintf( reportFile,
+                                 "       %3d: func%d(int, std::map<int, "
+                                 "Foo> const&)", j + 1, f );
+                }
+            else {
+                size += fprintf( reportFile, "       %3d: ns::func%d",
+                                 j + 1, f );
+                }
+            size += fprintf( reportFile,
+                             "   (at /src/module%d/file%d.cpp:%d)\n",
+                             f % 50, f % 400, ( f * 13 + j ) % 900 + 1 );
+            
+            if( j == 0 ) {
+                size += fprintf( reportFile,
+                                 "            %d:|   x = y + z;\n",
+                                 ( f * 13 ) % 900 + 1 );
+                }
+            }
+        size += fprintf( reportFile, "\n\n" );
+        numStacks++;
+        }
+    
+    fclose( reportFile );
+    
+    for( int c=0; c<NUM_CHAINS; c++ ) {
+        delete [] chains[c];
+        }
+    
+    printf( "Wrote %d stacks, %.1f MB, to %s\n",
+            numStacks, size / ( 1024.0 * 1024.0 ), inArgs[1] );
+    
+    return 0;
+    }
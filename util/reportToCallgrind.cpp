@@ -1,15 +1,20 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 
 void usage() {
     printf( "Usage:\n\n" );
     
     printf( "reportToCallgrind report_file callgrind_file\n\n" );
-
+    
     printf( "Example:\n\n" );
-
+    
     
     printf( "reportToCallgrind myReport.txt myReport.callgrind\n\n" );
     exit( 0 );
@@ -17,362 +22,818 @@ void usage() {
 
 
 
-char *stringDuplicate( char *inString ) {
-    int len = strlen( inString );
-    char *newString = new char[ len + 1 ];
-    memcpy( newString, inString, len );
-    newString[len] = '\0';
-    return newString;
+// The report is mapped and read through once, a line at a time, from
+// the full stack list on.  Names are never copied, they're just kept as
+// pointers into the mapped report, and files, functions and costs are
+// all found again through hash tables, so the time taken grows with the
+// size of the report, not with the number of lines times the number of
+// unique lines.
+//
+// Each stack's samples count as self cost at its innermost line, and as
+// call cost at every other line in it, for the call that line made to
+// the function one frame in.  There's no limit on the number of callees
+// a line can have.
+
+
+
+// a name, pointing into the report
+typedef struct Name {
+        const char *start;
+        int length;
+    } Name;
+
+
+typedef struct Function {
+        // indices in names
+        int name;
+        int file;
+        // lowest line seen in the function, the closest we can get to
+        // where it starts
+        int firstLine;
+        // numbered in the output yet
+        char written;
+    } Function;
+
+
+// the text of a frame line after its number, like
+//     main   (at myProgram.cpp:153)
+// which is the same for every stack the frame is in, so each one only
+// gets picked apart once
+typedef struct FrameLine {
+        Name text;
+        // index in functions
+        int function;
+        int line;
+    } FrameLine;
+
+
+typedef struct Cost {
+        // index in frameLines, which the samples were at
+        int frameLine;
+        // index in functions, and line, of that frame line
+        int function;
+        int line;
+        // function called from the line, or -1 for samples that ended
+        // at the line
+        int callee;
+        long long sampleCount;
+        // the report's percentages, in thousandths of a percent
+        long long wallCost;
+    } Cost;
+
+
+
+// a growable array, doubled when it runs out of room
+template <class T>
+struct Array {
+        T *items;
+        int size;
+        int capacity;
+    };
+
+
+
+template <class T>
+static T *pushItem( Array<T> *inArray ) {
+    if( inArray->size == inArray->capacity ) {
+        int newCapacity = inArray->capacity * 2;
+        if( newCapacity < 1024 ) {
+            newCapacity = 1024;
+            }
+        T *newItems = new T[ newCapacity ];
+        
+        if( inArray->items != NULL ) {
+            memcpy( newItems, inArray->items, inArray->size * sizeof( T ) );
+            delete [] inArray->items;
+            }
+        inArray->items = newItems;
+        inArray->capacity = newCapacity;
+        }
+    
+    inArray->size++;
+    return &( inArray->items[ inArray->size - 1 ] );
     }
 
 
-typedef struct FunctionLine FunctionLine;
 
-typedef struct FunctionCall {
-        FunctionLine *callee;
-        int sampleCount;
-    } FunctionCall;
+Array<Name> names = { NULL, 0, 0 };
+Array<Function> functions = { NULL, 0, 0 };
+Array<FrameLine> frameLines = { NULL, 0, 0 };
+Array<Cost> costs = { NULL, 0, 0 };
 
-    
+// file names are numbered in the output by their index in names
+Array<char> nameWrittenAsFile = { NULL, 0, 0 };
 
-#define MAX_CALLEES 16                            
 
-struct FunctionLine {
-        char *fileName;
-        char *functionName;
-        int lineNum;
-        int sampleCount;
-        
-        int numCallees;
-        FunctionCall callees[ MAX_CALLEES ];
-    };
+
+// open addressing, like the profiler's own hash indices, but with each
+// slot's hash next to its record number, so a probe touches one cache
+// line instead of two
+typedef struct HashSlot {
+        unsigned int hash;
+        // index+1 into the array of records, or 0 for an empty slot
+        int value;
+    } HashSlot;
 
 
-int maxNumLines = 0;
-int filledNumLines = 0;
-FunctionLine *functionLines = NULL;
+typedef struct HashTable {
+        HashSlot *slots;
+        // always a power of 2
+        int numSlots;
+        int numUsed;
+    } HashTable;
 
 
+HashTable nameTable = { NULL, 0, 0 };
+HashTable functionTable = { NULL, 0, 0 };
+HashTable frameLineTable = { NULL, 0, 0 };
+HashTable costTable = { NULL, 0, 0 };
 
-void updateCallee( FunctionLine *inLine, FunctionLine *inCallee, 
-                   int inNumSamples ) {
-    char found = false;
-    // check for existing
-    for( int i=0; i<inLine->numCallees; i++ ) {
-        FunctionCall *c = &( inLine->callees[ i ] );
+
+
+static void placeInHashTable( HashTable *inTable, int inSlotValue,
+                              unsigned int inHash ) {
+    int mask = inTable->numSlots - 1;
+    int s = inHash & mask;
+    
+    while( inTable->slots[s].value != 0 ) {
+        s = ( s + 1 ) & mask;
+        }
+    inTable->slots[s].hash = inHash;
+    inTable->slots[s].value = inSlotValue;
+    }
+
+
+
+static void addToHashTable( HashTable *inTable, int inNumber,
+                            unsigned int inHash ) {
+    if( inTable->numUsed + 1 > inTable->numSlots / 2 ) {
+        HashTable oldTable = *inTable;
         
-        if( strcmp( c->callee->functionName,
-                    inCallee->functionName ) == 0 ) {
-            c->sampleCount += inNumSamples;
-            
-            // note that FunctionLines track the position in the
-            // target function where the sample was hit,
-            // not the location of the start of the function
-            
-            // but when tracking callees, we actually want to
-            // record the position in the source of the function itself
-            
-            // this is not actually listed in our stack traces
-            // try to get as close as possible by taking the lowest
-            // line number from inside the function body
-            
-            if( inCallee->lineNum < c->callee->lineNum ) {
-                // replace
-                c->callee = inCallee;
+        inTable->numSlots *= 2;
+        if( inTable->numSlots < 1024 ) {
+            inTable->numSlots = 1024;
+            }
+        inTable->slots = new HashSlot[ inTable->numSlots ];
+        
+        memset( inTable->slots, 0, inTable->numSlots * sizeof( HashSlot ) );
+        
+        for( int s=0; s<oldTable.numSlots; s++ ) {
+            if( oldTable.slots[s].value != 0 ) {
+                placeInHashTable( inTable, oldTable.slots[s].value,
+                                  oldTable.slots[s].hash );
                 }
-
-            found = true;
-            break;
             }
+        if( oldTable.slots != NULL ) {
+            delete [] oldTable.slots;
+            }
+        }
+    
+    placeInHashTable( inTable, inNumber + 1, inHash );
+    inTable->numUsed++;
+    }
+
+
+
+static void freeHashTable( HashTable *inTable ) {
+    if( inTable->slots != NULL ) {
+        delete [] inTable->slots;
         }
+    inTable->slots = NULL;
+    inTable->numSlots = 0;
+    inTable->numUsed = 0;
+    }
 
-    if( found ) {
-        return;    
+
+
+// a word at a time, since names are long and there are a lot of them
+static unsigned int hashBytes( const char *inBytes, int inLength ) {
+    uint64_t h = 14695981039346656037ULL ^ (uint64_t)inLength;
+    
+    int i = 0;
+    for( ; i + 8 <= inLength; i += 8 ) {
+        uint64_t w;
+        memcpy( &w, &( inBytes[i] ), 8 );
+        h = ( h ^ w ) * 0x9E3779B97F4A7C15ULL;
+        h ^= h >> 29;
+        }
+    if( i < inLength ) {
+        uint64_t w = 0;
+        memcpy( &w, &( inBytes[i] ), inLength - i );
+        h = ( h ^ w ) * 0x9E3779B97F4A7C15ULL;
+        h ^= h >> 29;
         }
+    return (unsigned int)( h ^ ( h >> 32 ) );
+    }
+
+
+
+static int getName( const char *inStart, int inLength ) {
+    unsigned int hash = hashBytes( inStart, inLength );
     
-    // add new one
-    if( inLine->numCallees >= MAX_CALLEES ) {
-        printf( "Out of space in function callee list for line:  %s:%s:%d\n",
-               inLine->fileName,
-               inLine->functionName,
-               inLine->lineNum );
-        return;
+    if( nameTable.numSlots > 0 ) {
+        int mask = nameTable.numSlots - 1;
+        int s = hash & mask;
+        
+        while( nameTable.slots[s].value != 0 ) {
+            if( nameTable.slots[s].hash == hash ) {
+                int i = nameTable.slots[s].value - 1;
+                Name *n = &( names.items[i] );
+                
+                if( n->length == inLength &&
+                    memcmp( n->start, inStart, inLength ) == 0 ) {
+                    return i;
+                    }
+                }
+            s = ( s + 1 ) & mask;
+            }
         }
-    FunctionCall newCall = { inCallee, inNumSamples };
     
-    inLine->callees[ inLine->numCallees ] = newCall;
-    inLine->numCallees++;
+    Name *n = pushItem( &names );
+    n->start = inStart;
+    n->length = inLength;
+    
+    *( pushItem( &nameWrittenAsFile ) ) = false;
+    
+    addToHashTable( &nameTable, names.size - 1, hash );
+    
+    return names.size - 1;
     }
 
+
+
+static int getFunction( int inName, int inFile, int inLine ) {
+    int parts[2] = { inName, inFile };
+    unsigned int hash = hashBytes( (const char*)parts, sizeof( parts ) );
+    
+    if( functionTable.numSlots > 0 ) {
+        int mask = functionTable.numSlots - 1;
+        int s = hash & mask;
+        
+        while( functionTable.slots[s].value != 0 ) {
+            if( functionTable.slots[s].hash == hash ) {
+                int i = functionTable.slots[s].value - 1;
+                Function *f = &( functions.items[i] );
+                
+                if( f->name == inName && f->file == inFile ) {
+                    if( inLine < f->firstLine ) {
+                        f->firstLine = inLine;
+                        }
+                    return i;
+                    }
+                }
+            s = ( s + 1 ) & mask;
+            }
+        }
+    
+    Function *f = pushItem( &functions );
+    f->name = inName;
+    f->file = inFile;
+    f->firstLine = inLine;
+    f->written = false;
     
+    addToHashTable( &functionTable, functions.size - 1, hash );
+    
+    return functions.size - 1;
+    }
 
 
-int main( int inNumArgs, char **inArgs ) {
-    if( inNumArgs != 3 ) {
-        usage();
+
+static void addCost( int inFrameLine, int inCallee,
+                     int inSampleCount, int inWallCost ) {
+    uint64_t key = 
+        ( (uint64_t)(unsigned int)inFrameLine << 32 ) | 
+        (unsigned int)inCallee;
+    key *= 0x9E3779B97F4A7C15ULL;
+    unsigned int hash = (unsigned int)( key >> 32 );
+    
+    if( costTable.numSlots > 0 ) {
+        int mask = costTable.numSlots - 1;
+        int s = hash & mask;
+        
+        while( costTable.slots[s].value != 0 ) {
+            if( costTable.slots[s].hash == hash ) {
+                int i = costTable.slots[s].value - 1;
+                Cost *c = &( costs.items[i] );
+                
+                if( c->frameLine == inFrameLine && 
+                    c->callee == inCallee ) {
+                    c->sampleCount += inSampleCount;
+                    c->wallCost += inWallCost;
+                    return;
+                    }
+                }
+            s = ( s + 1 ) & mask;
+            }
         }
     
-    FILE *reportFile = fopen( inArgs[1], "r" );
+    FrameLine *f = &( frameLines.items[ inFrameLine ] );
     
-    if( reportFile == NULL ) {
-        usage();
+    Cost *c = pushItem( &costs );
+    c->frameLine = inFrameLine;
+    c->function = f->function;
+    c->line = f->line;
+    c->callee = inCallee;
+    c->sampleCount = inSampleCount;
+    c->wallCost = inWallCost;
+    
+    addToHashTable( &costTable, costs.size - 1, hash );
+    }
+
+
+
+// by function, then line, with the samples that ended at a line before
+// the calls made from it
+static int compareCosts( const void *inA, const void *inB ) {
+    Cost *a = (Cost*)inA;
+    Cost *b = (Cost*)inB;
+    
+    if( a->function != b->function ) {
+        return ( a->function < b->function ) ? -1 : 1;
+        }
+    if( a->line != b->line ) {
+        return ( a->line < b->line ) ? -1 : 1;
         }
+    if( a->callee != b->callee ) {
+        return ( a->callee < b->callee ) ? -1 : 1;
+        }
+    return 0;
+    }
+
+
+
+// finds the last inNeedle in [inStart, inEnd)
+static const char *findLast( const char *inStart, const char *inEnd,
+                             const char *inNeedle ) {
+    int needleLength = strlen( inNeedle );
     
-    FILE *callgrindFile = fopen( inArgs[2], "w" );
+    for( const char *p = inEnd - needleLength; p >= inStart; p-- ) {
+        if( memcmp( p, inNeedle, needleLength ) == 0 ) {
+            return p;
+            }
+        }
+    return NULL;
+    }
+
+
+
+// reads a decimal number, skipping spaces before it
+// returns false if there isn't one
+static char readNumber( const char **ioPos, const char *inEnd,
+                        long long *outValue ) {
+    const char *p = *ioPos;
     
-    if( callgrindFile == NULL ) {
-        fclose( reportFile );
-        usage();
+    while( p < inEnd && *p == ' ' ) {
+        p++;
         }
     
-    fseek( reportFile, 0, SEEK_END );
-    int length = ftell( reportFile );
-    fseek( reportFile, 0, SEEK_SET );
+    char negative = false;
+    if( p < inEnd && *p == '-' ) {
+        negative = true;
+        p++;
+        }
     
-    printf( "Report file contains %d bytes\n", length );
+    if( p == inEnd || *p < '0' || *p > '9' ) {
+        return false;
+        }
     
-    char *report = new char[ length + 1 ];
-    if( report == NULL ) {
-        printf( "Failed to allocate report buffer\n" );
-        fclose( reportFile );
-        fclose( callgrindFile );
-        return 1;
+    long long value = 0;
+    while( p < inEnd && *p >= '0' && *p <= '9' ) {
+        value = value * 10 + ( *p - '0' );
+        p++;
         }
-    fread( report, 1, length, reportFile );
-    report[ length ] = '\0';
     
+    *outValue = negative ? -value : value;
+    *ioPos = p;
+    return true;
+    }
 
-    const char *fullStackHeader =
-        "Full stacks with at least one sample:";
 
-    char *fullStackPos = 
-        strstr( report, fullStackHeader );
+
+// a stack header line looks like
+//      12.345% ===================================== (67 samples)
+// maybe with labels after it, like a thread name
+// returns false if inLine isn't one
+static char parseStackHeader( const char *inLine, const char *inEnd,
+                              int *outSampleCount, int *outWallCost ) {
+    const char *p = inLine;
     
-    if( fullStackPos == NULL ) {
-        printf( "Failed to parse report for full stack list\n" );
-        
-        delete [] report;
-        
-        
-        fclose( reportFile );
-        fclose( callgrindFile );
-        return 1;
+    long long whole;
+    if( ! readNumber( &p, inEnd, &whole ) ) {
+        return false;
+        }
+    
+    // exactly 3 decimals, so the percentage is exact in thousandths
+    long long thousandths = 0;
+    if( p < inEnd && *p == '.' ) {
+        p++;
+        int numDigits = 0;
+        while( p < inEnd && *p >= '0' && *p <= '9' ) {
+            if( numDigits < 3 ) {
+                thousandths = thousandths * 10 + ( *p - '0' );
+                }
+            numDigits++;
+            p++;
+            }
+        for( ; numDigits < 3; numDigits++ ) {
+            thousandths *= 10;
+            }
         }
     
-    char *stackStartPos = &( fullStackPos[ strlen( fullStackHeader ) ] );
+    const char *bar = "% ===================================== (";
+    int barLength = strlen( bar );
+    
+    if( inEnd - p < barLength || memcmp( p, bar, barLength ) != 0 ) {
+        return false;
+        }
+    p += barLength;
+    
+    long long count;
+    if( ! readNumber( &p, inEnd, &count ) ) {
+        return false;
+        }
+    
+    *outSampleCount = (int)count;
+    *outWallCost = (int)( whole * 1000 + thousandths );
+    return true;
+    }
 
 
-    // num lines an upper bound on number of unique function lines in profile
-    char *nextLinePos = stackStartPos;
+
+// a frame line looks like
+//        3: std::map<int, Foo>::find   (at /usr/include/map.h:153)
+// reads the number at the start, and leaves outText pointing at the 
+// rest
+// returns false if inLine isn't one
+static char parseFrameNumber( const char *inLine, const char *inEnd,
+                              int *outStackPos, const char **outText ) {
+    const char *p = inLine;
     
-    int numLines = 0;
-    while( nextLinePos != NULL ) {
-        nextLinePos = strstr( &( nextLinePos[1] ), "\n" );
-        numLines ++;
+    long long stackPos;
+    if( ! readNumber( &p, inEnd, &stackPos ) ) {
+        return false;
+        }
+    if( inEnd - p < 2 || p[0] != ':' || p[1] != ' ' ) {
+        // source line after the innermost frame looks like  153:|   ...
+        return false;
         }
     
-    printf( "%d lines found in full stack portion of profile\n", numLines );
+    *outStackPos = (int)stackPos;
+    *outText = p + 2;
+    return true;
+    }
+
+
 
-    maxNumLines = numLines;
-    filledNumLines = 0;
-    functionLines = new FunctionLine[ maxNumLines ];
+// picks apart the rest of a frame line, where names can have spaces in
+// them, and file names can have colons
+// returns false if it doesn't look like a frame
+static char parseFrameText( const char *inText, const char *inEnd,
+                            const char **outName, int *outNameLength,
+                            const char **outFile, int *outFileLength,
+                            int *outLineNum ) {
+    const char *at = findLast( inText, inEnd, "   (at " );
     
+    if( at == NULL || inEnd[-1] != ')' ) {
+        return false;
+        }
     
-    int startStackOffset = stackStartPos - report;
+    const char *fileStart = at + strlen( "   (at " );
+    const char *colon = findLast( fileStart, inEnd, ":" );
     
-    fseek( reportFile, startStackOffset, SEEK_SET );
-
-    char foundStack = true;
-    int numStacksFound = 0;
+    if( colon == NULL ) {
+        return false;
+        }
+    
+    const char *linePos = colon + 1;
+    long long lineNum;
+    if( ! readNumber( &linePos, inEnd, &lineNum ) ||
+        linePos != inEnd - 1 ) {
+        return false;
+        }
     
-    while( foundStack ) {
-        foundStack = false;
+    *outName = inText;
+    *outNameLength = at - inText;
+    *outFile = fileStart;
+    *outFileLength = colon - fileStart;
+    *outLineNum = (int)lineNum;
+    return true;
+    }
 
-        float percent;
-        int numSamples;
-        
-        int numRead = 
-            fscanf( reportFile, 
-                    "%f%% ===================================== (%d samples)",
-                    &percent, &numSamples );
-        
-        if( numRead == 2 ) {
-            foundStack = true;
-            numStacksFound ++;
 
-            //printf( "%f percent, %d samples found in stack\n",
-            //       percent, numSamples );
-            
-            
-            int numRead = 4;
-            
-            int lastStackPos = 0;
-            FunctionLine *lastStackFunctionLine = NULL;
-            
-            while( numRead == 4 ) {
 
-                int stackPos;
-                char funName[200];
-                char fileName[200];
-                memset( funName, 0, 200 );
-                memset( fileName, 0, 200 );
-                
-                int curPos = ftell( reportFile );
-                int lineNum;
-                numRead = fscanf( reportFile, "%d: %199s   (at %199[^:]:%d)",
-                                  &stackPos, funName, fileName, &lineNum );
+// returns the index in frameLines of the frame line with text inText,
+// or -1 if it isn't a frame
+static int getFrameLine( const char *inText, const char *inEnd ) {
+    int length = inEnd - inText;
+    unsigned int hash = hashBytes( inText, length );
+    
+    if( frameLineTable.numSlots > 0 ) {
+        int mask = frameLineTable.numSlots - 1;
+        int s = hash & mask;
+        
+        while( frameLineTable.slots[s].value != 0 ) {
+            if( frameLineTable.slots[s].hash == hash ) {
+                int i = frameLineTable.slots[s].value - 1;
+                Name *t = &( frameLines.items[i].text );
                 
-                if( numRead != 4 ) {
-                    // rewind
-                    fseek( reportFile, curPos, SEEK_SET );
-
-                    // try again, allowing blank for file name
-                    numRead = fscanf( reportFile, 
-                                      "%d: %199s   (at :%d)",
-                                      &stackPos, funName, &lineNum );
-                    
-                    if( numRead != 3 ) {
-                        // rewind again
-                        fseek( reportFile, curPos, SEEK_SET );
-                        }
-                    else {
-                        fileName[0] = '?';
-                        fileName[1] = '\0';
-                        numRead = 4;
-                        }
-                    }
-
-                if( numRead == 4 ) {
-                    if( stackPos = lastStackPos + 1 ) {
-                        lastStackPos = stackPos;
-                        // next step in stack
-
-                        char found = false;
-                        
-                        FunctionLine *thisStackFunctionLine = NULL;
-                        
-                        for( int f=0; f<filledNumLines; f++ ) {
-                            FunctionLine *fl = 
-                                &( functionLines[ f ] );
-                            
-                            if( fl->lineNum == lineNum 
-                                && strcmp( fl->functionName, funName ) == 0 ) {
-                                fl->sampleCount += numSamples;
-                                found = true;
-                                thisStackFunctionLine = fl;
-                                break;
-                                }
-                            }
-                        if( ! found ) {
-                            FunctionLine newLine = {
-                                stringDuplicate( fileName ),
-                                stringDuplicate( funName ),
-                                lineNum,
-                                numSamples,
-                                0 }; // no callees so far
-                        
-                            functionLines[ filledNumLines ] =
-                                newLine;
-                            thisStackFunctionLine = 
-                                &( functionLines[ filledNumLines ] );
-                            filledNumLines++;
-                            }
-
-                        if( lastStackFunctionLine != NULL ) {
-                            // this line calls another line
-                            
-                            updateCallee( thisStackFunctionLine,
-                                          lastStackFunctionLine,
-                                          numSamples );
-                            }
-                        
-                        lastStackFunctionLine = thisStackFunctionLine;
-
-                        if( stackPos == 1 ) {
-                            int curPos = ftell( reportFile );
-                            // may be program source code context after this
-                            // skip it
-                            int sourceLine;
-                            char sourceCode[300];
-                            int numReadB = fscanf( reportFile,
-                                                   "%d:|   %299[^\n]\n",
-                                                   &sourceLine, sourceCode );
-                            if( numReadB == 2 ) {
-                                // source code line found, skip it
-                                }
-                            else {
-                                // source code line not found
-                                // rewind
-                                fseek( reportFile, curPos, SEEK_SET );
-                                }
-                            }
-                        }
+                if( t->length == length &&
+                    memcmp( t->start, inText, length ) == 0 ) {
+                    return i;
                     }
                 }
-            //printf( "    Read up to stack line %d\n", lastStackPos );
+            s = ( s + 1 ) & mask;
             }
         }
     
-    printf( "%d full stacks found\n", numStacksFound );
+    int nameLength, fileLength, lineNum;
+    const char *name, *file;
     
-    /*
+    if( ! parseFrameText( inText, inEnd, &name, &nameLength,
+                          &file, &fileLength, &lineNum ) ) {
+        return -1;
+        }
+    
+    // named and numbered the way wallClockProfiler's own --callgrind 
+    // does it, since a line starting with - or + would be read as 
+    // relative to the line before
+    if( fileLength == 0 ) {
+        file = "???";
+        fileLength = 3;
+        }
+    if( lineNum < 0 ) {
+        lineNum = 0;
+        }
+    
+    FrameLine *f = pushItem( &frameLines );
+    f->text.start = inText;
+    f->text.length = length;
+    f->function = getFunction( getName( name, nameLength ),
+                               getName( file, fileLength ),
+                               lineNum );
+    f->line = lineNum;
+    
+    addToHashTable( &frameLineTable, frameLines.size - 1, hash );
+    
+    return frameLines.size - 1;
+    }
 
-      # callgrind format
-      events: Cycles Instructions Flops
-      fl=file.f
-      fn=main
-      15 90 14 2
-      16 20 12
-     */
-    fprintf( callgrindFile, "events: Samples\n" );
+
+
+// writes a file's number, and its name the first time
+static void writeName( FILE *inFile, const char *inPrefix, int inName,
+                       Array<char> *inWritten ) {
+    if( inWritten->items[ inName ] ) {
+        fprintf( inFile, "%s(%d)\n", inPrefix, inName + 1 );
+        }
+    else {
+        Name *n = &( names.items[ inName ] );
+        fprintf( inFile, "%s(%d) %.*s\n", inPrefix, inName + 1,
+                 n->length, n->start );
+        inWritten->items[ inName ] = true;
+        }
+    }
+
+
+
+static void writeFunctionName( FILE *inFile, const char *inPrefix,
+                               int inFunction ) {
+    Function *f = &( functions.items[ inFunction ] );
+    
+    if( f->written ) {
+        fprintf( inFile, "%s(%d)\n", inPrefix, inFunction + 1 );
+        }
+    else {
+        Name *n = &( names.items[ f->name ] );
+        fprintf( inFile, "%s(%d) %.*s\n", inPrefix, inFunction + 1,
+                 n->length, n->start );
+        f->written = true;
+        }
+    }
+
+
+
+int main( int inNumArgs, char **inArgs ) {
+    if( inNumArgs != 3 ) {
+        usage();
+        }
+    
+    int reportFD = open( inArgs[1], O_RDONLY );
+    
+    if( reportFD == -1 ) {
+        usage();
+        }
+    
+    struct stat reportStat;
+    if( fstat( reportFD, &reportStat ) != 0 || reportStat.st_size == 0 ) {
+        printf( "Failed to read report file %s\n", inArgs[1] );
+        close( reportFD );
+        return 1;
+        }
+    
+    size_t length = reportStat.st_size;
+    
+    printf( "Report file contains %lld bytes\n", (long long)length );
     
-    printf( "%d unique function lines found\n", filledNumLines );
+    char *report = (char*)mmap( NULL, length, PROT_READ, MAP_PRIVATE,
+                                reportFD, 0 );
+    close( reportFD );
     
-    for( int i=0; i<filledNumLines; i++ ) {
-        int selfSampleCount = functionLines[i].sampleCount;
+    if( report == MAP_FAILED ) {
+        printf( "Failed to map report file %s\n", inArgs[1] );
+        return 1;
+        }
+    madvise( report, length, MADV_SEQUENTIAL );
+    
+    FILE *callgrindFile = fopen( inArgs[2], "w" );
+    
+    if( callgrindFile == NULL ) {
+        munmap( report, length );
+        usage();
+        }
+    
+    
+    const char *fullStackHeader =
+        "Full stacks with at least one sample:";
+    int fullStackHeaderLength = strlen( fullStackHeader );
+    
+    const char *pos = report;
+    const char *end = report + length;
+    
+    char foundFullStacks = false;
+    
+    // the stack we're in the middle of, if any
+    char inStack = false;
+    int stackSamples = 0;
+    int stackWallCost = 0;
+    int lastStackPos = 0;
+    int lastFunction = -1;
+    
+    int numStacksFound = 0;
+    int numOutOfOrder = 0;
+    
+    long long totalSamples = 0;
+    long long totalWallCost = 0;
+    
+    while( pos < end ) {
+        const char *lineEnd = (const char*)memchr( pos, '\n', end - pos );
+        if( lineEnd == NULL ) {
+            lineEnd = end;
+            }
         
-        // subtract sample count from function calls made from this line
-        for( int c=0; c<functionLines[i].numCallees; c++ ) {
-            selfSampleCount -= functionLines[i].callees[c].sampleCount;
+        const char *line = pos;
+        pos = lineEnd + 1;
+        
+        if( ! foundFullStacks ) {
+            if( lineEnd - line == fullStackHeaderLength &&
+                memcmp( line, fullStackHeader,
+                        fullStackHeaderLength ) == 0 ) {
+                foundFullStacks = true;
+                }
+            continue;
             }
-
-        fprintf( callgrindFile, "fl=%s\n", functionLines[i].fileName );
-        fprintf( callgrindFile, "fn=%s\n", functionLines[i].functionName );
-        fprintf( callgrindFile, "%d %d\n", 
-                 functionLines[i].lineNum,
-                 selfSampleCount );
         
-        for( int c=0; c<functionLines[i].numCallees; c++ ) {
-            /*
-            cfi=file2.c
-            cfn=func2
-            calls=3 20
-            16 400
-            */
-            fprintf( callgrindFile, "cfi=%s\n", 
-                     functionLines[i].callees[c].callee->fileName );
-            fprintf( callgrindFile, "cfn=%s\n", 
-                     functionLines[i].callees[c].callee->functionName );
-            fprintf( callgrindFile, "calls=1 %d\n", 
-                     functionLines[i].callees[c].callee->lineNum );
-            fprintf( callgrindFile, "%d %d\n", 
-                     functionLines[i].lineNum,
-                     functionLines[i].callees[c].sampleCount );
+        if( parseStackHeader( line, lineEnd,
+                              &stackSamples, &stackWallCost ) ) {
+            inStack = true;
+            lastStackPos = 0;
+            lastFunction = -1;
+            numStacksFound++;
+            
+            totalSamples += stackSamples;
+            totalWallCost += stackWallCost;
+            continue;
+            }
+        
+        if( ! inStack ) {
+            continue;
+            }
+        
+        int stackPos;
+        const char *text;
+        
+        if( ! parseFrameNumber( line, lineEnd, &stackPos, &text ) ) {
+            // source line, or the blank lines after a stack
+            continue;
+            }
+        
+        int frameLine = getFrameLine( text, lineEnd );
+        
+        if( frameLine == -1 ) {
+            continue;
+            }
+        
+        if( stackPos != lastStackPos + 1 ) {
+            // frames of a stack are numbered 1, 2, 3...
+            // anything else means we've lost track of where we are
+            numOutOfOrder++;
+            inStack = false;
+            continue;
+            }
+        lastStackPos = stackPos;
+        
+        int function = frameLines.items[ frameLine ].function;
+        
+        if( stackPos == 1 ) {
+            // samples ended here
+            addCost( frameLine, -1, stackSamples, stackWallCost );
+            }
+        else {
+            // and went through a call made from here
+            addCost( frameLine, lastFunction, 
+                     stackSamples, stackWallCost );
             }
-        fprintf( callgrindFile, "\n\n" );
+        lastFunction = function;
         }
     
-    for( int i=0; i<filledNumLines; i++ ) {
-        delete [] functionLines[i].fileName;
-        delete [] functionLines[i].functionName;
+    if( ! foundFullStacks ) {
+        printf( "Failed to parse report for full stack list\n" );
+        
+        munmap( report, length );
+        fclose( callgrindFile );
+        return 1;
         }
-
-    delete [] functionLines;
     
-    delete [] report;
+    printf( "%d full stacks found\n", numStacksFound );
+    
+    if( numOutOfOrder > 0 ) {
+        printf( "Skipped the rest of %d stacks with frames out of order\n",
+                numOutOfOrder );
+        }
+    
+    freeHashTable( &nameTable );
+    freeHashTable( &functionTable );
+    freeHashTable( &frameLineTable );
+    freeHashTable( &costTable );
+    
+    qsort( costs.items, costs.size, sizeof( Cost ), compareCosts );
+    
+    
+    // files and functions are numbered, and only named the first time,
+    // like in callgrind's own files
+    fprintf( callgrindFile,
+             "# callgrind format\n"
+             "version: 1\n"
+             "creator: reportToCallgrind\n"
+             "positions: line\n"
+             "event: Samples : Stack samples\n"
+             "event: Wall : Wall-clock time, "
+             "in thousandths of a percent\n"
+             "events: Samples Wall\n"
+             "summary: %lld %lld\n",
+             totalSamples, totalWallCost );
+    
+    printf( "%d unique functions and %d unique lines and calls found\n",
+            functions.size, costs.size );
+    
+    int currentFunction = -1;
+    int currentFile = -1;
+    
+    for( int i=0; i<costs.size; i++ ) {
+        Cost *c = &( costs.items[i] );
+        
+        if( c->function != currentFunction ) {
+            int fileName = functions.items[ c->function ].file;
+            
+            fprintf( callgrindFile, "\n" );
+            
+            if( fileName != currentFile ) {
+                writeName( callgrindFile, "fl=", fileName,
+                           &nameWrittenAsFile );
+                currentFile = fileName;
+                }
+            writeFunctionName( callgrindFile, "fn=", c->function );
+            currentFunction = c->function;
+            }
+        
+        if( c->callee != -1 ) {
+            Function *callee = &( functions.items[ c->callee ] );
+            
+            writeName( callgrindFile, "cfi=", callee->file,
+                       &nameWrittenAsFile );
+            writeFunctionName( callgrindFile, "cfn=", c->callee );
+            
+            // we don't see calls, only samples inside them, so the
+            // call count is the sample count
+            fprintf( callgrindFile, "calls=%lld %d\n", c->sampleCount,
+                     callee->firstLine );
+            }
+        fprintf( callgrindFile, "%d %lld %lld\n",
+                 c->line, c->sampleCount, c->wallCost );
+        }
+    
+    fprintf( callgrindFile, "\ntotals: %lld %lld\n",
+             totalSamples, totalWallCost );
+    
+    delete [] names.items;
+    delete [] functions.items;
+    delete [] frameLines.items;
+    delete [] costs.items;
+    delete [] nameWrittenAsFile.items;
+    
+    munmap( report, length );
     
-    fclose( reportFile );
     fclose( callgrindFile );
-
+    
     return 0;
     }
@@ -7,6 +7,7 @@
 #include <math.h>
 #include <fcntl.h>
 #include <sys/prctl.h>
+#include <poll.h>
 
 #include <time.h>
 #include <stdarg.h>
@@ -956,82 +957,264 @@ static void sendCommand( const char *inCommand ) {
     }
 
 
-// 65 KiB buffer
-// if GDB issues a single response that is longer than this
-// we will only return or processes the tail end of it.
-#define READ_BUFF_SIZE 65536
-char readBuff[READ_BUFF_SIZE];
+// GDB's whole response to a command, always \0-terminated
+// grows as needed, so long responses (deep stacks) are never cut short
+char *readBuff = NULL;
+int readBuffSize = 0;
 
 char anythingInReadBuff = false;
 char numReadAttempts = 0;
 
 
-#define BUFF_TAIL_SIZE 32768
-char tailBuff[ BUFF_TAIL_SIZE ];
+// GDB/MI output is a series of records, one per line:
+//    ^result   *exec-async   +status-async   =notify-async
+//    ~console  @target       &log            (gdb) prompt
+// result and async records can start with a numeric token
+typedef struct MIRecord {
+        // first character of record, after token, or '(' for the prompt
+        char type;
+        // numeric token in front of record, or -1 if none
+        int token;
+        // offset into readBuff of record, after token
+        int start;
+        // length, not counting line end
+        int length;
+    } MIRecord;
+
+
+// records in current contents of readBuff, in order
+SimpleVector<MIRecord> responseRecords;
+
+
+#define MIN_READ_BUFF_SIZE 65536
 
 
 char programExited = false;
 char detatchJustSent = false;
 
 
+// how long to block at a time while waiting for GDB
+#define GDB_POLL_TIMEOUT_MS 1000
+
+
+// sleeps until GDB has written something for us to read
+// returns false if GDB has closed its end of the pipe
+static char waitForGDBOutput() {
+    struct pollfd p;
+    p.fd = inPipe;
+    p.events = POLLIN;
+    
+    while( true ) {
+        p.revents = 0;
+        
+        int result = poll( &p, 1, GDB_POLL_TIMEOUT_MS );
+        
+        if( result == -1 ) {
+            if( errno == EINTR ) {
+                continue;
+                }
+            return false;
+            }
+        if( result == 0 ) {
+            // GDB may legitimately take a long time (waiting for the
+            // program to stop, for example), keep waiting
+            continue;
+            }
+        if( p.revents & POLLIN ) {
+            break;
+            }
+        // hang up or error, with nothing left to read
+        return false;
+        }
+
+    return true;
+    }
+
+
+static void growReadBuff( int inSizeNeeded ) {
+    if( inSizeNeeded <= readBuffSize ) {
+        return;
+        }
+    
+    int newSize = readBuffSize * 2;
+    if( newSize < MIN_READ_BUFF_SIZE ) {
+        newSize = MIN_READ_BUFF_SIZE;
+        }
+    while( newSize < inSizeNeeded ) {
+        newSize *= 2;
+        }
+    
+    char *newBuff = new char[ newSize ];
+    
+    if( readBuff != NULL ) {
+        memcpy( newBuff, readBuff, readBuffSize );
+        delete [] readBuff;
+        }
+    readBuff = newBuff;
+    readBuffSize = newSize;
+    }
+
+
+
+// splits off one complete line of output as a record
+static MIRecord classifyMIRecord( int inStart, int inLength ) {
+    MIRecord r;
+    r.token = -1;
+    r.start = inStart;
+    r.length = inLength;
+    
+    char *line = &( readBuff[ inStart ] );
+    
+    // skip token
+    int tokenLength = 0;
+    while( tokenLength < inLength && 
+           line[ tokenLength ] >= '0' && line[ tokenLength ] <= '9' ) {
+        tokenLength++;
+        }
+    if( tokenLength > 0 && tokenLength < inLength ) {
+        r.token = atoi( line );
+        r.start += tokenLength;
+        r.length -= tokenLength;
+        line = &( line[ tokenLength ] );
+        }
+    
+    if( r.length > 0 ) {
+        r.type = line[0];
+        }
+    else {
+        r.type = '\0';
+        }
+    
+    return r;
+    }
+
+
+
+// true if inRecord's text contains inString
+static char recordContains( MIRecord *inRecord, const char *inString ) {
+    int stringLength = strlen( inString );
+    char *text = &( readBuff[ inRecord->start ] );
+    
+    for( int i=0; i <= inRecord->length - stringLength; i++ ) {
+        if( memcmp( &( text[i] ), inString, stringLength ) == 0 ) {
+            return true;
+            }
+        }
+    return false;
+    }
+
+
+
+// true if inRecord's text starts with inString
+static char recordStartsWith( MIRecord *inRecord, const char *inString ) {
+    int stringLength = strlen( inString );
+    
+    return inRecord->length >= stringLength &&
+        memcmp( &( readBuff[ inRecord->start ] ), 
+                inString, stringLength ) == 0;
+    }
+
+
+
+// reads until we have a full response (ending with a (gdb) prompt), 
+// and, if inWaitingFor is set, until a record containing inWaitingFor 
+// has arrived too
+// only newly arrived bytes are scanned, and each complete line is
+// added to responseRecords as it arrives
 static int fillBufferWithResponse( const char *inWaitingFor = NULL ) {
     int readSoFar = 0;
     anythingInReadBuff = false;
     numReadAttempts = 0;
     
+    responseRecords.deleteAll();
+    
+    // start of first line not yet split off as a record
+    int lineStart = 0;
+    
+    char sawPrompt = false;
+    char sawWaitingFor = ( inWaitingFor == NULL );
+    
+    growReadBuff( MIN_READ_BUFF_SIZE );
+    readBuff[0] = '\0';
+
     while( true ) {
         
-        if( readSoFar >= READ_BUFF_SIZE - 1 ) {
-            // we've filled up our read buffer
-            
-            // save the last bit of it, but discard the rest
-            
-            // copy end, including last \0
-            memcpy( tailBuff, 
-                    &( readBuff[ readSoFar + 1 - BUFF_TAIL_SIZE ] ),
-                    BUFF_TAIL_SIZE );
-            
-            memcpy( readBuff, tailBuff, BUFF_TAIL_SIZE );
-
-            readSoFar = BUFF_TAIL_SIZE - 1;
+        if( readBuffSize - readSoFar < MIN_READ_BUFF_SIZE / 4 ) {
+            growReadBuff( readBuffSize * 2 );
             }
         
         numReadAttempts++;
         
         int numRead = 
             read( inPipe, &( readBuff[readSoFar] ), 
-                  ( READ_BUFF_SIZE - 1 ) - readSoFar );
+                  ( readBuffSize - 1 ) - readSoFar );
         
         if( numRead > 0 ) {
             anythingInReadBuff = true;
             
+            int scanStart = readSoFar;
+            
             readSoFar += numRead;
             
             readBuff[ readSoFar ] = '\0';
-        
-            if( strstr( readBuff, "(gdb)" ) != NULL &&
-                ( inWaitingFor == NULL ||
-                  strstr( readBuff, inWaitingFor ) != NULL ) ) {
+            
+            char programJustExited = false;
+            
+            for( int i=scanStart; i<readSoFar; i++ ) {
+                if( readBuff[i] != '\n' ) {
+                    continue;
+                    }
+                
+                int lineLength = i - lineStart;
+                if( lineLength > 0 && readBuff[ i - 1 ] == '\r' ) {
+                    lineLength --;
+                    }
+                
+                MIRecord r = classifyMIRecord( lineStart, lineLength );
+                lineStart = i + 1;
+
+                if( r.type == '\0' ) {
+                    continue;
+                    }
+                responseRecords.push_back( r );
+                
+                if( r.type == '(' && recordStartsWith( &r, "(gdb)" ) ) {
+                    sawPrompt = true;
+                    }
+                else if( inWaitingFor != NULL && 
+                         recordContains( &r, inWaitingFor ) ) {
+                    sawWaitingFor = true;
+                    }
+                
+                if( r.type == '=' && ! detatchJustSent &&
+                    recordStartsWith( &r, "=thread-group-exited" ) ) {
+                    programJustExited = true;
+                    }
+                }
+            
+            if( sawPrompt && sawWaitingFor ) {
                 // read full response
                 return readSoFar;
                 }
-            else if( readSoFar > 10 &&
-                     ! detatchJustSent &&
-                     strstr( readBuff, "thread-group-exited" ) != NULL ) {
+            else if( programJustExited ) {
                 // stop waiting for full response, program has exited
                 programExited = true;
                 return readSoFar;
                 }
             }
+        else if( numRead == 0 ) {
+            printf( "GDB closed its output pipe\n" );
+            return readSoFar;
+            }
         else if( numRead == -1 ) {
             if( !( errno == EAGAIN || errno == EWOULDBLOCK ) ) {
                 char *errorString = strerror( errno );
                 printf( "Error in reading from GDB pipe: %s\n", errorString );
                 return readSoFar;
                 }
-            else {
-                // sleep to avoid CPU starving pipe sender
-                usleep( 200 );
+            else if( ! waitForGDBOutput() ) {
+                printf( "GDB closed its output pipe\n" );
+                return readSoFar;
                 }
             }
         }
@@ -1118,6 +1301,260 @@ static char *getGDBResponse() {
 
 
 
+// **************************************
+// GDB/MI values, parsed in place in readBuff
+
+// Result records look like ^done,name=value,name=value where each value
+// is a "c-string", a {tuple} of name=value results, or a [list] of 
+// values or results.  Rather than copying pieces out, we walk over 
+// them where they sit.
+
+
+typedef struct MIValue {
+        // '"' for c-string, '{' for tuple, '[' for list, 
+        // or '\0' for the bare result list at the end of a record
+        char type;
+        // for strings, tuples and lists, these include the delimiters
+        const char *start;
+        // one past the end
+        const char *end;
+    } MIValue;
+
+
+
+// returns pointer just past the end of the value starting at inPos,
+// or NULL if it's cut off or malformed
+static const char *skipMIValue( const char *inPos, const char *inEnd ) {
+    if( inPos >= inEnd ) {
+        return NULL;
+        }
+    
+    if( inPos[0] == '"' ) {
+        const char *c = &( inPos[1] );
+        
+        while( c < inEnd ) {
+            if( c[0] == '\\' ) {
+                c = &( c[2] );
+                }
+            else if( c[0] == '"' ) {
+                return &( c[1] );
+                }
+            else {
+                c = &( c[1] );
+                }
+            }
+        return NULL;
+        }
+    
+    if( inPos[0] == '{' || inPos[0] == '[' ) {
+        char close = ( inPos[0] == '{' ) ? '}' : ']';
+        
+        const char *c = &( inPos[1] );
+        
+        while( c < inEnd ) {
+            if( c[0] == close ) {
+                return &( c[1] );
+                }
+            else if( c[0] == '"' || c[0] == '{' || c[0] == '[' ) {
+                c = skipMIValue( c, inEnd );
+                
+                if( c == NULL ) {
+                    return NULL;
+                    }
+                }
+            else {
+                // names, = and ,
+                c = &( c[1] );
+                }
+            }
+        return NULL;
+        }
+    
+    return NULL;
+    }
+
+
+
+// steps to the next item in a tuple or list
+// *ioPos starts at the contents of the tuple or list (or at 
+// the start of a bare result list) and is advanced past the item
+// outName is set to NULL for list items that have no name
+// returns false when there are no more items
+static char nextMIItem( const char **ioPos, const char *inEnd,
+                        const char **outName, int *outNameLength,
+                        MIValue *outValue ) {
+    const char *c = *ioPos;
+    
+    if( c < inEnd && c[0] == ',' ) {
+        c = &( c[1] );
+        }
+    
+    if( c >= inEnd ) {
+        return false;
+        }
+    
+    *outName = NULL;
+    *outNameLength = 0;
+    
+    if( c[0] != '"' && c[0] != '{' && c[0] != '[' ) {
+        // name=value
+        const char *nameStart = c;
+        
+        while( c < inEnd && c[0] != '=' ) {
+            c = &( c[1] );
+            }
+        if( c >= inEnd ) {
+            return false;
+            }
+        *outName = nameStart;
+        *outNameLength = c - nameStart;
+        
+        // skip =
+        c = &( c[1] );
+        }
+    
+    const char *valueEnd = skipMIValue( c, inEnd );
+    
+    if( valueEnd == NULL ) {
+        return false;
+        }
+    
+    outValue->type = c[0];
+    outValue->start = c;
+    outValue->end = valueEnd;
+    
+    *ioPos = valueEnd;
+    return true;
+    }
+
+
+
+// where items of inValue start and end
+static void getMIContents( MIValue *inValue, 
+                           const char **outStart, const char **outEnd ) {
+    if( inValue->type == '\0' ) {
+        *outStart = inValue->start;
+        *outEnd = inValue->end;
+        }
+    else {
+        // skip delimiters
+        *outStart = &( inValue->start[1] );
+        *outEnd = &( inValue->end[-1] );
+        }
+    }
+
+
+
+// finds a named item in a tuple (or list of results)
+static char findMIField( MIValue *inValue, const char *inName,
+                         MIValue *outField ) {
+    const char *pos, *end;
+    getMIContents( inValue, &pos, &end );
+    
+    int nameLength = strlen( inName );
+    
+    const char *name;
+    int length;
+    
+    while( nextMIItem( &pos, end, &name, &length, outField ) ) {
+        if( name != NULL && length == nameLength &&
+            memcmp( name, inName, nameLength ) == 0 ) {
+            return true;
+            }
+        }
+    return false;
+    }
+
+
+
+// finds the result record in readBuff with inResultClass (like "done"),
+// and gets its list of results
+static char getMIResults( const char *inResultClass, 
+                          MIValue *outResults ) {
+    int classLength = strlen( inResultClass );
+    
+    for( int i=0; i<responseRecords.size(); i++ ) {
+        MIRecord *r = responseRecords.getElement( i );
+        
+        const char *text = &( readBuff[ r->start ] );
+        
+        if( r->type == '^' &&
+            r->length > classLength &&
+            memcmp( &( text[1] ), inResultClass, classLength ) == 0 ) {
+            
+            // results start after ^class
+            outResults->type = '\0';
+            outResults->start = &( text[ 1 + classLength ] );
+            outResults->end = &( text[ r->length ] );
+            return true;
+            }
+        }
+    return false;
+    }
+
+
+
+// copies a c-string value, removing quotes and escapes
+// result destroyed by caller
+static char *copyMIString( MIValue *inValue ) {
+    if( inValue->type != '"' ) {
+        return stringDuplicate( "" );
+        }
+    
+    const char *c = &( inValue->start[1] );
+    const char *end = &( inValue->end[-1] );
+    
+    char *result = new char[ end - c + 1 ];
+    int length = 0;
+    
+    while( c < end ) {
+        if( c[0] == '\\' && c + 1 < end ) {
+            c = &( c[1] );
+            
+            switch( c[0] ) {
+                case 'n':
+                    result[ length++ ] = '\n';
+                    break;
+                case 't':
+                    result[ length++ ] = '\t';
+                    break;
+                case 'r':
+                    result[ length++ ] = '\r';
+                    break;
+                case '0': case '1': case '2': case '3':
+                case '4': case '5': case '6': case '7': {
+                    // octal, GDB's way of escaping non-ASCII bytes
+                    int value = 0;
+                    int digits = 0;
+                    while( digits < 3 && c < end && 
+                           c[0] >= '0' && c[0] <= '7' ) {
+                        value = value * 8 + ( c[0] - '0' );
+                        c = &( c[1] );
+                        digits++;
+                        }
+                    // step back onto last digit
+                    c = &( c[-1] );
+                    result[ length++ ] = (char)value;
+                    break;
+                    }
+                default:
+                    result[ length++ ] = c[0];
+                    break;
+                }
+            }
+        else {
+            result[ length++ ] = c[0];
+            }
+        c = &( c[1] );
+        }
+    result[ length ] = '\0';
+    
+    return result;
+    }
+
+
+
+
 typedef struct StackFrame{
         void *address;
         char *funcName;
@@ -1196,53 +1633,44 @@ static void freeStack( Stack *inStack ) {
 
     
 
-static StackFrame parseFrame( char *inFrameString ) {
+// fills a StackFrame from a frame={...} tuple
+// names are copied whole, so templates like std::map<int, Foo>::find 
+// and operators with spaces in them come through intact
+static StackFrame parseFrame( MIValue *inFrame ) {
     StackFrame newF;
     
-    char *openPos = strstr( inFrameString, "{" );
-    
-    if( openPos == NULL ) {
-        printf( "Error parsing stack frame:  %s\n", inFrameString );
-        exit( 1 );
-        }
-    openPos = &( openPos[1] );
-    
-    char *closePos = strstr( openPos, "}" );
-    
-    if( closePos == NULL ) {
-        printf( "Error parsing stack frame:  %s\n", inFrameString );
-        exit( 1 );
-        }
-    closePos[0] ='\0';
-    
-    int numVals;
-    char **vals = split( openPos, ",", &numVals );
-    
-    void *address = NULL;
-    
-    for( int i=0; i<numVals; i++ ) {
-        if( strstr( vals[i], "addr=" ) == vals[i] ) {
-            sscanf( vals[i], "addr=\"%p\"", &address );
-            break;
-            }
-        }
-
-    newF.address = address;
+    newF.address = NULL;
     newF.lineNum = -1;
     newF.funcName = NULL;
     newF.fileName = NULL;
     
-    for( int i=0; i<numVals; i++ ) {
-        if( strstr( vals[i], "func=" ) == vals[i] ) {
-            newF.funcName = new char[ 500 ];
-            sscanf( vals[i], "func=\"%499s\"", newF.funcName );
+    const char *pos, *end;
+    getMIContents( inFrame, &pos, &end );
+    
+    const char *name;
+    int nameLength;
+    MIValue field;
+    
+    // one pass over the fields, in whatever order GDB gives them
+    while( nextMIItem( &pos, end, &name, &nameLength, &field ) ) {
+        if( name == NULL || field.type != '"' ) {
+            continue;
+            }
+        
+        if( nameLength == 4 && memcmp( name, "addr", 4 ) == 0 ) {
+            newF.address = 
+                (void*)strtoul( &( field.start[1] ), NULL, 16 );
+            }
+        else if( nameLength == 4 && memcmp( name, "func", 4 ) == 0 &&
+                 newF.funcName == NULL ) {
+            newF.funcName = copyMIString( &field );
             }
-        else if( strstr( vals[i], "file=" ) == vals[i] ) {
-            newF.fileName = new char[ 500 ];
-            sscanf( vals[i], "file=\"%499s\"", newF.fileName );
+        else if( nameLength == 4 && memcmp( name, "file", 4 ) == 0 &&
+                 newF.fileName == NULL ) {
+            newF.fileName = copyMIString( &field );
             }
-        else if( strstr( vals[i], "line=" ) == vals[i] ) {
-            sscanf( vals[i], "line=\"%d\"", &newF.lineNum );
+        else if( nameLength == 4 && memcmp( name, "line", 4 ) == 0 ) {
+            newF.lineNum = strtol( &( field.start[1] ), NULL, 10 );
             }
         }
     
@@ -1252,21 +1680,6 @@ static StackFrame parseFrame( char *inFrameString ) {
     if( newF.funcName == NULL ) {
         newF.funcName = stringDuplicate( "" );
         }
-    
-    char *quotePos = strstr( newF.fileName, "\"" );
-    if( quotePos != NULL ) {
-        quotePos[0] ='\0';
-        }
-    quotePos = strstr( newF.funcName, "\"" );
-    if( quotePos != NULL ) {
-        quotePos[0] ='\0';
-        }
-
-
-    for( int i=0; i<numVals; i++ ) {
-        delete [] vals[i];
-        }
-    delete [] vals;
 
     return newF;
     }
@@ -1288,44 +1701,31 @@ static void logGDBStackResponse() {
         return;
         }
     
-    const char *stackStartMarker = ",stack=[";
-    
-    char *stackStartPos = strstr( readBuff, ",stack=[" );
-        
-    if( stackStartPos == NULL ) {
-        return;
-        }
-    
-    char *stackStart = &( stackStartPos[ strlen( stackStartMarker ) ] );
-    
-    char *closeBracket = strstr( stackStart, "]\n" );
+    // looks like:
+    // ^done,stack=[frame={level="0",addr="0x...",func="main",...},...]
+    MIValue results, stack;
     
-    if( closeBracket == NULL ) {
+    if( ! getMIResults( "done", &results ) ||
+        ! findMIField( &results, "stack", &stack ) ||
+        stack.type != '[' ) {
         return;
         }
     
-    // terminate at close
-    closeBracket[0] = '\0';
+    Stack thisStack;
+    thisStack.sampleCount = 1;
     
-    const char *frameMarker = "frame=";
+    const char *pos, *end;
+    getMIContents( &stack, &pos, &end );
     
-    if( strstr( stackStart, frameMarker ) != stackStart ) {
-        return;
-        }
+    const char *name;
+    int nameLength;
+    MIValue frame;
     
-    // skip first
-    stackStart = &( stackStart[ strlen( frameMarker ) ] );
-    
-    int numFrames;
-    char **frames = split( stackStart, frameMarker, &numFrames );
-
-    Stack thisStack;
-    thisStack.sampleCount = 1;
-    for( int i=0; i<numFrames; i++ ) {
-        thisStack.frames.push_back( parseFrame( frames[i] ) );
-        delete [] frames[i];
+    while( nextMIItem( &pos, end, &name, &nameLength, &frame ) ) {
+        if( frame.type == '{' ) {
+            thisStack.frames.push_back( parseFrame( &frame ) );
+            }
         }
-    delete [] frames;
 
     
     char match = false;
@@ -1666,39 +2066,30 @@ int main( int inNumArgs, char **inArgs ) {
     
     usleep( 100000 );
 
-    char *response = getGDBResponse();
+    int valueNumRead = fillBufferWithResponse();
     
-    char *valueStart = strstr( response, "value=\"" );
+    if( valueNumRead > 0 ) {
+        log( "Variable value response", readBuff );
+        }
+    checkProgramExited();
     
-    char valueFound = false;
-
-    if( valueStart != NULL ) {
-        
-        char *varContentsStart = &( valueStart[7] );
+    // looks like:
+    // ^done,value="..."
+    MIValue results, value;
     
-        // terminate at closing " character
-        char *varContentsEnd = strstr( varContentsStart, "\"" );
-
-        while( varContentsEnd != NULL && varContentsEnd[-1] == '\\' ) {
-            // don't end on an escaped \"
-            // find a real unescaped "
-            varContentsEnd = strstr( &( varContentsEnd[1] ), "\"" );
-            }
+    if( getMIResults( "done", &results ) &&
+        findMIField( &results, "value", &value ) ) {
         
-        if( varContentsEnd != NULL ) {
-            varContentsEnd[0] = '\0';
+        char *valueString = copyMIString( &value );
         
-            printf( "\n\n%s = %s\n", inArgs[5], varContentsStart );
-            valueFound = true;
-            }
+        printf( "\n\n%s = %s\n", inArgs[5], valueString );
+        
+        delete [] valueString;
         }
-
-    if( !valueFound ) {
+    else {
         printf( "\n\nFailed to output value of variable: %s\n", inArgs[5] );
         }
     
-    delete [] response;
-    
     
     printf( "\n\nDetatching from program\n" );
         
@@ -7,6 +7,19 @@
 #include <math.h>
 #include <fcntl.h>
 #include <sys/prctl.h>
+#include <poll.h>
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+#include <sys/user.h>
+#include <sys/uio.h>
+#include <stdint.h>
+#include <elf.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <cxxabi.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
 
 #include <time.h>
 #include <stdarg.h>
@@ -921,26 +934,222 @@ char *autoSprintf( const char* inFormatString, ... ) {
 
 
 
+// command-line options look like --name or --name=value
+// they can appear anywhere on the command line, and they are pulled out
+// before the positional arguments are interpreted
+typedef struct CommandOption {
+        const char *name;
+        const char *valueName;
+        const char *description;
+    } CommandOption;
+
+
+static CommandOption knownOptions[] = {
+    { "native", NULL,
+      "sample with ptrace and frame pointers instead of through GDB\n"
+      "(GDB is still used to look up names after sampling; libc frames\n"
+      "between a blocking call and its nearest caller with a frame\n"
+      "pointer can be missing)" },
+    { "allThreads", NULL,
+      "sample the stacks of all threads at each stop, not just the\n"
+      "current one, and report where each thread spends its time" },
+    { "lazySymbols", NULL,
+      "only record frame addresses while sampling, and look up all\n"
+      "names and lines in one batch after sampling (always on with\n"
+      "--native)" },
+    { "builtinSymbols", NULL,
+      "look up names and lines by reading ELF symbol tables and DWARF\n"
+      "line tables ourselves instead of asking GDB (implies\n"
+      "--lazySymbols, and with --native, GDB isn't needed at all)" },
+    { "perf", NULL,
+      "also collect on-CPU samples with perf_event_open, without\n"
+      "stopping the target, and label each stack with how much of its\n"
+      "time was spent on-CPU versus off-CPU (implies --lazySymbols)" },
+    { "jitter", "uniform|poisson",
+      "randomize the time between samples (keeping the same average\n"
+      "rate), so that sampling can't line up with periodic work" },
+    { "budget", "percent",
+      "keep the target paused for no more than this percent of\n"
+      "wall-clock time, by lowering the sample rate as needed\n"
+      "(samples_per_sec becomes the highest rate allowed)" },
+    { "rootDepth", "frames",
+      "report partial stacks (common stack roots) up to this many\n"
+      "frames deep (default 14)" },
+    { "top", "count",
+      "only list this many of the biggest functions, partial stacks of\n"
+      "each depth, and full stacks in the report (default is all)" },
+    { "sampleLog", "file",
+      "also write samples to this file as they're taken, so they aren't\n"
+      "lost if the profiler is killed, and the report can be printed\n"
+      "again later with --report" },
+    { "report", "file",
+      "don't sample anything, just print the report for a sample log\n"
+      "written with --sampleLog (--rootDepth and --top still apply)" },
+    { "pprof", "file",
+      "also write the samples to this file as a pprof profile\n"
+      "(gzipped if the name ends in .gz, like profile.pb.gz)" },
+    { "folded", "file",
+      "also write each stack to this file as a line of collapsed\n"
+      "frames (main;foo;bar 1234), weighted in microseconds, for\n"
+      "flame graph tools" },
+    { "flameGraph", "file",
+      "also draw a flame graph of the samples in this SVG file" },
+    { "icicle", NULL,
+      "draw the flame graph upside down, with the outermost frames at\n"
+      "the top" },
+    { "timeline", "file",
+      "also write every sample, in order, with its time and thread, to\n"
+      "this file as Chrome trace events (for chrome://tracing, Perfetto\n"
+      "or speedscope)" },
+    { "callgrind", "file",
+      "also write the samples to this file in callgrind's format, for\n"
+      "KCachegrind and callgrind_annotate" },
+    { "diff", "file",
+      "with --report, compare against this earlier sample log instead\n"
+      "of printing a plain report: list how each function's and stack's\n"
+      "share of the time changed, and with --flameGraph, draw the\n"
+      "changes in red (more time) and blue (less time)" }
+    };
+
+#define NUM_KNOWN_OPTIONS \
+    (int)( sizeof( knownOptions ) / sizeof( CommandOption ) )
+
+
+
 static void usage() {
     printf( "\nDirect call usage:\n\n"
-            "    wallClockProfiler samples_per_sec ./myProgram\n\n" );
+            "    wallClockProfiler [options] samples_per_sec ./myProgram\n\n" );
     printf( "Attach to existing process (may require root):\n\n"
-            "    wallClockProfiler samples_per_sec ./myProgram pid "
+            "    wallClockProfiler [options] samples_per_sec ./myProgram pid "
             "[detatch_sec]\n\n" );
     printf( "detatch_sec is the (optional) number of seconds before detatching and\n"
             "ending profiling (or -1 to stay attached forever, default)\n\n" );
-    
+    printf( "Report on a sample log written earlier:\n\n"
+            "    wallClockProfiler [options] --report=file\n\n" );
+    printf( "Compare a sample log against an earlier one:\n\n"
+            "    wallClockProfiler [options] --diff=before_file "
+            "--report=after_file\n\n" );
+
+    printf( "Options:\n\n" );
+
+    for( int i=0; i<NUM_KNOWN_OPTIONS; i++ ) {
+        if( knownOptions[i].valueName != NULL ) {
+            printf( "    --%s=%s\n", knownOptions[i].name,
+                    knownOptions[i].valueName );
+            }
+        else {
+            printf( "    --%s\n", knownOptions[i].name );
+            }
+
+        // indent each line of description
+        const char *lineStart = knownOptions[i].description;
+        while( lineStart != NULL && lineStart[0] != '\0' ) {
+            const char *lineEnd = strstr( lineStart, "\n" );
+            int lineLength = strlen( lineStart );
+            if( lineEnd != NULL ) {
+                lineLength = lineEnd - lineStart;
+                }
+            printf( "        %.*s\n", lineLength, lineStart );
+
+            lineStart = &( lineStart[ lineLength ] );
+            if( lineStart[0] == '\n' ) {
+                lineStart = &( lineStart[1] );
+                }
+            }
+        printf( "\n" );
+        }
+
     exit( 1 );
     }
 
 
+
+SimpleVector<char*> optionNames;
+// NULL for options given without a value
+SimpleVector<char*> optionValues;
+
+
+
+// removes all options from inArgs, leaving only positional args behind
+static void parseOptions( int *ioNumArgs, char **ioArgs ) {
+    int numPositional = 1;
+
+    for( int i=1; i<*ioNumArgs; i++ ) {
+        char *arg = ioArgs[i];
+
+        if( strstr( arg, "--" ) != arg ) {
+            ioArgs[ numPositional ] = arg;
+            numPositional++;
+            continue;
+            }
+
+        char *name = stringDuplicate( &( arg[2] ) );
+        char *value = NULL;
+
+        char *equalPos = strstr( name, "=" );
+        if( equalPos != NULL ) {
+            value = stringDuplicate( &( equalPos[1] ) );
+            equalPos[0] = '\0';
+            }
+
+        char known = false;
+        for( int k=0; k<NUM_KNOWN_OPTIONS; k++ ) {
+            if( strcmp( knownOptions[k].name, name ) == 0 ) {
+                known = true;
+
+                if( ( knownOptions[k].valueName == NULL ) !=
+                    ( value == NULL ) ) {
+                    printf( "Option --%s used incorrectly\n", name );
+                    usage();
+                    }
+                break;
+                }
+            }
+
+        if( !known ) {
+            printf( "Unknown option --%s\n", name );
+            usage();
+            }
+
+        optionNames.push_back( name );
+        optionValues.push_back( value );
+        }
+
+    *ioNumArgs = numPositional;
+    }
+
+
+
+static char isOptionSet( const char *inName ) {
+    for( int i=0; i<optionNames.size(); i++ ) {
+        if( strcmp( optionNames.getElementDirect( i ), inName ) == 0 ) {
+            return true;
+            }
+        }
+    return false;
+    }
+
+
+
+// returns NULL if option not set
+// result destroyed internally
+static const char *getOptionValue( const char *inName ) {
+    for( int i=0; i<optionNames.size(); i++ ) {
+        if( strcmp( optionNames.getElementDirect( i ), inName ) == 0 ) {
+            return optionValues.getElementDirect( i );
+            }
+        }
+    return NULL;
+    }
+
+
 int inPipe;
 int outPipe;
 
+// false if we never started GDB at all
+char useGDB = true;
 
 
-char sendBuff[1024];
-
 
 FILE *logFile = NULL;
 
@@ -957,87 +1166,428 @@ static void log( const char *inHeader, char *inBody ) {
 static void sendCommand( const char *inCommand ) {
     log( "Sending command to GDB", (char*)inCommand );
 
-    sprintf( sendBuff, "%s\n", inCommand );
-    write( outPipe, sendBuff, strlen( sendBuff ) );
+    // commands can be as long as the paths in them, so the line end
+    // is sent along with the command rather than copied onto it
+    struct iovec parts[2] = { { (void*)inCommand, strlen( inCommand ) },
+                              { (void*)"\n", 1 } };
+    writev( outPipe, parts, 2 );
+    }
+
+
+
+// GDB quotes strings the way C does, with non-ASCII bytes as \ooo octal
+// unescapes the chars from inStart up to inEnd into outResult, which 
+// needs room for as many chars as that
+// returns the number of chars written (no \0 is added)
+static int unescapeGDBString( const char *inStart, const char *inEnd,
+                              char *outResult ) {
+    const char *c = inStart;
+    
+    int length = 0;
+    
+    while( c < inEnd ) {
+        if( c[0] == '\\' && c + 1 < inEnd ) {
+            c = &( c[1] );
+            
+            switch( c[0] ) {
+                case 'n':
+                    outResult[ length++ ] = '\n';
+                    break;
+                case 't':
+                    outResult[ length++ ] = '\t';
+                    break;
+                case 'r':
+                    outResult[ length++ ] = '\r';
+                    break;
+                case '0': case '1': case '2': case '3':
+                case '4': case '5': case '6': case '7': {
+                    int value = 0;
+                    int digits = 0;
+                    while( digits < 3 && c < inEnd && 
+                           c[0] >= '0' && c[0] <= '7' ) {
+                        value = value * 8 + ( c[0] - '0' );
+                        c = &( c[1] );
+                        digits++;
+                        }
+                    // step back onto last digit
+                    c = &( c[-1] );
+                    outResult[ length++ ] = (char)value;
+                    break;
+                    }
+                default:
+                    outResult[ length++ ] = c[0];
+                    break;
+                }
+            }
+        else {
+            outResult[ length++ ] = c[0];
+            }
+        c = &( c[1] );
+        }
+    
+    return length;
+    }
+
+
+
+// a command sent with a token, whose result record hasn't
+// necessarily come back yet
+typedef struct PendingCommand {
+        int token;
+        char answered;
+        // when its result record arrived
+        double answerTime;
+    } PendingCommand;
+
+
+SimpleVector<PendingCommand> pendingCommands;
+
+int nextCommandToken = 1;
+
+
+// sends inCommand with a numeric token in front, like 12-stack-list-frames
+// GDB echoes the token on the command's result record, so several
+// commands can be sent back to back without waiting for each answer
+// returns the token
+static int sendTokenCommand( const char *inCommand ) {
+    int token = nextCommandToken++;
+    
+    char *command = autoSprintf( "%d%s", token, inCommand );
+    sendCommand( command );
+    delete [] command;
+    
+    PendingCommand c = { token, false, 0 };
+    pendingCommands.push_back( c );
+    
+    return token;
     }
 
 
-// 65 KiB buffer
-// if GDB issues a single response that is longer than this
-// we will only return or processes the tail end of it.
-#define READ_BUFF_SIZE 65536
-char readBuff[READ_BUFF_SIZE];
+// GDB's whole response to a command, always \0-terminated
+// grows as needed, so long responses (deep stacks) are never cut short
+char *readBuff = NULL;
+int readBuffSize = 0;
 
 char anythingInReadBuff = false;
 char numReadAttempts = 0;
 
 
-#define BUFF_TAIL_SIZE 32768
-char tailBuff[ BUFF_TAIL_SIZE ];
+// GDB/MI output is a series of records, one per line:
+//    ^result   *exec-async   +status-async   =notify-async
+//    ~console  @target       &log            (gdb) prompt
+// result and async records can start with a numeric token
+typedef struct MIRecord {
+        // first character of record, after token, or '(' for the prompt
+        char type;
+        // numeric token in front of record, or -1 if none
+        int token;
+        // offset into readBuff of record, after token
+        int start;
+        // length, not counting line end
+        int length;
+    } MIRecord;
+
+
+// records in current contents of readBuff, in order
+SimpleVector<MIRecord> responseRecords;
+
+
+#define MIN_READ_BUFF_SIZE 65536
 
 
 char programExited = false;
 char detatchJustSent = false;
 
+// set if GDB takes commands while the target runs
+// without it (a plain run), GDB answers nothing until the target stops
+char gdbTargetAsync = false;
+
+
+// we used to retry reads after sleeping this long, so responses could
+// sit in the pipe for up to this long before we noticed them
+#define OLD_POLL_SLEEP_SECONDS 0.0002
+
+// how much of that extra latency we've saved by waking up right away
+// only counted while a sample has the target stopped, from the
+// interrupt through the resume, since that's the pause it would add to
+// (not detaching, or looking up names afterward)
+char countGDBPipeWaits = false;
+int numGDBPipeWaits = 0;
+double gdbPipeLatencySaved = 0;
+
+
+static double getMonotonicTime();
+
+static void trackGDBThreadRecord( MIRecord *inRecord );
+
+
+// how long to block at a time while waiting for GDB
+#define GDB_POLL_TIMEOUT_MS 1000
+
+
+// sleeps until GDB has written something for us to read
+// returns false if GDB has closed its end of the pipe
+static char waitForGDBOutput() {
+    struct pollfd p;
+    p.fd = inPipe;
+    p.events = POLLIN;
+    
+    double waitStart = getMonotonicTime();
+    
+    while( true ) {
+        p.revents = 0;
+        
+        int result = poll( &p, 1, GDB_POLL_TIMEOUT_MS );
+        
+        if( result == -1 ) {
+            if( errno == EINTR ) {
+                continue;
+                }
+            return false;
+            }
+        if( result == 0 ) {
+            // GDB may legitimately take a long time (waiting for the
+            // program to stop, for example), keep waiting
+            continue;
+            }
+        if( p.revents & POLLIN ) {
+            break;
+            }
+        // hang up or error, with nothing left to read
+        return false;
+        }
+
+    if( countGDBPipeWaits ) {
+        double waited = getMonotonicTime() - waitStart;
+        
+        // old loop would have noticed this only at the end of a sleep
+        double oldWait = 
+            ceil( waited / OLD_POLL_SLEEP_SECONDS ) * OLD_POLL_SLEEP_SECONDS;
+        
+        numGDBPipeWaits++;
+        gdbPipeLatencySaved += oldWait - waited;
+        }
+    
+    return true;
+    }
+
+
+static void growReadBuff( int inSizeNeeded ) {
+    if( inSizeNeeded <= readBuffSize ) {
+        return;
+        }
+    
+    int newSize = readBuffSize * 2;
+    if( newSize < MIN_READ_BUFF_SIZE ) {
+        newSize = MIN_READ_BUFF_SIZE;
+        }
+    while( newSize < inSizeNeeded ) {
+        newSize *= 2;
+        }
+    
+    char *newBuff = new char[ newSize ];
+    
+    if( readBuff != NULL ) {
+        memcpy( newBuff, readBuff, readBuffSize );
+        delete [] readBuff;
+        }
+    readBuff = newBuff;
+    readBuffSize = newSize;
+    }
+
+
+
+// splits off one complete line of output as a record
+static MIRecord classifyMIRecord( int inStart, int inLength ) {
+    MIRecord r;
+    r.token = -1;
+    r.start = inStart;
+    r.length = inLength;
+    
+    char *line = &( readBuff[ inStart ] );
+    
+    // skip token
+    int tokenLength = 0;
+    while( tokenLength < inLength && 
+           line[ tokenLength ] >= '0' && line[ tokenLength ] <= '9' ) {
+        tokenLength++;
+        }
+    if( tokenLength > 0 && tokenLength < inLength ) {
+        r.token = atoi( line );
+        r.start += tokenLength;
+        r.length -= tokenLength;
+        line = &( line[ tokenLength ] );
+        }
+    
+    if( r.length > 0 ) {
+        r.type = line[0];
+        }
+    else {
+        r.type = '\0';
+        }
+    
+    return r;
+    }
+
+
 
+// true if inRecord's text contains inString
+static char recordContains( MIRecord *inRecord, const char *inString ) {
+    int stringLength = strlen( inString );
+    char *text = &( readBuff[ inRecord->start ] );
+    
+    for( int i=0; i <= inRecord->length - stringLength; i++ ) {
+        if( memcmp( &( text[i] ), inString, stringLength ) == 0 ) {
+            return true;
+            }
+        }
+    return false;
+    }
+
+
+
+// true if inRecord's text starts with inString
+static char recordStartsWith( MIRecord *inRecord, const char *inString ) {
+    int stringLength = strlen( inString );
+    
+    return inRecord->length >= stringLength &&
+        memcmp( &( readBuff[ inRecord->start ] ), 
+                inString, stringLength ) == 0;
+    }
+
+
+
+// reads until we have a full response (ending with a (gdb) prompt), 
+// and, if inWaitingFor is set, until a record containing inWaitingFor 
+// has arrived too
+// if tokened commands are pending, reads until all of their results
+// have arrived, so readBuff can hold several responses
+// only newly arrived bytes are scanned, and each complete line is
+// added to responseRecords as it arrives
 static int fillBufferWithResponse( const char *inWaitingFor = NULL ) {
     int readSoFar = 0;
     anythingInReadBuff = false;
     numReadAttempts = 0;
     
+    // keep the records' memory around for the next response
+    responseRecords.deleteStartElements( responseRecords.size() );
+    
+    // start of first line not yet split off as a record
+    int lineStart = 0;
+    
+    char sawPrompt = false;
+    char sawWaitingFor = ( inWaitingFor == NULL );
+    
+    // results we still need for tokened commands
+    int numUnanswered = 0;
+    for( int c=0; c<pendingCommands.size(); c++ ) {
+        if( ! pendingCommands.getElement( c )->answered ) {
+            numUnanswered++;
+            }
+        }
+    
+    growReadBuff( MIN_READ_BUFF_SIZE );
+    readBuff[0] = '\0';
+
     while( true ) {
         
-        if( readSoFar >= READ_BUFF_SIZE - 1 ) {
-            // we've filled up our read buffer
-            
-            // save the last bit of it, but discard the rest
-            
-            // copy end, including last \0
-            memcpy( tailBuff, 
-                    &( readBuff[ readSoFar + 1 - BUFF_TAIL_SIZE ] ),
-                    BUFF_TAIL_SIZE );
-            
-            memcpy( readBuff, tailBuff, BUFF_TAIL_SIZE );
-
-            readSoFar = BUFF_TAIL_SIZE - 1;
+        if( readBuffSize - readSoFar < MIN_READ_BUFF_SIZE / 4 ) {
+            growReadBuff( readBuffSize * 2 );
             }
         
         numReadAttempts++;
         
         int numRead = 
             read( inPipe, &( readBuff[readSoFar] ), 
-                  ( READ_BUFF_SIZE - 1 ) - readSoFar );
+                  ( readBuffSize - 1 ) - readSoFar );
         
         if( numRead > 0 ) {
             anythingInReadBuff = true;
             
+            int scanStart = readSoFar;
+            
             readSoFar += numRead;
             
             readBuff[ readSoFar ] = '\0';
-        
-            if( strstr( readBuff, "(gdb)" ) != NULL &&
-                ( inWaitingFor == NULL ||
-                  strstr( readBuff, inWaitingFor ) != NULL ) ) {
+            
+            char programJustExited = false;
+            
+            for( int i=scanStart; i<readSoFar; i++ ) {
+                if( readBuff[i] != '\n' ) {
+                    continue;
+                    }
+                
+                int lineLength = i - lineStart;
+                if( lineLength > 0 && readBuff[ i - 1 ] == '\r' ) {
+                    lineLength --;
+                    }
+                
+                MIRecord r = classifyMIRecord( lineStart, lineLength );
+                lineStart = i + 1;
+
+                if( r.type == '\0' ) {
+                    continue;
+                    }
+                responseRecords.push_back( r );
+                
+                if( r.type == '(' && recordStartsWith( &r, "(gdb)" ) ) {
+                    sawPrompt = true;
+                    }
+                else if( r.type == '^' ) {
+                    // a response isn't whole until its own prompt
+                    sawPrompt = false;
+                    
+                    if( r.token >= 0 ) {
+                        for( int c=0; c<pendingCommands.size(); c++ ) {
+                            PendingCommand *p = 
+                                pendingCommands.getElement( c );
+                            if( p->token == r.token ) {
+                                p->answered = true;
+                                p->answerTime = getMonotonicTime();
+                                numUnanswered--;
+                                break;
+                                }
+                            }
+                        }
+                    }
+                else if( r.type == '=' ) {
+                    trackGDBThreadRecord( &r );
+                    }
+                
+                if( inWaitingFor != NULL && ! sawWaitingFor &&
+                    recordContains( &r, inWaitingFor ) ) {
+                    sawWaitingFor = true;
+                    }
+                
+                if( r.type == '=' && ! detatchJustSent &&
+                    recordStartsWith( &r, "=thread-group-exited" ) ) {
+                    programJustExited = true;
+                    }
+                }
+            
+            if( sawPrompt && sawWaitingFor && numUnanswered == 0 ) {
                 // read full response
                 return readSoFar;
                 }
-            else if( readSoFar > 10 &&
-                     ! detatchJustSent &&
-                     strstr( readBuff, "thread-group-exited" ) != NULL ) {
+            else if( programJustExited ) {
                 // stop waiting for full response, program has exited
                 programExited = true;
                 return readSoFar;
                 }
             }
+        else if( numRead == 0 ) {
+            printf( "GDB closed its output pipe\n" );
+            return readSoFar;
+            }
         else if( numRead == -1 ) {
             if( !( errno == EAGAIN || errno == EWOULDBLOCK ) ) {
                 char *errorString = strerror( errno );
                 printf( "Error in reading from GDB pipe: %s\n", errorString );
                 return readSoFar;
                 }
-            else {
-                // sleep to avoid CPU starving pipe sender
-                usleep( 200 );
+            else if( ! waitForGDBOutput() ) {
+                printf( "GDB closed its output pipe\n" );
+                return readSoFar;
                 }
             }
         }
@@ -1141,334 +1691,9354 @@ static char *getGDBResponse() {
 
 
 
-typedef struct StackFrame{
-        void *address;
-        char *funcName;
-        char *fileName;
-        int lineNum;
-    } StackFrame;
-
-
-typedef struct Stack {
-        SimpleVector<StackFrame> frames;
-        int sampleCount;
-    } Stack;
-
-
-
-typedef struct FunctionRecord {
-        char *funcName;
-        int sampleCount;
-    } FunctionRecord;
-    
-    
-
-
-SimpleVector<Stack> stackLog;
+// **************************************
+// GDB/MI values, parsed in place in readBuff
 
+// Result records look like ^done,name=value,name=value where each value
+// is a "c-string", a {tuple} of name=value results, or a [list] of 
+// values or results.  Rather than copying pieces out, we walk over 
+// them where they sit.
 
-// these are for counting repeated common stack roots
-// they do NOT need to be freed (they cointain poiters to strings
-// in the main stack log)
-#define NUM_ROOT_STACKS_TO_TRACK 15
-SimpleVector<Stack> stackRootLog[ NUM_ROOT_STACKS_TO_TRACK ];
 
+typedef struct MIValue {
+        // '"' for c-string, '{' for tuple, '[' for list, 
+        // or '\0' for the bare result list at the end of a record
+        char type;
+        // for strings, tuples and lists, these include the delimiters
+        const char *start;
+        // one past the end
+        const char *end;
+    } MIValue;
 
 
 
-// does not make sense to call this unless depth less than full stack depth
-Stack getRoot( Stack inFullStack, int inDepth ) {
-    Stack newStack;
-    newStack.sampleCount = 1;
-    int numToSkip = inFullStack.frames.size() - inDepth;
+// returns pointer just past the end of the value starting at inPos,
+// or NULL if it's cut off or malformed
+static const char *skipMIValue( const char *inPos, const char *inEnd ) {
+    if( inPos >= inEnd ) {
+        return NULL;
+        }
+    
+    if( inPos[0] == '"' ) {
+        const char *c = &( inPos[1] );
+        
+        while( c < inEnd ) {
+            if( c[0] == '\\' ) {
+                c = &( c[2] );
+                }
+            else if( c[0] == '"' ) {
+                return &( c[1] );
+                }
+            else {
+                c = &( c[1] );
+                }
+            }
+        return NULL;
+        }
     
-    for( int i=numToSkip; i<inFullStack.frames.size(); i++ ) {
-        newStack.frames.push_back( inFullStack.frames.getElementDirect( i ) );
+    if( inPos[0] == '{' || inPos[0] == '[' ) {
+        char close = ( inPos[0] == '{' ) ? '}' : ']';
+        
+        const char *c = &( inPos[1] );
+        
+        while( c < inEnd ) {
+            if( c[0] == close ) {
+                return &( c[1] );
+                }
+            else if( c[0] == '"' || c[0] == '{' || c[0] == '[' ) {
+                c = skipMIValue( c, inEnd );
+                
+                if( c == NULL ) {
+                    return NULL;
+                    }
+                }
+            else {
+                // names, = and ,
+                c = &( c[1] );
+                }
+            }
+        return NULL;
         }
     
-    return newStack;
+    return NULL;
     }
 
 
 
-
-
-static char stackCompare( Stack *inA, Stack *inB ) {
-    if( inA->frames.size() != inB->frames.size() ) {
+// steps to the next item in a tuple or list
+// *ioPos starts at the contents of the tuple or list (or at 
+// the start of a bare result list) and is advanced past the item
+// outName is set to NULL for list items that have no name
+// returns false when there are no more items
+static char nextMIItem( const char **ioPos, const char *inEnd,
+                        const char **outName, int *outNameLength,
+                        MIValue *outValue ) {
+    const char *c = *ioPos;
+    
+    if( c < inEnd && c[0] == ',' ) {
+        c = &( c[1] );
+        }
+    
+    if( c >= inEnd ) {
         return false;
         }
-    for( int i=0; i<inA->frames.size(); i++ ) {
-        if( inA->frames.getElementDirect( i ).address !=
-            inB->frames.getElementDirect( i ).address ) {
+    
+    *outName = NULL;
+    *outNameLength = 0;
+    
+    if( c[0] != '"' && c[0] != '{' && c[0] != '[' ) {
+        // name=value
+        const char *nameStart = c;
+        
+        while( c < inEnd && c[0] != '=' ) {
+            c = &( c[1] );
+            }
+        if( c >= inEnd ) {
             return false;
-            }    
+            }
+        *outName = nameStart;
+        *outNameLength = c - nameStart;
+        
+        // skip =
+        c = &( c[1] );
+        }
+    
+    const char *valueEnd = skipMIValue( c, inEnd );
+    
+    if( valueEnd == NULL ) {
+        return false;
         }
+    
+    outValue->type = c[0];
+    outValue->start = c;
+    outValue->end = valueEnd;
+    
+    *ioPos = valueEnd;
     return true;
     }
 
 
-static void freeStack( Stack *inStack ) {
-    for( int i=0; i<inStack->frames.size(); i++ ) {
-        StackFrame f = inStack->frames.getElementDirect( i );
-        delete [] f.funcName;
-        delete [] f.fileName;
+
+// where items of inValue start and end
+static void getMIContents( MIValue *inValue, 
+                           const char **outStart, const char **outEnd ) {
+    if( inValue->type == '\0' ) {
+        *outStart = inValue->start;
+        *outEnd = inValue->end;
+        }
+    else {
+        // skip delimiters
+        *outStart = &( inValue->start[1] );
+        *outEnd = &( inValue->end[-1] );
         }
-    inStack->frames.deleteAll();
     }
 
 
+
+// finds a named item in a tuple (or list of results)
+static char findMIField( MIValue *inValue, const char *inName,
+                         MIValue *outField ) {
+    const char *pos, *end;
+    getMIContents( inValue, &pos, &end );
+    
+    int nameLength = strlen( inName );
+    
+    const char *name;
+    int length;
+    
+    while( nextMIItem( &pos, end, &name, &length, outField ) ) {
+        if( name != NULL && length == nameLength &&
+            memcmp( name, inName, nameLength ) == 0 ) {
+            return true;
+            }
+        }
+    return false;
+    }
+
+
+
+// finds the result record in readBuff with inResultClass (like "done"),
+// and gets its list of results
+// inToken picks out the answer to one tokened command, -1 for any
+static char getMIResults( const char *inResultClass, 
+                          MIValue *outResults, int inToken = -1 ) {
+    int classLength = strlen( inResultClass );
+    
+    for( int i=0; i<responseRecords.size(); i++ ) {
+        MIRecord *r = responseRecords.getElement( i );
+        
+        const char *text = &( readBuff[ r->start ] );
+        
+        if( r->type == '^' &&
+            ( inToken == -1 || r->token == inToken ) &&
+            r->length > classLength &&
+            memcmp( &( text[1] ), inResultClass, classLength ) == 0 ) {
+            
+            // results start after ^class
+            outResults->type = '\0';
+            outResults->start = &( text[ 1 + classLength ] );
+            outResults->end = &( text[ r->length ] );
+            return true;
+            }
+        }
+    return false;
+    }
+
+
+
+// writes a c-string value into outResult, without quotes and escapes
+// outResult needs room for as many chars as are between the quotes
+// returns the number of chars written (no \0 is added)
+static int unescapeMIString( MIValue *inValue, char *outResult ) {
+    return unescapeGDBString( &( inValue->start[1] ), &( inValue->end[-1] ),
+                              outResult );
+    }
+
+
+
+
+
+
+typedef struct StackFrame{
+        void *address;
+        char *funcName;
+        char *fileName;
+        int lineNum;
+    } StackFrame;
+
+
+typedef struct Stack {
+        SimpleVector<StackFrame> frames;
+        int sampleCount;
+        // wall-clock time that this stack's samples stand for
+        double sampleSeconds;
+        // index into threadLog, or -1 if we're not tracking threads
+        int threadIndex;
+        // share of this stack's time spent running, from --perf samples,
+        // or -1 if unknown
+        float onCPUFraction;
+    } Stack;
+
+
+
+typedef struct ThreadRecord {
+        // GDB's thread number, or kernel TID for native sampling
+        int id;
+        char *name;
+        int sampleCount;
+        double sampleSeconds;
+    } ThreadRecord;
+
+
+char sampleAllThreads = false;
+
+
+// samples are weighted by the wall-clock time since the previous sample,
+// since they aren't evenly spaced
+typedef struct SampleRecord {
+        // seconds since sampling started
+        double time;
+        // seconds since the previous sample (or the start)
+        double interval;
+        
+        // how long the target was paused for this sample, in phases:
+        // from asking for the stop until the stop was confirmed
+        double stopSeconds;
+        // from the stop until all stacks were captured
+        double captureSeconds;
+        // from capture until the target was confirmed running again
+        double resumeSeconds;
+    } SampleRecord;
+
+SimpleVector<SampleRecord> sampleRecords;
+
+// interval of the sample whose stacks are being added right now
+double currentSampleWeight = 0;
+
+
+// getMonotonicTime values for each phase of the current sample's pause
+typedef struct PauseTimes {
+        double interrupted;
+        double stopped;
+        double captured;
+        double resumed;
+    } PauseTimes;
+
+PauseTimes currentPause;
+
+// only record frame addresses while sampling, and look up names after
+char lazySymbols = false;
+
+// frame filters are skipped in lazy mode, since we don't need 
+// anything but addresses
+const char *stackListCommand = "-stack-list-frames";
+
+SimpleVector<ThreadRecord> threadLog;
+
+
+// these write to the sample log, if there is one
+static void logThreadRecord( int inThreadIndex );
+static void logStringRecord( const char *inString, int inLength );
+static void logFrameRecord( StackFrame *inFrame );
+static void logMapsRecord();
+
+
+
+// finds thread, or adds it if it's new
+// updates name of thread if inName has changed
+static int getThreadIndex( int inID, const char *inName ) {
+    for( int i=0; i<threadLog.size(); i++ ) {
+        ThreadRecord *t = threadLog.getElement( i );
+        
+        if( t->id == inID ) {
+            if( strcmp( t->name, inName ) != 0 ) {
+                delete [] t->name;
+                t->name = stringDuplicate( inName );
+                logThreadRecord( i );
+                }
+            return i;
+            }
+        }
+    
+    ThreadRecord t = { inID, stringDuplicate( inName ), 0, 0 };
+    threadLog.push_back( t );
+    
+    logThreadRecord( threadLog.size() - 1 );
+    
+    return threadLog.size() - 1;
+    }
+
+
+
+typedef struct FunctionRecord {
+        char *funcName;
+        int sampleCount;
+        double sampleSeconds;
+    } FunctionRecord;
+    
+    
+
+
+SimpleVector<Stack> stackLog;
+
+
+
+static char addStackSample( unsigned int *inFrameIDs, int inNumFrames,
+                            int inThreadIndex, 
+                            int inCount, double inSeconds );
+
+
+
+// frame names are interned, so they aren't the stack's to free
+static void freeStack( Stack *inStack ) {
+    inStack->frames.deleteAll();
+    }
+
+
+
+// open-addressing hash table over a vector of records (stacks, frames,
+// strings), so finding a record we've seen before doesn't mean 
+// comparing it against every record we've seen
+typedef struct HashIndex {
+        // index+1 into the vector of records, or 0 for an empty slot
+        int *slots;
+        // full hash of the record in each slot, so that growing doesn't
+        // have to rehash records, and probes can skip most compares
+        unsigned int *slotHashes;
+        // always a power of 2
+        int numSlots;
+        int numUsed;
+    } HashIndex;
+
+
+// grow when table is this full
+#define HASH_INDEX_MAX_LOAD 0.5
+
+#define HASH_INDEX_MIN_SLOTS 1024
+
+
+// stacks are keyed by thread and frame IDs
+HashIndex stackLogIndex = { NULL, NULL, 0, 0 };
+
+
+
+static void placeInHashIndex( HashIndex *inIndex, int inSlotValue,
+                              unsigned int inHash ) {
+    int mask = inIndex->numSlots - 1;
+    int s = inHash & mask;
+    
+    while( inIndex->slots[s] != 0 ) {
+        s = ( s + 1 ) & mask;
+        }
+    inIndex->slots[s] = inSlotValue;
+    inIndex->slotHashes[s] = inHash;
+    }
+
+
+
+// calls inMatches with the record number of each record in inIndex
+// that has inHash, until one matches inKey
+// returns the matching record number, or -1 if there isn't one
+static int findInHashIndex( HashIndex *inIndex, unsigned int inHash,
+                            char (*inMatches)( int inNumber, void *inKey ),
+                            void *inKey ) {
+    if( inIndex->numSlots == 0 ) {
+        return -1;
+        }
+    
+    int mask = inIndex->numSlots - 1;
+    int s = inHash & mask;
+    
+    while( inIndex->slots[s] != 0 ) {
+        if( inIndex->slotHashes[s] == inHash ) {
+            int i = inIndex->slots[s] - 1;
+            
+            if( inMatches( i, inKey ) ) {
+                return i;
+                }
+            }
+        s = ( s + 1 ) & mask;
+        }
+    return -1;
+    }
+
+
+
+// adds the record at inNumber in its vector to inIndex
+static void addToHashIndex( HashIndex *inIndex, int inNumber,
+                            unsigned int inHash ) {
+    if( inIndex->numUsed + 1 > 
+        inIndex->numSlots * HASH_INDEX_MAX_LOAD ) {
+        
+        HashIndex oldIndex = *inIndex;
+        
+        inIndex->numSlots *= 2;
+        if( inIndex->numSlots < HASH_INDEX_MIN_SLOTS ) {
+            inIndex->numSlots = HASH_INDEX_MIN_SLOTS;
+            }
+        inIndex->slots = new int[ inIndex->numSlots ];
+        inIndex->slotHashes = new unsigned int[ inIndex->numSlots ];
+        
+        memset( inIndex->slots, 0, inIndex->numSlots * sizeof( int ) );
+        
+        for( int s=0; s<oldIndex.numSlots; s++ ) {
+            if( oldIndex.slots[s] != 0 ) {
+                placeInHashIndex( inIndex, oldIndex.slots[s],
+                                  oldIndex.slotHashes[s] );
+                }
+            }
+        if( oldIndex.slots != NULL ) {
+            delete [] oldIndex.slots;
+            delete [] oldIndex.slotHashes;
+            }
+        }
+    
+    placeInHashIndex( inIndex, inNumber + 1, inHash );
+    inIndex->numUsed++;
+    }
+
+
+
+static void freeHashIndex( HashIndex *inIndex ) {
+    if( inIndex->slots != NULL ) {
+        delete [] inIndex->slots;
+        delete [] inIndex->slotHashes;
+        }
+    inIndex->slots = NULL;
+    inIndex->slotHashes = NULL;
+    inIndex->numSlots = 0;
+    inIndex->numUsed = 0;
+    }
+
+
+
+// **************************************
+// interned names and frames
+
+// Sampling sees the same frames over and over.  Each name is stored
+// once in a string table, each unique frame once in a frame table, and
+// stacks are kept as arrays of 32-bit frame IDs until sampling is over,
+// so memory grows with the number of unique frames and stacks, not with
+// the number of samples.  Each stop's stacks are parsed into scratch 
+// vectors that are cleared without being freed, so once the deepest 
+// stack has come through, a sample of a known stack doesn't touch the 
+// heap at all.
+
+
+// interned strings are packed into blocks that never move, so they can
+// be handed out as plain pointers
+#define STRING_BLOCK_SIZE 65536
+
+SimpleVector<char*> stringBlocks;
+
+char *currentStringBlock = NULL;
+int currentStringBlockUsed = 0;
+
+// every interned string, in the order they were interned
+SimpleVector<char*> internedStrings;
+
+HashIndex internedStringIndex = { NULL, NULL, 0, 0 };
+
+
+
+static unsigned int hashBytes( const char *inBytes, int inLength ) {
+    // FNV-1a
+    unsigned int h = 2166136261U;
+    
+    for( int i=0; i<inLength; i++ ) {
+        h ^= (unsigned char)inBytes[i];
+        h *= 16777619U;
+        }
+    return h;
+    }
+
+
+
+typedef struct StringKey {
+        const char *start;
+        int length;
+    } StringKey;
+
+
+
+static char internedStringMatches( int inNumber, void *inKey ) {
+    StringKey *key = (StringKey*)inKey;
+    char *s = internedStrings.getElementDirect( inNumber );
+    
+    return strncmp( s, key->start, key->length ) == 0 &&
+        s[ key->length ] == '\0';
+    }
+
+
+
+// returns the table's copy of the inLength chars at inString (which 
+// needn't be \0-terminated), adding one if needed
+// equal strings always get the same copy, so interned strings can be
+// compared by pointer
+// result lives until freeInternedNames, and must not be destroyed
+static char *internString( const char *inString, int inLength ) {
+    unsigned int hash = hashBytes( inString, inLength );
+    
+    StringKey key = { inString, inLength };
+    
+    int found = findInHashIndex( &internedStringIndex, hash,
+                                 internedStringMatches, &key );
+    if( found != -1 ) {
+        return internedStrings.getElementDirect( found );
+        }
+    
+    char *copy;
+    
+    if( inLength + 1 > STRING_BLOCK_SIZE / 4 ) {
+        // too big to pack, gets a block of its own
+        copy = new char[ inLength + 1 ];
+        stringBlocks.push_back( copy );
+        }
+    else {
+        if( currentStringBlock == NULL ||
+            currentStringBlockUsed + inLength + 1 > STRING_BLOCK_SIZE ) {
+            
+            currentStringBlock = new char[ STRING_BLOCK_SIZE ];
+            currentStringBlockUsed = 0;
+            stringBlocks.push_back( currentStringBlock );
+            }
+        copy = &( currentStringBlock[ currentStringBlockUsed ] );
+        currentStringBlockUsed += inLength + 1;
+        }
+    
+    memcpy( copy, inString, inLength );
+    copy[ inLength ] = '\0';
+    
+    internedStrings.push_back( copy );
+    addToHashIndex( &internedStringIndex, internedStrings.size() - 1, 
+                    hash );
+    
+    logStringRecord( copy, inLength );
+    
+    return copy;
+    }
+
+
+
+// every unique frame, where a frame's ID is its index
+// names are interned, or NULL for frames that only have addresses
+SimpleVector<StackFrame> frameTable;
+
+HashIndex frameTableIndex = { NULL, NULL, 0, 0 };
+
+
+
+static unsigned int hashFrame( StackFrame *inFrame ) {
+    // interned names are equal only if their pointers are
+    uint64_t h = 14695981039346656037ULL;
+    
+    uint64_t parts[4] = { (uint64_t)(uintptr_t)inFrame->address,
+                          (uint64_t)(uintptr_t)inFrame->funcName,
+                          (uint64_t)(uintptr_t)inFrame->fileName,
+                          (uint64_t)(unsigned int)inFrame->lineNum };
+    
+    for( int i=0; i<4; i++ ) {
+        h ^= parts[i];
+        h *= 1099511628211ULL;
+        h ^= h >> 29;
+        }
+    
+    return (unsigned int)( h ^ ( h >> 32 ) );
+    }
+
+
+
+static char frameMatches( int inNumber, void *inKey ) {
+    StackFrame *a = frameTable.getElement( inNumber );
+    StackFrame *b = (StackFrame*)inKey;
+    
+    return a->address == b->address &&
+        a->funcName == b->funcName &&
+        a->fileName == b->fileName &&
+        a->lineNum == b->lineNum;
+    }
+
+
+
+// inFrame's names must already be interned
+// returns the ID of inFrame in frameTable, adding it if needed
+static unsigned int internFrame( StackFrame inFrame ) {
+    unsigned int hash = hashFrame( &inFrame );
+    
+    int found = findInHashIndex( &frameTableIndex, hash,
+                                 frameMatches, &inFrame );
+    if( found != -1 ) {
+        return found;
+        }
+    
+    frameTable.push_back( inFrame );
+    addToHashIndex( &frameTableIndex, frameTable.size() - 1, hash );
+    
+    logFrameRecord( &inFrame );
+    
+    return frameTable.size() - 1;
+    }
+
+
+
+static void freeInternedNames() {
+    for( int i=0; i<stringBlocks.size(); i++ ) {
+        delete [] stringBlocks.getElementDirect( i );
+        }
+    stringBlocks.deleteAll();
+    internedStrings.deleteAll();
+    currentStringBlock = NULL;
+    currentStringBlockUsed = 0;
+    
+    freeHashIndex( &internedStringIndex );
+    }
+
+
+
+// frames of a stack in stackLog or perfStackLog, as frame IDs, 
+// innermost first
+// stacks only get their frames filled in from frameTable once sampling
+// is over, by expandStackFrames
+typedef struct StackKey {
+        unsigned int *frameIDs;
+        int numFrames;
+    } StackKey;
+
+
+// parallel to stackLog while sampling
+SimpleVector<StackKey> stackLogKeys;
+
+
+
+static unsigned int hashFrameIDs( unsigned int *inFrameIDs, 
+                                  int inNumFrames, int inThreadIndex ) {
+    uint64_t h = 14695981039346656037ULL;
+    
+    h ^= (uint64_t)( inThreadIndex + 1 );
+    h *= 1099511628211ULL;
+    
+    for( int i=0; i<inNumFrames; i++ ) {
+        h ^= inFrameIDs[i];
+        h *= 1099511628211ULL;
+        }
+    
+    return (unsigned int)( h ^ ( h >> 32 ) );
+    }
+
+
+
+typedef struct StackLookup {
+        SimpleVector<Stack> *stacks;
+        SimpleVector<StackKey> *keys;
+        unsigned int *frameIDs;
+        int numFrames;
+        int threadIndex;
+    } StackLookup;
+
+
+
+static char stackKeyMatches( int inNumber, void *inKey ) {
+    StackLookup *l = (StackLookup*)inKey;
+    StackKey *k = l->keys->getElement( inNumber );
+    
+    return k->numFrames == l->numFrames &&
+        l->stacks->getElement( inNumber )->threadIndex == l->threadIndex &&
+        memcmp( k->frameIDs, l->frameIDs, 
+                l->numFrames * sizeof( unsigned int ) ) == 0;
+    }
+
+
+
+// finds the stack of inFrameIDs in inStacks, or adds it with no 
+// samples and a copy of inFrameIDs as its key
+// sets outIsNew if it was added
+static int findOrAddStack( SimpleVector<Stack> *inStacks,
+                           SimpleVector<StackKey> *inKeys,
+                           HashIndex *inIndex,
+                           unsigned int *inFrameIDs, int inNumFrames,
+                           int inThreadIndex, char *outIsNew ) {
+    unsigned int hash = 
+        hashFrameIDs( inFrameIDs, inNumFrames, inThreadIndex );
+    
+    StackLookup lookup = { inStacks, inKeys, inFrameIDs, inNumFrames,
+                           inThreadIndex };
+    
+    int found = findInHashIndex( inIndex, hash, stackKeyMatches, &lookup );
+    
+    *outIsNew = ( found == -1 );
+    
+    if( found != -1 ) {
+        return found;
+        }
+    
+    Stack newStack;
+    newStack.sampleCount = 0;
+    newStack.sampleSeconds = 0;
+    newStack.threadIndex = inThreadIndex;
+    newStack.onCPUFraction = -1;
+    
+    inStacks->push_back( newStack );
+    
+    StackKey key;
+    key.frameIDs = new unsigned int[ inNumFrames ];
+    key.numFrames = inNumFrames;
+    memcpy( key.frameIDs, inFrameIDs, inNumFrames * sizeof( unsigned int ) );
+    
+    inKeys->push_back( key );
+    
+    addToHashIndex( inIndex, inStacks->size() - 1, hash );
+    
+    return inStacks->size() - 1;
+    }
+
+
+
+// once no more samples are coming in, gives each stack its frames 
+// from frameTable, and frees the keys
+static void expandStackFrames( SimpleVector<Stack> *inStacks,
+                               SimpleVector<StackKey> *inKeys ) {
+    for( int i=0; i<inKeys->size(); i++ ) {
+        Stack *s = inStacks->getElement( i );
+        StackKey *k = inKeys->getElement( i );
+        
+        for( int f=0; f<k->numFrames; f++ ) {
+            s->frames.push_back( 
+                frameTable.getElementDirect( k->frameIDs[f] ) );
+            }
+        delete [] k->frameIDs;
+        }
+    inKeys->deleteAll();
+    }
+
+
+
+// stacks of the current sample, before they're added to stackLog
+// frame IDs for all of them are back to back in sampleFrameIDs
+typedef struct SampleStack {
+        int firstFrame;
+        int numFrames;
+        int threadIndex;
+    } SampleStack;
+
+SimpleVector<SampleStack> sampleStacks;
+SimpleVector<unsigned int> sampleFrameIDs;
+
+
+
+// cleared with deleteStartElements, which keeps their memory around
+// for the next sample
+static void clearSampleStacks() {
+    sampleStacks.deleteStartElements( sampleStacks.size() );
+    sampleFrameIDs.deleteStartElements( sampleFrameIDs.size() );
+    }
+
+
+
+// following addSampleFrame calls add to this stack
+static void startSampleStack( int inThreadIndex ) {
+    SampleStack s = { sampleFrameIDs.size(), 0, inThreadIndex };
+    sampleStacks.push_back( s );
+    }
+
+
+
+// inFrame's names must already be interned
+static void addSampleFrame( StackFrame inFrame ) {
+    sampleFrameIDs.push_back( internFrame( inFrame ) );
+    sampleStacks.getLastElement()->numFrames++;
+    }
+
+
+
+// adds the samples of stack inIndex in sampleStacks
+// returns true if that stack had not been seen before
+static char addSampleStack( int inIndex, int inCount, double inSeconds ) {
+    SampleStack *s = sampleStacks.getElement( inIndex );
+    
+    if( s->numFrames == 0 ) {
+        return false;
+        }
+    
+    return addStackSample( sampleFrameIDs.getElement( s->firstFrame ),
+                           s->numFrames, s->threadIndex, 
+                           inCount, inSeconds );
+    }
+
+
+
+// escapes only ever make strings shorter, so this grows to fit the
+// longest quoted string we've had to unescape, and no further
+char *miStringScratch = NULL;
+int miStringScratchSize = 0;
+
+
+
+// interned copy of a c-string value, without quotes and escapes
+static char *internMIString( MIValue *inValue ) {
+    if( inValue->type != '"' ) {
+        return internString( "", 0 );
+        }
+    
+    const char *c = &( inValue->start[1] );
+    int rawLength = inValue->end - inValue->start - 2;
+    
+    if( memchr( c, '\\', rawLength ) == NULL ) {
+        // nothing to unescape, intern it right out of readBuff
+        return internString( c, rawLength );
+        }
+    
+    if( rawLength > miStringScratchSize ) {
+        if( miStringScratch != NULL ) {
+            delete [] miStringScratch;
+            }
+        miStringScratchSize = rawLength;
+        miStringScratch = new char[ miStringScratchSize ];
+        }
+    
+    int length = unescapeMIString( inValue, miStringScratch );
+    
+    return internString( miStringScratch, length );
+    }
+
+
+
+// **************************************
+// source paths
+
+// File names in frames are the ones the compiler recorded, which are 
+// often relative to the directory the target was built in, not to ours.
+// A source file is only ever opened through the absolute path that GDB 
+// (as fullname) or the target's DWARF (with its compilation directory)
+// gives for that name.  A name that turns up with two different paths,
+// or without one, gets none, and its lines are left to GDB's list.
+
+
+typedef struct SourcePath {
+        // both interned
+        const char *name;
+        // NULL if not known for sure
+        const char *path;
+    } SourcePath;
+
+
+SimpleVector<SourcePath> sourcePaths;
+
+HashIndex sourcePathIndex = { NULL, NULL, 0, 0 };
+
+
+
+static char sourcePathMatches( int inNumber, void *inKey ) {
+    return strcmp( sourcePaths.getElement( inNumber )->name, 
+                   (const char*)inKey ) == 0;
+    }
+
+
+
+static SourcePath *findSourcePath( const char *inName ) {
+    int found = findInHashIndex( &sourcePathIndex, 
+                                 hashBytes( inName, strlen( inName ) ),
+                                 sourcePathMatches, (void*)inName );
+    if( found == -1 ) {
+        return NULL;
+        }
+    return sourcePaths.getElement( found );
+    }
+
+
+
+// inPath is interned, or NULL if this occurrence of inName has no path
+static void recordSourcePath( const char *inName, const char *inPath ) {
+    if( inPath != NULL && inPath[0] != '/' ) {
+        inPath = NULL;
+        }
+    
+    SourcePath *p = findSourcePath( inName );
+    
+    if( p != NULL ) {
+        if( p->path != inPath ) {
+            // names more than one file, or not always resolved
+            p->path = NULL;
+            }
+        return;
+        }
+    
+    SourcePath newP;
+    newP.name = internString( inName, strlen( inName ) );
+    newP.path = inPath;
+    
+    sourcePaths.push_back( newP );
+    addToHashIndex( &sourcePathIndex, sourcePaths.size() - 1,
+                    hashBytes( inName, strlen( inName ) ) );
+    }
+
+
+
+// inFullName is a frame's fullname value, or NULL if it had none
+// called for every frame GDB sends, so a name that's already known with
+// the same path is checked without copying anything
+static void recordFrameSourcePath( const char *inName, 
+                                   MIValue *inFullName ) {
+    if( inFullName == NULL ) {
+        recordSourcePath( inName, NULL );
+        return;
+        }
+    
+    SourcePath *p = findSourcePath( inName );
+    
+    if( p != NULL && p->path != NULL ) {
+        const char *c = &( inFullName->start[1] );
+        int rawLength = inFullName->end - inFullName->start - 2;
+        
+        if( (int)strlen( p->path ) == rawLength &&
+            memcmp( p->path, c, rawLength ) == 0 ) {
+            return;
+            }
+        }
+    else if( p != NULL ) {
+        // already ambiguous
+        return;
+        }
+    
+    recordSourcePath( inName, internMIString( inFullName ) );
+    }
+
+
+
+static void freeSourcePaths() {
+    sourcePaths.deleteAll();
+    freeHashIndex( &sourcePathIndex );
+    }
+
+
+
+// **************************************
+// calling-context tree
+
+// Every sampled stack is a path from its outermost frame down to its
+// innermost one.  Paths that start the same way share nodes, and once
+// sampling is over, each stack's samples are added to the counts along 
+// its path, so repeated stack roots (partial stacks) of any depth can be
+// read off the tree.
+// There's one tree for each thread when sampling all threads.
+
+
+typedef struct CallTreeNode {
+        // copied from frameTable, names are interned (or point into 
+        // symbolCache, for frames that only have addresses until after
+        // sampling)
+        StackFrame frame;
+        // index in callTree, -1 for outermost frames
+        int parent;
+        // number of frames from outermost, which has depth 1
+        int depth;
+        int threadIndex;
+        // samples whose stacks pass through or end at this node
+        int sampleCount;
+        double sampleSeconds;
+        // samples whose stacks end here
+        int endCount;
+        double endSeconds;
+    } CallTreeNode;
+
+
+SimpleVector<CallTreeNode> callTree;
+
+
+// how deep to report partial stacks, set with --rootDepth
+int reportRootDepth = 14;
+
+
+// finds a node's child by frame address, so we don't have to walk
+// lists of children
+HashIndex callTreeChildIndex = { NULL, NULL, 0, 0 };
+
+
+// for each stack in stackLog, the tree node where its path ends
+SimpleVector<int> stackLogTreeNodes;
+
+
+    
+
+// **************************************
+// target address space
+
+// Frames that only have addresses need to be matched up with the files
+// that their code came from, so we keep track of where everything is
+// mapped in the target.
+
+
+int targetPID = -1;
+
+
+
+typedef struct MapRegion {
+        uintptr_t start;
+        uintptr_t end;
+        unsigned long offset;
+        char *path;
+    } MapRegion;
+
+
+// executable regions of the target's address space, from /proc/PID/maps
+SimpleVector<MapRegion> targetMaps;
+
+// set when we see an address that isn't covered by targetMaps
+char targetMapsStale = true;
+
+
+
+static void readTargetMaps() {
+    char *mapsFileName = autoSprintf( "/proc/%d/maps", targetPID );
+    
+    FILE *mapsFile = fopen( mapsFileName, "r" );
+    
+    delete [] mapsFileName;
+
+    if( mapsFile == NULL ) {
+        // target gone, keep what we had before
+        return;
+        }
+
+    for( int i=0; i<targetMaps.size(); i++ ) {
+        delete [] targetMaps.getElementDirect( i ).path;
+        }
+    targetMaps.deleteAll();
+    
+    char line[4096];
+    
+    while( fgets( line, sizeof( line ), mapsFile ) != NULL ) {
+        unsigned long start, end, offset;
+        char perms[5];
+        int pathStart = -1;
+        
+        int numRead = sscanf( line, "%lx-%lx %4s %lx %*s %*s %n",
+                              &start, &end, perms, &offset, &pathStart );
+        
+        if( numRead != 4 || perms[2] != 'x' ) {
+            continue;
+            }
+        
+        char *path = stringDuplicate( "" );
+        
+        if( pathStart > 0 ) {
+            delete [] path;
+            path = stringDuplicate( &( line[ pathStart ] ) );
+            
+            char *newlinePos = strstr( path, "\n" );
+            if( newlinePos != NULL ) {
+                newlinePos[0] = '\0';
+                }
+            }
+
+        MapRegion r = { start, end, offset, path };
+        targetMaps.push_back( r );
+        }
+
+    fclose( mapsFile );
+
+    targetMapsStale = false;
+    
+    logMapsRecord();
+    }
+
+
+
+static MapRegion *findMapRegion( uintptr_t inAddress ) {
+    for( int i=0; i<targetMaps.size(); i++ ) {
+        MapRegion *r = targetMaps.getElement( i );
+        
+        if( inAddress >= r->start && inAddress < r->end ) {
+            return r;
+            }
+        }
+    return NULL;
+    }
+
+
+
+// reads the program headers of an ELF file on disk to figure out
+// how far it was shifted from its link-time addresses when loaded
+// returns false if inRegion's file could not be read
+static char getLoadBias( MapRegion *inRegion, uintptr_t *outBias ) {
+    
+    // lowest mapping of this file is where its start was loaded
+    uintptr_t base = inRegion->start - inRegion->offset;
+    
+    FILE *f = fopen( inRegion->path, "rb" );
+    
+    if( f == NULL ) {
+        return false;
+        }
+    
+    unsigned char ident[ EI_NIDENT ];
+    
+    if( fread( ident, 1, EI_NIDENT, f ) != EI_NIDENT ||
+        memcmp( ident, ELFMAG, SELFMAG ) != 0 ) {
+        fclose( f );
+        return false;
+        }
+    
+    fseek( f, 0, SEEK_SET );
+    
+    char found = false;
+    uintptr_t firstLoadStart = 0;
+    
+    if( ident[ EI_CLASS ] == ELFCLASS64 ) {
+        Elf64_Ehdr header;
+        
+        if( fread( &header, sizeof( header ), 1, f ) == 1 ) {
+            for( int i=0; i<header.e_phnum && !found; i++ ) {
+                Elf64_Phdr ph;
+                fseek( f, header.e_phoff + i * header.e_phentsize, SEEK_SET );
+                
+                if( fread( &ph, sizeof( ph ), 1, f ) == 1 &&
+                    ph.p_type == PT_LOAD ) {
+                    firstLoadStart = ph.p_vaddr - ph.p_offset;
+                    found = true;
+                    }
+                }
+            }
+        }
+    else {
+        Elf32_Ehdr header;
+        
+        if( fread( &header, sizeof( header ), 1, f ) == 1 ) {
+            for( int i=0; i<header.e_phnum && !found; i++ ) {
+                Elf32_Phdr ph;
+                fseek( f, header.e_phoff + i * header.e_phentsize, SEEK_SET );
+                
+                if( fread( &ph, sizeof( ph ), 1, f ) == 1 &&
+                    ph.p_type == PT_LOAD ) {
+                    firstLoadStart = ph.p_vaddr - ph.p_offset;
+                    found = true;
+                    }
+                }
+            }
+        }
+
+    fclose( f );
+    
+    if( found ) {
+        *outBias = base - firstLoadStart;
+        }
+    return found;
+    }
+
+
+
+static StackFrame makeAddressFrame( uintptr_t inAddress ) {
+    StackFrame f;
+    f.address = (void*)inAddress;
+    
+    // filled in later, by resolveFrameNames
+    f.funcName = NULL;
+    f.fileName = NULL;
+    f.lineNum = -1;
+    
+    return f;
+    }
+
+
+
+// call this with the frames of each newly seen stack
+// target's maps will be re-read if the stack has addresses that
+// we don't know about (from newly-loaded shared libraries, for example)
+static void checkFramesMapped( unsigned int *inFrameIDs, int inNumFrames ) {
+    for( int i=0; i<inNumFrames && !targetMapsStale; i++ ) {
+        if( findMapRegion( 
+                (uintptr_t)frameTable.getElement( inFrameIDs[i] )->
+                address ) == NULL ) {
+            targetMapsStale = true;
+            }
+        }
+    }
+
+
+
+// **************************************
+// sample log
+
+// With --sampleLog, everything we learn while sampling is also appended
+// to a file as it comes in, so a profiler that's killed part way 
+// through still leaves its samples behind, and the report can be made 
+// later (or again) with --report.  A log starts with a magic string and
+// a version number, followed by records that are each a type byte and
+// some fields.  Numbers are unsigned LEB128, like in DWARF, and doubles
+// are 8 raw bytes in our own byte order.  Strings, frames and stacks are
+// numbered in the order their records appear, and later records refer
+// to them by number, so each name is written once, and each sample of a
+// stack we've seen before takes a few bytes.
+
+
+#define SAMPLE_LOG_MAGIC "wcpSLog\n"
+#define SAMPLE_LOG_MAGIC_LENGTH 8
+
+// bump this whenever the meaning of a record changes
+#define SAMPLE_LOG_VERSION 1
+
+
+// an interned string:  length, bytes
+#define SAMPLE_LOG_STRING 1
+// an interned frame:  address, function string number + 1 and 
+// file string number + 1 (0 for none), line + 1
+#define SAMPLE_LOG_FRAME 2
+// a new or renamed thread:  index in threadLog, id, name length, bytes
+#define SAMPLE_LOG_THREAD 3
+// a new stack:  thread index + 1 (0 for none), frame count, frame numbers
+#define SAMPLE_LOG_STACK 4
+// samples of a stack:  stack number, count, seconds (double)
+#define SAMPLE_LOG_SAMPLES 5
+// a stop's SampleRecord, after the stacks it sampled:  five doubles
+#define SAMPLE_LOG_STOP 6
+// a new on-CPU stack:  frame count, frame numbers
+#define SAMPLE_LOG_PERF_STACK 7
+// an on-CPU sample:  on-CPU stack number
+#define SAMPLE_LOG_PERF_SAMPLE 8
+// the target's executable regions, replacing any from before:  count,
+// then start, end, offset, path length and path bytes for each
+#define SAMPLE_LOG_MAPS 9
+// just before sampling starts:  requested rate (double), all threads
+// flag, on-CPU samples flag
+#define SAMPLE_LOG_START 10
+// sampling is over:  number of stops, seconds (double), on-CPU samples 
+// lost
+#define SAMPLE_LOG_END 11
+// a name looked up after sampling:  lookup address, function length, 
+// bytes, file length, bytes, line + 1
+#define SAMPLE_LOG_SYMBOL 12
+// where a file name's source is, after sampling:  name length, bytes, 
+// absolute path length, bytes
+#define SAMPLE_LOG_SOURCE_PATH 13
+
+
+FILE *sampleLogFile = NULL;
+
+// flushed at least this often, so a killed profiler doesn't lose much
+#define SAMPLE_LOG_FLUSH_SECONDS 1.0
+
+double lastSampleLogFlush = 0;
+
+
+
+static void logNumber( unsigned long long inValue ) {
+    do {
+        int b = inValue & 0x7f;
+        inValue >>= 7;
+        
+        if( inValue != 0 ) {
+            b |= 0x80;
+            }
+        putc_unlocked( b, sampleLogFile );
+        } while( inValue != 0 );
+    }
+
+
+
+static void logDouble( double inValue ) {
+    fwrite( &inValue, sizeof( double ), 1, sampleLogFile );
+    }
+
+
+
+static void logBytes( const char *inBytes, int inLength ) {
+    logNumber( inLength );
+    fwrite( inBytes, 1, inLength, sampleLogFile );
+    }
+
+
+
+// returns false if inFileName can't be written
+static char openSampleLog( const char *inFileName ) {
+    sampleLogFile = fopen( inFileName, "wb" );
+    
+    if( sampleLogFile == NULL ) {
+        return false;
+        }
+    
+    // records are small, so let stdio gather them into big writes
+    setvbuf( sampleLogFile, NULL, _IOFBF, 1 << 18 );
+    
+    fwrite( SAMPLE_LOG_MAGIC, 1, SAMPLE_LOG_MAGIC_LENGTH, sampleLogFile );
+    logNumber( SAMPLE_LOG_VERSION );
+    
+    lastSampleLogFlush = getMonotonicTime();
+    
+    return true;
+    }
+
+
+
+static void closeSampleLog() {
+    if( sampleLogFile != NULL ) {
+        fclose( sampleLogFile );
+        sampleLogFile = NULL;
+        }
+    }
+
+
+
+// number of an interned string (or -1 for NULL)
+static int getInternedStringNumber( const char *inString ) {
+    if( inString == NULL ) {
+        return -1;
+        }
+    
+    int length = strlen( inString );
+    
+    StringKey key = { inString, length };
+    
+    return findInHashIndex( &internedStringIndex, 
+                            hashBytes( inString, length ),
+                            internedStringMatches, &key );
+    }
+
+
+
+static void logStringRecord( const char *inString, int inLength ) {
+    if( sampleLogFile == NULL ) {
+        return;
+        }
+    putc_unlocked( SAMPLE_LOG_STRING, sampleLogFile );
+    logBytes( inString, inLength );
+    }
+
+
+
+static void logFrameRecord( StackFrame *inFrame ) {
+    if( sampleLogFile == NULL ) {
+        return;
+        }
+    putc_unlocked( SAMPLE_LOG_FRAME, sampleLogFile );
+    logNumber( (uintptr_t)inFrame->address );
+    logNumber( getInternedStringNumber( inFrame->funcName ) + 1 );
+    logNumber( getInternedStringNumber( inFrame->fileName ) + 1 );
+    logNumber( inFrame->lineNum + 1 );
+    }
+
+
+
+static void logThreadRecord( int inThreadIndex ) {
+    if( sampleLogFile == NULL ) {
+        return;
+        }
+    ThreadRecord *t = threadLog.getElement( inThreadIndex );
+    
+    putc_unlocked( SAMPLE_LOG_THREAD, sampleLogFile );
+    logNumber( inThreadIndex );
+    logNumber( (unsigned int)t->id );
+    logBytes( t->name, strlen( t->name ) );
+    }
+
+
+
+static void logMapsRecord() {
+    if( sampleLogFile == NULL ) {
+        return;
+        }
+    putc_unlocked( SAMPLE_LOG_MAPS, sampleLogFile );
+    logNumber( targetMaps.size() );
+    
+    for( int i=0; i<targetMaps.size(); i++ ) {
+        MapRegion *r = targetMaps.getElement( i );
+        
+        logNumber( r->start );
+        logNumber( r->end );
+        logNumber( r->offset );
+        logBytes( r->path, strlen( r->path ) );
+        }
+    }
+
+
+
+static void logStackRecord( unsigned int *inFrameIDs, int inNumFrames,
+                            int inThreadIndex ) {
+    if( sampleLogFile == NULL ) {
+        return;
+        }
+    putc_unlocked( SAMPLE_LOG_STACK, sampleLogFile );
+    logNumber( inThreadIndex + 1 );
+    logNumber( inNumFrames );
+    
+    for( int i=0; i<inNumFrames; i++ ) {
+        logNumber( inFrameIDs[i] );
+        }
+    }
+
+
+
+static void logSamplesRecord( int inStackIndex, int inCount, 
+                              double inSeconds ) {
+    if( sampleLogFile == NULL ) {
+        return;
+        }
+    putc_unlocked( SAMPLE_LOG_SAMPLES, sampleLogFile );
+    logNumber( inStackIndex );
+    logNumber( inCount );
+    logDouble( inSeconds );
+    }
+
+
+
+// every stop gets one of these, so this is where the log is flushed
+static void logStopRecord( SampleRecord *inRecord ) {
+    if( sampleLogFile == NULL ) {
+        return;
+        }
+    putc_unlocked( SAMPLE_LOG_STOP, sampleLogFile );
+    logDouble( inRecord->time );
+    logDouble( inRecord->interval );
+    logDouble( inRecord->stopSeconds );
+    logDouble( inRecord->captureSeconds );
+    logDouble( inRecord->resumeSeconds );
+    
+    double now = getMonotonicTime();
+    
+    if( now - lastSampleLogFlush >= SAMPLE_LOG_FLUSH_SECONDS ) {
+        fflush( sampleLogFile );
+        lastSampleLogFlush = now;
+        }
+    }
+
+
+
+static void logPerfStackRecord( unsigned int *inFrameIDs, 
+                                int inNumFrames ) {
+    if( sampleLogFile == NULL ) {
+        return;
+        }
+    putc_unlocked( SAMPLE_LOG_PERF_STACK, sampleLogFile );
+    logNumber( inNumFrames );
+    
+    for( int i=0; i<inNumFrames; i++ ) {
+        logNumber( inFrameIDs[i] );
+        }
+    }
+
+
+
+static void logPerfSampleRecord( int inStackIndex ) {
+    if( sampleLogFile == NULL ) {
+        return;
+        }
+    putc_unlocked( SAMPLE_LOG_PERF_SAMPLE, sampleLogFile );
+    logNumber( inStackIndex );
+    }
+
+
+
+static void logStartRecord( double inRequestedRate, char inAllThreads,
+                            char inOnCPU ) {
+    if( sampleLogFile == NULL ) {
+        return;
+        }
+    putc_unlocked( SAMPLE_LOG_START, sampleLogFile );
+    logDouble( inRequestedRate );
+    logNumber( inAllThreads );
+    logNumber( inOnCPU );
+    }
+
+
+
+static void logEndRecord( int inNumSamples, double inSamplingSeconds,
+                          long inPerfLostCount ) {
+    if( sampleLogFile == NULL ) {
+        return;
+        }
+    putc_unlocked( SAMPLE_LOG_END, sampleLogFile );
+    logNumber( inNumSamples );
+    logDouble( inSamplingSeconds );
+    logNumber( inPerfLostCount );
+    
+    fflush( sampleLogFile );
+    }
+
+
+
+
+// **************************************
+// timeline
+
+// The report adds the whole run up, so a few seconds of stall in the
+// middle of a long attach look like a blip.  With --timeline, each 
+// sample also keeps its place in time, and the samples come out as
+// Chrome trace events (for chrome://tracing, Perfetto or speedscope),
+// one track per thread, with a box for each function on the stack for
+// as long as it stayed there.
+//
+// Names aren't known until sampling is over, so while sampling, each
+// thread's run of samples of the same stack goes to a temporary file
+// as soon as the thread moves on to a different stack, and the JSON is
+// written from that file in one pass at the end.  The samples 
+// themselves don't stay in memory.  What does grow with the run is 
+// sampleRecords, one per stop, which the report keeps anyway and the 
+// track of the profiler's pauses is drawn from.
+//
+// A stop's samples stand for the time since the stop before it.  A 
+// stop whose stacks couldn't be read has no samples, so the next stop's
+// samples are spread over both, in proportion to their time.
+
+
+// set with --timeline
+const char *timelineFileName = NULL;
+
+
+// a stack, from one time to another, in seconds since sampling started
+typedef struct TimelineSpan {
+        int stackIndex;
+        double start;
+        double end;
+    } TimelineSpan;
+
+
+// spans as they're finished, in order for each thread
+FILE *timelineSpanFile = NULL;
+
+// samples since the last stop that came before some samples, with their
+// seconds where a span's end would be
+SimpleVector<TimelineSpan> timelineSamples;
+
+// the stops those samples came from
+char timelineHaveStops = false;
+double timelineStopsStart = 0;
+double timelineStopsEnd = 0;
+
+// span each thread is in right now, indexed by threadLog index + 1, 
+// with a stack index of -1 for threads that aren't in one
+SimpleVector<TimelineSpan> timelineOpenSpans;
+
+// where each thread's share of the stops it was sampled in is up to, 
+// and its seconds in the stops, while samples are being laid out
+SimpleVector<double> timelineThreadCursors;
+SimpleVector<double> timelineThreadSeconds;
+
+
+
+static void endTimelineSpan( int inThread ) {
+    TimelineSpan *open = timelineOpenSpans.getElement( inThread );
+    
+    if( open->stackIndex != -1 ) {
+        fwrite( open, sizeof( TimelineSpan ), 1, timelineSpanFile );
+        open->stackIndex = -1;
+        }
+    }
+
+
+
+// lays out the samples of the stops that just ended
+static void layOutTimelineSamples() {
+    int numThreads = threadLog.size() + 1;
+    
+    while( timelineOpenSpans.size() < numThreads ) {
+        TimelineSpan none = { -1, 0, 0 };
+        timelineOpenSpans.push_back( none );
+        timelineThreadCursors.push_back( 0 );
+        timelineThreadSeconds.push_back( 0 );
+        }
+    
+    for( int i=0; i<timelineSamples.size(); i++ ) {
+        TimelineSpan *s = timelineSamples.getElement( i );
+        int t = stackLog.getElement( s->stackIndex )->threadIndex + 1;
+        
+        *( timelineThreadCursors.getElement( t ) ) = timelineStopsStart;
+        *( timelineThreadSeconds.getElement( t ) ) += s->end;
+        }
+    
+    double stopsSeconds = timelineStopsEnd - timelineStopsStart;
+    
+    for( int i=0; i<timelineSamples.size(); i++ ) {
+        TimelineSpan *s = timelineSamples.getElement( i );
+        int t = stackLog.getElement( s->stackIndex )->threadIndex + 1;
+        
+        double *cursor = timelineThreadCursors.getElement( t );
+        double threadSeconds = timelineThreadSeconds.getElementDirect( t );
+        
+        double start = *cursor;
+        double end = timelineStopsEnd;
+        
+        if( threadSeconds > 0 ) {
+            end = start + stopsSeconds * s->end / threadSeconds;
+            }
+        *cursor = end;
+        
+        TimelineSpan *open = timelineOpenSpans.getElement( t );
+        
+        if( open->stackIndex == s->stackIndex && 
+            open->end >= start - 1e-9 ) {
+            // still in the same stack
+            open->end = end;
+            }
+        else {
+            endTimelineSpan( t );
+            open->stackIndex = s->stackIndex;
+            open->start = start;
+            open->end = end;
+            }
+        }
+    
+    for( int i=0; i<timelineSamples.size(); i++ ) {
+        TimelineSpan *s = timelineSamples.getElement( i );
+        int t = stackLog.getElement( s->stackIndex )->threadIndex + 1;
+        
+        *( timelineThreadSeconds.getElement( t ) ) = 0;
+        }
+    
+    timelineSamples.deleteStartElements( timelineSamples.size() );
+    timelineHaveStops = false;
+    }
+
+
+
+// inSeconds of samples of stack inStackIndex of stackLog
+static void addTimelineSamples( int inStackIndex, double inSeconds ) {
+    if( timelineFileName == NULL ) {
+        return;
+        }
+    
+    if( timelineSpanFile == NULL ) {
+        timelineSpanFile = tmpfile();
+        
+        if( timelineSpanFile == NULL ) {
+            printf( "Could not create a temporary file for --timeline\n" );
+            timelineFileName = NULL;
+            return;
+            }
+        }
+    
+    if( timelineHaveStops ) {
+        // first sample of the next stop
+        layOutTimelineSamples();
+        }
+    
+    TimelineSpan s = { inStackIndex, 0, inSeconds };
+    timelineSamples.push_back( s );
+    }
+
+
+
+// the samples added since the last stop belong to inRecord
+static void addTimelineStop( SampleRecord *inRecord ) {
+    if( timelineSpanFile == NULL ) {
+        return;
+        }
+    
+    if( ! timelineHaveStops ) {
+        timelineStopsStart = inRecord->time - inRecord->interval;
+        timelineHaveStops = true;
+        }
+    timelineStopsEnd = inRecord->time;
+    }
+
+
+
+static void writeJSONString( FILE *inFile, const char *inString ) {
+    putc( '"', inFile );
+    
+    for( const unsigned char *c = (const unsigned char*)inString; 
+         *c != '\0'; c++ ) {
+        
+        if( *c == '"' || *c == '\\' ) {
+            putc( '\\', inFile );
+            putc( *c, inFile );
+            }
+        else if( *c < 0x20 ) {
+            fprintf( inFile, "\\u%04x", *c );
+            }
+        else {
+            putc( *c, inFile );
+            }
+        }
+    putc( '"', inFile );
+    }
+
+
+
+// Chrome trace thread ID for a threadLog index + 1
+static int getTimelineTID( int inThread ) {
+    if( inThread == 0 ) {
+        // not tracking threads, only the one we sampled
+        return 1;
+        }
+    return threadLog.getElement( inThread - 1 )->id;
+    }
+
+
+
+static void writeTimelineEvent( FILE *inFile, char inPhase, int inThread,
+                                double inSeconds, const char *inName ) {
+    fprintf( inFile, ",\n{\"ph\":\"%c\",\"pid\":1,\"tid\":%d,\"ts\":%.3f",
+             inPhase, getTimelineTID( inThread ), inSeconds * 1e6 );
+    
+    if( inName != NULL ) {
+        fprintf( inFile, ",\"name\":" );
+        writeJSONString( inFile, inName );
+        }
+    fprintf( inFile, "}" );
+    }
+
+
+
+// names have to be filled in by now, and stackLog not reordered yet
+static void writeTimeline( const char *inFileName ) {
+    if( timelineSpanFile == NULL ) {
+        printf( "No samples for the timeline\n" );
+        return;
+        }
+    
+    layOutTimelineSamples();
+    
+    for( int t=0; t<timelineOpenSpans.size(); t++ ) {
+        endTimelineSpan( t );
+        }
+    
+    FILE *file = fopen( inFileName, "w" );
+    
+    if( file == NULL ) {
+        printf( "Could not open %s to write timeline\n", inFileName );
+        }
+    else {
+        fprintf( file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+                 "{\"ph\":\"M\",\"pid\":1,\"tid\":0,"
+                 "\"name\":\"process_name\","
+                 "\"args\":{\"name\":\"target\"}}" );
+        
+        int numThreads = timelineOpenSpans.size();
+        
+        // the stack each thread shows, and when it ends
+        TimelineSpan *shown = new TimelineSpan[ numThreads ];
+        for( int t=0; t<numThreads; t++ ) {
+            shown[t].stackIndex = -1;
+            }
+        
+        rewind( timelineSpanFile );
+        
+        TimelineSpan span;
+        
+        while( fread( &span, sizeof( TimelineSpan ), 1, 
+                      timelineSpanFile ) == 1 ) {
+            
+            Stack *s = stackLog.getElement( span.stackIndex );
+            int t = s->threadIndex + 1;
+            
+            // frames that stay open, from the outermost in
+            int numShared = 0;
+            
+            if( shown[t].stackIndex != -1 ) {
+                Stack *old = stackLog.getElement( shown[t].stackIndex );
+                
+                if( shown[t].end >= span.start - 1e-9 ) {
+                    int o = old->frames.size() - 1;
+                    int n = s->frames.size() - 1;
+                    
+                    while( o >= 0 && n >= 0 &&
+                           strcmp( old->frames.getElement( o )->funcName,
+                                   s->frames.getElement( n )->funcName ) 
+                           == 0 ) {
+                        numShared++;
+                        o--;
+                        n--;
+                        }
+                    }
+                
+                double closeTime = span.start;
+                if( numShared == 0 ) {
+                    // there may have been a gap
+                    closeTime = shown[t].end;
+                    }
+                
+                for( int f=0; f < old->frames.size() - numShared; f++ ) {
+                    writeTimelineEvent( file, 'E', t, closeTime, NULL );
+                    }
+                }
+            
+            for( int f = s->frames.size() - 1 - numShared; f >= 0; f-- ) {
+                writeTimelineEvent( file, 'B', t, span.start,
+                                    s->frames.getElement( f )->funcName );
+                }
+            
+            shown[t] = span;
+            }
+        
+        for( int t=0; t<numThreads; t++ ) {
+            if( shown[t].stackIndex == -1 ) {
+                // never sampled
+                continue;
+                }
+            Stack *s = stackLog.getElement( shown[t].stackIndex );
+            
+            for( int f=0; f<s->frames.size(); f++ ) {
+                writeTimelineEvent( file, 'E', t, shown[t].end, NULL );
+                }
+            
+            const char *name = "sampled thread";
+            if( t > 0 ) {
+                name = threadLog.getElement( t - 1 )->name;
+                }
+            fprintf( file, ",\n{\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+                     "\"name\":\"thread_name\",\"args\":{\"name\":",
+                     getTimelineTID( t ) );
+            writeJSONString( file, name );
+            fprintf( file, "}}" );
+            }
+        delete [] shown;
+        
+        // the profiler's own pauses get a track of their own
+        fprintf( file, ",\n{\"ph\":\"M\",\"pid\":1,\"tid\":0,"
+                 "\"name\":\"thread_name\","
+                 "\"args\":{\"name\":\"profiler pauses\"}}" );
+        
+        for( int i=0; i<sampleRecords.size(); i++ ) {
+            SampleRecord *r = sampleRecords.getElement( i );
+            
+            fprintf( file, ",\n{\"ph\":\"X\",\"pid\":1,\"tid\":0,"
+                     "\"ts\":%.3f,\"dur\":%.3f,\"name\":\"pause\"}",
+                     r->time * 1e6, 
+                     ( r->stopSeconds + r->captureSeconds + 
+                       r->resumeSeconds ) * 1e6 );
+            }
+        
+        fprintf( file, "\n]}\n" );
+        fclose( file );
+        
+        printf( "Wrote timeline to %s\n", inFileName );
+        }
+    
+    fclose( timelineSpanFile );
+    timelineSpanFile = NULL;
+    
+    timelineSamples.deleteAll();
+    timelineOpenSpans.deleteAll();
+    timelineThreadCursors.deleteAll();
+    timelineThreadSeconds.deleteAll();
+    }
+
+
+
+
+// fills a StackFrame from a frame={...} tuple
+// names are interned whole, so templates like std::map<int, Foo>::find 
+// and operators with spaces in them come through intact
+// the file's fullname, if GDB gives one, goes into sourcePaths
+static StackFrame parseFrame( MIValue *inFrame ) {
+    StackFrame newF;
+    
+    newF.address = NULL;
+    newF.lineNum = -1;
+    newF.funcName = NULL;
+    newF.fileName = NULL;
+    
+    const char *pos, *end;
+    getMIContents( inFrame, &pos, &end );
+    
+    const char *name;
+    int nameLength;
+    MIValue field;
+    
+    MIValue fullName;
+    char foundFullName = false;
+    
+    // one pass over the fields, in whatever order GDB gives them
+    while( nextMIItem( &pos, end, &name, &nameLength, &field ) ) {
+        if( name == NULL || field.type != '"' ) {
+            continue;
+            }
+        
+        if( nameLength == 4 && memcmp( name, "addr", 4 ) == 0 ) {
+            newF.address = 
+                (void*)strtoul( &( field.start[1] ), NULL, 16 );
+            }
+        else if( nameLength == 4 && memcmp( name, "func", 4 ) == 0 &&
+                 newF.funcName == NULL ) {
+            newF.funcName = internMIString( &field );
+            }
+        else if( nameLength == 4 && memcmp( name, "file", 4 ) == 0 &&
+                 newF.fileName == NULL ) {
+            newF.fileName = internMIString( &field );
+            }
+        else if( nameLength == 4 && memcmp( name, "line", 4 ) == 0 ) {
+            newF.lineNum = strtol( &( field.start[1] ), NULL, 10 );
+            }
+        else if( nameLength == 8 && memcmp( name, "fullname", 8 ) == 0 ) {
+            fullName = field;
+            foundFullName = true;
+            }
+        }
+    
+    if( newF.fileName != NULL ) {
+        recordFrameSourcePath( newF.fileName, 
+                               foundFullName ? &fullName : NULL );
+        }
+    
+    if( newF.fileName == NULL ) {
+        newF.fileName = internString( "", 0 );
+        }
+    if( newF.funcName == NULL ) {
+        newF.funcName = internString( "", 0 );
+        }
+
+    return newF;
+    }
+
+
+
+// logs the stack in readBuff that answers the command sent with inToken
+// inThreadIndex is the threadLog index to tag the stack with, or -1
+static void logGDBStack( int inToken, int inThreadIndex ) {
+    // looks like:
+    // ^done,stack=[frame={level="0",addr="0x...",func="main",...},...]
+    MIValue results, stack;
+    
+    if( ! getMIResults( "done", &results, inToken ) ||
+        ! findMIField( &results, "stack", &stack ) ||
+        stack.type != '[' ) {
+        return;
+        }
+    
+    clearSampleStacks();
+    startSampleStack( inThreadIndex );
+    
+    const char *pos, *end;
+    getMIContents( &stack, &pos, &end );
+    
+    const char *name;
+    int nameLength;
+    MIValue frame;
+    
+    while( nextMIItem( &pos, end, &name, &nameLength, &frame ) ) {
+        if( frame.type != '{' ) {
+            continue;
+            }
+        
+        if( lazySymbols ) {
+            // only pull out the addresses, names get looked up later
+            MIValue addr;
+            
+            if( findMIField( &frame, "addr", &addr ) ) {
+                addSampleFrame( 
+                    makeAddressFrame( 
+                        strtoul( &( addr.start[1] ), NULL, 16 ) ) );
+                }
+            }
+        else {
+            addSampleFrame( parseFrame( &frame ) );
+            }
+        }
+    
+    addSampleStack( 0, 1, currentSampleWeight );
+    }
+
+
+
+static unsigned int hashCallTreeChild( int inParent, void *inAddress,
+                                       int inThreadIndex ) {
+    uint64_t h = (uint64_t)(uintptr_t)inAddress;
+    
+    h ^= (uint64_t)(unsigned int)inParent << 32;
+    h ^= (uint64_t)(unsigned int)inThreadIndex;
+    h *= 0x9E3779B97F4A7C15ULL;
+    
+    return (unsigned int)( h >> 32 );
+    }
+
+
+
+// finds or adds the child of inParent (-1 for an outermost frame)
+// for frame inFrameID
+static int getCallTreeChild( int inParent, unsigned int inFrameID,
+                             int inThreadIndex ) {
+    StackFrame *inFrame = frameTable.getElement( inFrameID );
+    
+    unsigned int hash = 
+        hashCallTreeChild( inParent, inFrame->address, inThreadIndex );
+    
+    HashIndex *index = &callTreeChildIndex;
+    
+    if( index->numSlots > 0 ) {
+        int mask = index->numSlots - 1;
+        int s = hash & mask;
+        
+        while( index->slots[s] != 0 ) {
+            if( index->slotHashes[s] == hash ) {
+                int n = index->slots[s] - 1;
+                CallTreeNode *node = callTree.getElement( n );
+                
+                if( node->parent == inParent &&
+                    node->frame.address == inFrame->address &&
+                    node->threadIndex == inThreadIndex ) {
+                    return n;
+                    }
+                }
+            s = ( s + 1 ) & mask;
+            }
+        }
+    
+    CallTreeNode node;
+    node.frame = *inFrame;
+    node.parent = inParent;
+    node.depth = 1;
+    if( inParent != -1 ) {
+        node.depth = callTree.getElement( inParent )->depth + 1;
+        }
+    node.threadIndex = inThreadIndex;
+    node.sampleCount = 0;
+    node.sampleSeconds = 0;
+    node.endCount = 0;
+    node.endSeconds = 0;
+    
+    callTree.push_back( node );
+    
+    addToHashIndex( index, callTree.size() - 1, hash );
+    
+    return callTree.size() - 1;
+    }
+
+
+
+// adds inCount samples along the path from inNode back up to 
+// the outermost frame
+static void addCallTreeSamples( int inNode, int inCount, 
+                                double inSeconds ) {
+    CallTreeNode *node = callTree.getElement( inNode );
+    
+    node->endCount += inCount;
+    node->endSeconds += inSeconds;
+    
+    int n = inNode;
+    while( n != -1 ) {
+        node = callTree.getElement( n );
+        
+        node->sampleCount += inCount;
+        node->sampleSeconds += inSeconds;
+        
+        n = node->parent;
+        }
+    }
+
+
+
+// finds the stack made of inFrameIDs (innermost first) in stackLog, 
+// or adds it with no samples, along with its path through callTree
+// sets outIsNew if it was added
+static int addStack( unsigned int *inFrameIDs, int inNumFrames,
+                     int inThreadIndex, char *outIsNew ) {
+    int index = findOrAddStack( &stackLog, &stackLogKeys, &stackLogIndex,
+                                inFrameIDs, inNumFrames, inThreadIndex,
+                                outIsNew );
+    
+    if( *outIsNew ) {
+        // walk in from outermost frame
+        int treeNode = -1;
+        for( int f = inNumFrames - 1; f >= 0; f-- ) {
+            treeNode = getCallTreeChild( treeNode, inFrameIDs[f],
+                                         inThreadIndex );
+            }
+        stackLogTreeNodes.push_back( treeNode );
+        
+        if( lazySymbols ) {
+            // make sure we know where its code came from
+            checkFramesMapped( inFrameIDs, inNumFrames );
+            }
+        
+        logStackRecord( inFrameIDs, inNumFrames, inThreadIndex );
+        }
+    
+    return index;
+    }
+
+
+
+// adds inCount samples to stack inIndex of stackLog, and to its thread
+// they're added along its path through callTree by finishStackLogs,
+// once per stack instead of once per sample
+static void addStackSamples( int inIndex, int inCount, double inSeconds ) {
+    Stack *s = stackLog.getElement( inIndex );
+    s->sampleCount += inCount;
+    s->sampleSeconds += inSeconds;
+    
+    if( s->threadIndex >= 0 ) {
+        ThreadRecord *t = threadLog.getElement( s->threadIndex );
+        t->sampleCount += inCount;
+        t->sampleSeconds += inSeconds;
+        }
+    
+    logSamplesRecord( inIndex, inCount, inSeconds );
+    addTimelineSamples( inIndex, inSeconds );
+    }
+
+
+
+// adds inCount samples of the stack made of inFrameIDs (innermost 
+// first) to stackLog and callTree
+// returns true if the stack had not been seen before
+static char addStackSample( unsigned int *inFrameIDs, int inNumFrames,
+                            int inThreadIndex, 
+                            int inCount, double inSeconds ) {
+    char isNew;
+    
+    int index = addStack( inFrameIDs, inNumFrames, inThreadIndex, &isNew );
+    
+    addStackSamples( index, inCount, inSeconds );
+
+    return isNew;
+    }
+
+
+
+// reads partial stacks of depth 1 through inMaxDepth off of callTree
+// outStacksByDepth needs inMaxDepth + 1 vectors
+// a partial stack only counts the samples that went deeper than it,
+// not the ones whose full stack it is
+// frames are borrowed from the tree, so these don't need to be freed
+static void getPartialStacks( int inMaxDepth, 
+                              SimpleVector<Stack> *outStacksByDepth ) {
+    for( int i=0; i<callTree.size(); i++ ) {
+        CallTreeNode *node = callTree.getElement( i );
+        
+        if( node->depth > inMaxDepth || 
+            node->sampleCount == node->endCount ) {
+            continue;
+            }
+        
+        Stack s;
+        s.sampleCount = node->sampleCount - node->endCount;
+        s.sampleSeconds = node->sampleSeconds - node->endSeconds;
+        s.threadIndex = node->threadIndex;
+        s.onCPUFraction = -1;
+        
+        int n = i;
+        while( n != -1 ) {
+            CallTreeNode *pathNode = callTree.getElement( n );
+            s.frames.push_back( pathNode->frame );
+            n = pathNode->parent;
+            }
+        
+        outStacksByDepth[ node->depth ].push_back( s );
+        }
+    }
+
+
+
+// GDB's numbers for the target's live threads, kept up to date from
+// =thread-created and =thread-exited notifications, so we don't have to
+// ask for the thread list before listing stacks
+SimpleVector<int> gdbThreadIDs;
+
+
+static void trackGDBThreadRecord( MIRecord *inRecord ) {
+    const char *createdMarker = "=thread-created";
+    const char *exitedMarker = "=thread-exited";
+    
+    char created = recordStartsWith( inRecord, createdMarker );
+    
+    if( ! created && ! recordStartsWith( inRecord, exitedMarker ) ) {
+        return;
+        }
+    
+    // looks like:
+    // =thread-created,id="2",group-id="i1"
+    const char *text = &( readBuff[ inRecord->start ] );
+    
+    MIValue results, id;
+    results.type = '\0';
+    results.start = 
+        &( text[ strlen( created ? createdMarker : exitedMarker ) ] );
+    results.end = &( text[ inRecord->length ] );
+    
+    if( ! findMIField( &results, "id", &id ) || id.type != '"' ) {
+        return;
+        }
+    
+    int threadID = atoi( &( id.start[1] ) );
+    
+    for( int i=0; i<gdbThreadIDs.size(); i++ ) {
+        if( gdbThreadIDs.getElementDirect( i ) == threadID ) {
+            if( ! created ) {
+                gdbThreadIDs.deleteElement( i );
+                }
+            return;
+            }
+        }
+    if( created ) {
+        gdbThreadIDs.push_back( threadID );
+        }
+    }
+
+
+
+// updates thread names from a -thread-info response
+// (and thread IDs too, if inResetIDs is set)
+// looks like:
+// ^done,threads=[{id="1",target-id="Thread 0x7f.. (LWP 123)",
+//                 name="myProgram",frame={...},...},{id="2",...}]
+static void readGDBThreadInfo( int inToken, char inResetIDs ) {
+    MIValue results, threads;
+    
+    if( ! getMIResults( "done", &results, inToken ) ||
+        ! findMIField( &results, "threads", &threads ) ) {
+        return;
+        }
+    
+    if( inResetIDs ) {
+        gdbThreadIDs.deleteAll();
+        }
+    
+    const char *pos, *end;
+    getMIContents( &threads, &pos, &end );
+    
+    const char *itemName;
+    int itemNameLength;
+    MIValue thread;
+    
+    while( nextMIItem( &pos, end, &itemName, &itemNameLength, 
+                       &thread ) ) {
+        MIValue field;
+        
+        if( ! findMIField( &thread, "id", &field ) ) {
+            continue;
+            }
+        
+        int id = atoi( &( field.start[1] ) );
+        
+        // interned, since the same names come back every sample
+        const char *name = "";
+        
+        if( findMIField( &thread, "name", &field ) ||
+            findMIField( &thread, "target-id", &field ) ) {
+            name = internMIString( &field );
+            }
+        
+        getThreadIndex( id, name );
+        
+        if( inResetIDs ) {
+            gdbThreadIDs.push_back( id );
+            }
+        }
+    }
+
+
+
+// threadLog index for a GDB thread, keeping the name we have for it
+static int getGDBThreadIndex( int inID ) {
+    for( int i=0; i<threadLog.size(); i++ ) {
+        if( threadLog.getElement( i )->id == inID ) {
+            return i;
+            }
+        }
+    return getThreadIndex( inID, "" );
+    }
+
+
+
+// list tokens for each stack, and the threads they belong to
+// kept from sample to sample, like sampleStacks
+SimpleVector<int> stackTokens;
+SimpleVector<int> stackThreadIndices;
+
+
+
+// with the target stopped, lists its stack (or stacks of all threads),
+// and resumes it
+// all the commands go to GDB back to back, with tokens, and then we
+// wait once for all of their results, rather than paying for a round 
+// trip through GDB for each one while the target sits stopped
+// sets currentPause.captured and currentPause.resumed
+// returns true if stacks were logged
+static char sampleGDBStacks() {
+    pendingCommands.deleteStartElements( pendingCommands.size() );
+    
+    if( sampleAllThreads && gdbThreadIDs.size() == 0 ) {
+        // haven't seen any thread notifications, ask for the list
+        int token = sendTokenCommand( "-thread-info" );
+        
+        fillBufferWithResponse();
+        checkProgramExited();
+        
+        if( programExited ) {
+            pendingCommands.deleteStartElements( pendingCommands.size() );
+            return false;
+            }
+        readGDBThreadInfo( token, true );
+        
+        pendingCommands.deleteStartElements( pendingCommands.size() );
+        }
+    
+    stackTokens.deleteStartElements( stackTokens.size() );
+    stackThreadIndices.deleteStartElements( stackThreadIndices.size() );
+    
+    if( sampleAllThreads ) {
+        for( int i=0; i<gdbThreadIDs.size(); i++ ) {
+            int id = gdbThreadIDs.getElementDirect( i );
+            
+            char command[100];
+            snprintf( command, sizeof( command ), "%s --thread %d",
+                      stackListCommand, id );
+            stackTokens.push_back( sendTokenCommand( command ) );
+            
+            stackThreadIndices.push_back( getGDBThreadIndex( id ) );
+            }
+        }
+    else {
+        stackTokens.push_back( sendTokenCommand( stackListCommand ) );
+        stackThreadIndices.push_back( -1 );
+        }
+    
+    // names can change while threads run, so they're listed each time
+    int threadInfoToken = -1;
+    
+    if( sampleAllThreads && ! gdbTargetAsync ) {
+        // GDB won't answer anything sent after -exec-continue until the
+        // target stops again, so this has to go while it's stopped
+        threadInfoToken = sendTokenCommand( "-thread-info" );
+        }
+    
+    int continueToken = sendTokenCommand( "-exec-continue" );
+    
+    if( sampleAllThreads && gdbTargetAsync ) {
+        // after the target is going again, where it doesn't add to the 
+        // pause
+        threadInfoToken = sendTokenCommand( "-thread-info" );
+        }
+    
+    int numRead = fillBufferWithResponse();
+    
+    if( numRead > 0 ) {
+        log( "sampleGDBStacks sees", readBuff );
+        }
+    
+    checkProgramExited();
+    
+    currentPause.captured = currentPause.resumed = getMonotonicTime();
+    
+    for( int i=0; i<pendingCommands.size(); i++ ) {
+        PendingCommand *c = pendingCommands.getElement( i );
+        
+        if( ! c->answered ) {
+            continue;
+            }
+        if( c->token == continueToken ) {
+            currentPause.resumed = c->answerTime;
+            }
+        else if( c->token < continueToken && 
+                 c->token != threadInfoToken ) {
+            // last stack listing to arrive
+            currentPause.captured = c->answerTime;
+            }
+        }
+    pendingCommands.deleteStartElements( pendingCommands.size() );
+
+    if( programExited ) {
+        return false;
+        }
+    
+    if( threadInfoToken != -1 ) {
+        readGDBThreadInfo( threadInfoToken, false );
+        }
+    
+    for( int i=0; i<stackTokens.size(); i++ ) {
+        logGDBStack( stackTokens.getElementDirect( i ),
+                     stackThreadIndices.getElementDirect( i ) );
+        }
+    
+    return true;
+    }
+
+
+
+// **************************************
+// sampling schedule
+
+// Each sample is taken at an absolute deadline, so the time spent
+// stopping the target and recording its stacks doesn't push later
+// samples back and lower the rate.  With --jitter, the gaps between
+// deadlines are random, but average out to the requested rate, so that
+// samples can't stay lined up with periodic work in the target.
+
+
+#define JITTER_NONE 0
+// gaps uniform between half and one-and-a-half periods
+#define JITTER_UNIFORM 1
+// exponential gaps, so samples form a Poisson process
+#define JITTER_POISSON 2
+
+int jitterMode = JITTER_NONE;
+
+
+
+static double getMonotonicTime() {
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    
+    return now.tv_sec + now.tv_nsec / 1000000000.0;
+    }
+
+
+
+static struct timespec monotonicTimeToTimespec( double inTime ) {
+    struct timespec t;
+    t.tv_sec = (time_t)inTime;
+    t.tv_nsec = lrint( ( inTime - t.tv_sec ) * 1000000000.0 );
+    
+    if( t.tv_nsec >= 1000000000 ) {
+        t.tv_sec ++;
+        t.tv_nsec -= 1000000000;
+        }
+    return t;
+    }
+
+
+
+// time from one sample deadline to the next
+static double getNextSampleGap( double inPeriod ) {
+    switch( jitterMode ) {
+        case JITTER_UNIFORM:
+            return inPeriod * ( 0.5 + drand48() );
+        case JITTER_POISSON:
+            // 1 - drand48() is never 0
+            return - inPeriod * log( 1 - drand48() );
+        default:
+            return inPeriod;
+        }
+    }
+
+
+
+// finds the deadline for the next sample, given that the last one was
+// due at inLastDeadline
+// if we've fallen more than a whole period behind (because a stop took
+// a long time), we start again from now rather than taking a burst of
+// samples to catch up
+static double getNextSampleDeadline( double inLastDeadline, 
+                                     double inPeriod ) {
+    double deadline = inLastDeadline + getNextSampleGap( inPeriod );
+    
+    double now = getMonotonicTime();
+    
+    if( deadline < now - inPeriod ) {
+        deadline = now + getNextSampleGap( inPeriod );
+        }
+    return deadline;
+    }
+
+
+
+// with --budget, the time between samples is adjusted as we go, so that
+// the target is paused for no more than this fraction of the time
+double pauseBudget = -1;
+
+// running average of pause lengths
+double averagePauseSeconds = -1;
+
+// weight of newest pause in average
+#define PAUSE_AVERAGE_WEIGHT 0.1
+
+// never wait longer than this between samples
+#define MAX_BUDGET_PERIOD 10.0
+
+// only log rate changes bigger than this fraction
+#define RATE_CHANGE_LOG_THRESHOLD 0.25
+
+double lastLoggedPeriod = -1;
+
+
+
+// finds sample period that keeps the average pause within budget, 
+// given the pause of the latest sample
+// inMinPeriod is the period for the rate that was asked for
+static double getBudgetedPeriod( double inMinPeriod, double inPause ) {
+    if( averagePauseSeconds < 0 ) {
+        averagePauseSeconds = inPause;
+        }
+    else {
+        averagePauseSeconds = 
+            ( 1 - PAUSE_AVERAGE_WEIGHT ) * averagePauseSeconds +
+            PAUSE_AVERAGE_WEIGHT * inPause;
+        }
+    
+    double period = averagePauseSeconds / pauseBudget;
+    
+    if( period < inMinPeriod ) {
+        period = inMinPeriod;
+        }
+    if( period > MAX_BUDGET_PERIOD ) {
+        period = MAX_BUDGET_PERIOD;
+        }
+    
+    if( lastLoggedPeriod < 0 ||
+        fabs( period - lastLoggedPeriod ) > 
+        RATE_CHANGE_LOG_THRESHOLD * lastLoggedPeriod ) {
+        
+        char *message = autoSprintf( 
+            "Sampling %.2f times per second, average pause %.3f ms",
+            1 / period, averagePauseSeconds * 1000 );
+        
+        printf( "%s\n", message );
+        log( "Sample rate changed for pause budget", message );
+        delete [] message;
+        
+        lastLoggedPeriod = period;
+        }
+    
+    return period;
+    }
+
+
+
+static void sleepUntil( double inDeadline ) {
+    struct timespec deadline = monotonicTimeToTimespec( inDeadline );
+    
+    while( clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, 
+                            &deadline, NULL ) == EINTR ) {
+        }
+    }
+
+
+
+
+// **************************************
+// target pause times
+
+// Every sample freezes the target for a moment.  We time each phase of
+// every pause, so that the report can say how much the profiler got in
+// the target's way.
+
+
+static int compareDoubles( const void *inA, const void *inB ) {
+    double a = *(double*)inA;
+    double b = *(double*)inB;
+    
+    if( a < b ) {
+        return -1;
+        }
+    if( a > b ) {
+        return 1;
+        }
+    return 0;
+    }
+
+
+
+// inValues must be sorted
+static double getPercentile( double *inValues, int inNumValues, 
+                             double inFraction ) {
+    int i = (int)ceil( inFraction * inNumValues ) - 1;
+    
+    if( i < 0 ) {
+        i = 0;
+        }
+    if( i >= inNumValues ) {
+        i = inNumValues - 1;
+        }
+    return inValues[i];
+    }
+
+
+
+static void printMilliseconds( double inSeconds ) {
+    printf( "%9.3f ms", inSeconds * 1000 );
+    }
+
+
+
+// histogram bucket upper limits, in microseconds
+static const double pauseBucketLimits[] = { 
+    10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000, 20000, 50000, 
+    100000 };
+
+#define NUM_PAUSE_BUCKETS \
+    (int)( 1 + sizeof( pauseBucketLimits ) / sizeof( double ) )
+
+#define PAUSE_HISTOGRAM_WIDTH 50
+
+
+
+static void printSamplingStats( double inRequestedRate, 
+                                double inSamplingSeconds ) {
+    int numRecords = sampleRecords.size();
+    
+    if( numRecords == 0 || inSamplingSeconds <= 0 ) {
+        return;
+        }
+    
+    printf( "Requested %.2f samples per second, achieved %.2f "
+            "over %.3f seconds\n",
+            inRequestedRate, numRecords / inSamplingSeconds, 
+            inSamplingSeconds );
+    
+    double *pauses = new double[ numRecords ];
+    double *phases[3];
+    for( int p=0; p<3; p++ ) {
+        phases[p] = new double[ numRecords ];
+        }
+    
+    double totalPause = 0;
+    
+    for( int i=0; i<numRecords; i++ ) {
+        SampleRecord *r = sampleRecords.getElement( i );
+        
+        phases[0][i] = r->stopSeconds;
+        phases[1][i] = r->captureSeconds;
+        phases[2][i] = r->resumeSeconds;
+        
+        pauses[i] = r->stopSeconds + r->captureSeconds + r->resumeSeconds;
+        totalPause += pauses[i];
+        }
+    
+    printf( "Target was paused for %.3f%% of wall-clock time\n",
+            100 * totalPause / inSamplingSeconds );
+    
+    if( numGDBPipeWaits > 0 ) {
+        printf( "Waited for GDB %.1f times per sample, waking on arrival "
+                "saved about %.3f ms per sample\n",
+                numGDBPipeWaits / (double)numRecords,
+                1000 * gdbPipeLatencySaved / numRecords );
+        }
+    
+    
+    printf( "\n%-25s%12s  %12s  %12s  %12s\n",
+            "Target pause per sample:", "mean", "p50", "p99", "max" );
+    
+    const char *names[4] = { "stop", "capture", "resume", "total" };
+    
+    for( int p=0; p<4; p++ ) {
+        double *values = pauses;
+        if( p < 3 ) {
+            values = phases[p];
+            }
+        
+        qsort( values, numRecords, sizeof( double ), compareDoubles );
+        
+        double sum = 0;
+        for( int i=0; i<numRecords; i++ ) {
+            sum += values[i];
+            }
+        
+        printf( "    %-20s ", names[p] );
+        printMilliseconds( sum / numRecords );
+        printf( "  " );
+        printMilliseconds( getPercentile( values, numRecords, 0.5 ) );
+        printf( "  " );
+        printMilliseconds( getPercentile( values, numRecords, 0.99 ) );
+        printf( "  " );
+        printMilliseconds( values[ numRecords - 1 ] );
+        printf( "\n" );
+        }
+    
+    
+    int bucketCounts[ NUM_PAUSE_BUCKETS ];
+    memset( bucketCounts, 0, sizeof( bucketCounts ) );
+    
+    int maxCount = 0;
+    
+    for( int i=0; i<numRecords; i++ ) {
+        double us = pauses[i] * 1000000;
+        
+        int b = 0;
+        while( b < NUM_PAUSE_BUCKETS - 1 && us >= pauseBucketLimits[b] ) {
+            b++;
+            }
+        bucketCounts[b]++;
+        
+        if( bucketCounts[b] > maxCount ) {
+            maxCount = bucketCounts[b];
+            }
+        }
+    
+    printf( "\nTarget pause histogram:\n" );
+    
+    // skip empty buckets at both ends
+    int first = 0;
+    while( bucketCounts[first] == 0 ) {
+        first++;
+        }
+    int last = NUM_PAUSE_BUCKETS - 1;
+    while( bucketCounts[last] == 0 ) {
+        last--;
+        }
+    
+    for( int b=first; b<=last; b++ ) {
+        if( b < NUM_PAUSE_BUCKETS - 1 ) {
+            printf( "    < %6.0f us ", pauseBucketLimits[b] );
+            }
+        else {
+            printf( "   >= %6.0f us ", pauseBucketLimits[b - 1] );
+            }
+        
+        int width = ( bucketCounts[b] * PAUSE_HISTOGRAM_WIDTH + 
+                      maxCount - 1 ) / maxCount;
+        
+        printf( "%7d |", bucketCounts[b] );
+        for( int i=0; i<width; i++ ) {
+            printf( "#" );
+            }
+        printf( "\n" );
+        }
+    printf( "\n" );
+    
+    for( int p=0; p<3; p++ ) {
+        delete [] phases[p];
+        }
+    delete [] pauses;
+    }
+
+
+
+
+// **************************************
+// native ptrace sampling backend
+
+// Instead of asking GDB to stop the target and list its stack for every
+// sample, we can seize the target with ptrace ourselves, interrupt it,
+// read its registers, and walk its frame pointer chain.  Each stop then
+// takes microseconds instead of milliseconds.
+//
+// Frames collected this way only have addresses.  Names and source lines
+// are looked up later, in one pass, after sampling is done.
+//
+// Frame pointer walking only sees the full stack for code that keeps
+// frame pointers (build with -fno-omit-frame-pointer for best results).
+// Libraries like libc usually don't, and that's where a blocked thread
+// sits, so when the walk can't start from the frame pointer, or the
+// thread is in a system call, the stack is scanned for the nearest frame
+// record, and the chain is picked up again from there.  The libc frames
+// in between are mostly lost.
+
+
+char useNativeBackend = false;
+
+// deepest stack that we will walk
+#define MAX_NATIVE_FRAMES 256
+
+// how far above the stack pointer we scan for return addresses
+#define NATIVE_STACK_SCAN_WORDS 512
+
+// frame pointers further than this above the stack pointer are garbage
+#define NATIVE_MAX_STACK_BYTES ( 64 * 1024 * 1024 )
+
+typedef struct NativeThread {
+        int tid;
+        // in threadLog
+        int threadIndex;
+    } NativeThread;
+
+
+// threads that we have seized
+// just the main thread, unless we're sampling all threads
+SimpleVector<NativeThread> nativeThreads;
+
+
+// SIGCHLD is blocked while the native backend is running so that we
+// can sleep between samples and still wake up to service ptrace stops
+sigset_t nativeChildSignalSet;
+
+
+
+static char readTargetMemory( int inTID, uintptr_t inAddress, 
+                              void *outBuffer, int inLength ) {
+    struct iovec local = { outBuffer, (size_t)inLength };
+    struct iovec remote = { (void*)inAddress, (size_t)inLength };
+    
+    if( process_vm_readv( inTID, &local, 1, &remote, 1, 0 ) == inLength ) {
+        return true;
+        }
+
+    // process_vm_readv may not be permitted, fall back to
+    // peeking one word at a time
+    for( int i=0; i<inLength; i += sizeof( long ) ) {
+        errno = 0;
+        long word = ptrace( PTRACE_PEEKDATA, inTID, 
+                            (void*)( inAddress + i ), NULL );
+        if( errno != 0 ) {
+            return false;
+            }
+        int numToCopy = sizeof( long );
+        if( inLength - i < numToCopy ) {
+            numToCopy = inLength - i;
+            }
+        memcpy( &( ( (char*)outBuffer )[i] ), &word, numToCopy );
+        }
+    return true;
+    }
+
+
+
+static char getNativeRegisters( int inTID, uintptr_t *outPC, 
+                                uintptr_t *outSP, uintptr_t *outFP ) {
+#if defined(__x86_64__) || defined(__i386__)
+    struct user_regs_struct regs;
+    
+    if( ptrace( PTRACE_GETREGS, inTID, NULL, &regs ) == -1 ) {
+        return false;
+        }
+    
+    #if defined(__x86_64__)
+        *outPC = regs.rip;
+        *outSP = regs.rsp;
+        *outFP = regs.rbp;
+    #else
+        *outPC = regs.eip;
+        *outSP = regs.esp;
+        *outFP = regs.ebp;
+    #endif
+    
+    return true;
+#else
+    return false;
+#endif
+    }
+
+
+
+static char isNativeFramePointer( uintptr_t inFP, uintptr_t inSP ) {
+    return inFP > inSP && inFP - inSP < NATIVE_MAX_STACK_BYTES &&
+        inFP % sizeof( uintptr_t ) == 0;
+    }
+
+
+
+// true if inPC is on or just past a syscall instruction
+static char isNativeSyscall( int inTID, uintptr_t inPC ) {
+    unsigned char b[4];
+    
+    if( ! readTargetMemory( inTID, inPC - 2, b, sizeof( b ) ) ) {
+        return false;
+        }
+    // it's on it when the call is going to be restarted
+    return ( b[0] == 0x0f && b[1] == 0x05 ) || 
+        ( b[2] == 0x0f && b[3] == 0x05 );
+    }
+
+
+
+// true if inAddress is in the target's code right after a call 
+// instruction, so that it could have been pushed by that call
+static char isNativeReturnAddress( int inTID, uintptr_t inAddress ) {
+    if( findMapRegion( inAddress ) == NULL ) {
+        return false;
+        }
+    
+    unsigned char b[8];
+    
+    if( ! readTargetMemory( inTID, inAddress - 8, b, sizeof( b ) ) ) {
+        return false;
+        }
+    
+    // call rel32
+    if( b[3] == 0xe8 ) {
+        return true;
+        }
+    
+    // call through a register or memory (ff /2), 2, 3, 6 or 7 bytes 
+    // long depending on how the operand is given
+    int lengths[4] = { 2, 3, 6, 7 };
+    
+    for( int i=0; i<4; i++ ) {
+        int start = 8 - lengths[i];
+        
+        if( b[ start ] == 0xff && ( b[ start + 1 ] & 0x38 ) == 0x10 ) {
+            return true;
+            }
+        }
+    return false;
+    }
+
+
+
+// true if the frame record at inRecord, found by scanning, is part of 
+// a live chain:  its return address is real, and so is the one in the
+// record it points to (or it is the last record)
+// a single stale record left by a call that already returned can pass
+// the first test, but rarely points at another good record
+static char isNativeFrameRecord( int inTID, uintptr_t inRecord,
+                                 uintptr_t inSavedFP, 
+                                 uintptr_t inReturnAddress ) {
+    if( ! isNativeReturnAddress( inTID, inReturnAddress ) ) {
+        return false;
+        }
+    if( inSavedFP == 0 ) {
+        return true;
+        }
+    if( ! isNativeFramePointer( inSavedFP, inRecord ) ) {
+        return false;
+        }
+    
+    uintptr_t nextRecord[2];
+    
+    if( ! readTargetMemory( inTID, inSavedFP, 
+                            nextRecord, sizeof( nextRecord ) ) ) {
+        return false;
+        }
+    return nextRecord[1] == 0 || 
+        isNativeReturnAddress( inTID, nextRecord[1] );
+    }
+
+
+
+// for a leaf without a usable frame pointer, or one in a system call 
+// whose frame pointer skips over its frameless libc callers
+// scans up from inSP for the nearest frame record with a live chain, 
+// and adds what can be trusted below it:  the return address at inSP 
+// if the leaf is a system call wrapper, and the highest return address 
+// below the record, which is where its owner's callee was called from
+// other return-address-looking words in between are often left over 
+// from calls that returned, so they are skipped, and the frameless 
+// frames between the leaf and the record's owner are lost
+// if inFP is usable, the scan doesn't go past its frame record
+// returns the frame pointer to walk on from, or 0 if there isn't one
+static uintptr_t scanNativeStack( int inTID, uintptr_t inSP, 
+                                  uintptr_t inFP, char inSyscall ) {
+    uintptr_t words[ NATIVE_STACK_SCAN_WORDS ];
+    
+    // the stack can end before that, so read it in pieces, and take 
+    // the pieces before the first that fails
+    #define NATIVE_STACK_SCAN_PIECES 8
+    
+    int wordsPerPiece = NATIVE_STACK_SCAN_WORDS / NATIVE_STACK_SCAN_PIECES;
+    
+    struct iovec local = { words, sizeof( words ) };
+    struct iovec remote[ NATIVE_STACK_SCAN_PIECES ];
+    
+    for( int i=0; i<NATIVE_STACK_SCAN_PIECES; i++ ) {
+        remote[i].iov_base = 
+            (void*)( inSP + i * wordsPerPiece * sizeof( uintptr_t ) );
+        remote[i].iov_len = wordsPerPiece * sizeof( uintptr_t );
+        }
+    
+    ssize_t numBytes = process_vm_readv( inTID, &local, 1, 
+                                         remote, NATIVE_STACK_SCAN_PIECES,
+                                         0 );
+    if( numBytes <= 0 ) {
+        return 0;
+        }
+    
+    int numWords = numBytes / sizeof( uintptr_t );
+    
+    if( isNativeFramePointer( inFP, inSP ) ) {
+        int recordEnd = ( inFP - inSP ) / sizeof( uintptr_t ) + 2;
+        
+        if( recordEnd < numWords ) {
+            numWords = recordEnd;
+            }
+        }
+    
+    char syscallCaller = 
+        inSyscall && isNativeReturnAddress( inTID, words[0] );
+    
+    if( syscallCaller ) {
+        addSampleFrame( makeAddressFrame( words[0] ) );
+        }
+    
+    // the record itself is two words, saved frame pointer and then 
+    // return address, and word 0 is the syscall wrapper's return address
+    for( int i=1; i+1<numWords; i++ ) {
+        uintptr_t record = inSP + i * sizeof( uintptr_t );
+        
+        if( ! isNativeFramePointer( words[i], record ) && words[i] != 0 ) {
+            continue;
+            }
+        if( ! isNativeFrameRecord( inTID, record, 
+                                   words[i], words[ i + 1 ] ) ) {
+            continue;
+            }
+        
+        for( int j=i-1; j>=0; j-- ) {
+            if( j == 0 && syscallCaller ) {
+                break;
+                }
+            if( isNativeReturnAddress( inTID, words[j] ) ) {
+                addSampleFrame( makeAddressFrame( words[j] ) );
+                break;
+                }
+            }
+        return record;
+        }
+    return 0;
+    }
+
+
+
+// target must be stopped
+// adds frames to the last stack in sampleStacks
+static void walkNativeStack( int inTID ) {
+    uintptr_t pc, sp, fp;
+    
+    if( ! getNativeRegisters( inTID, &pc, &sp, &fp ) ) {
+        return;
+        }
+    
+    addSampleFrame( makeAddressFrame( pc ) );
+    
+    // code without frame pointers either leaves something else in the 
+    // frame pointer, or leaves it pointing past its callers
+    char syscall = isNativeSyscall( inTID, pc );
+    
+    if( ! isNativeFramePointer( fp, sp ) || syscall ) {
+        fp = scanNativeStack( inTID, sp, fp, syscall );
+        }
+    
+    while( fp != 0 && 
+           fp % sizeof( uintptr_t ) == 0 &&
+           sampleStacks.getLastElement()->numFrames < MAX_NATIVE_FRAMES ) {
+        
+        // saved frame pointer, then return address
+        uintptr_t frameRecord[2];
+        
+        if( ! readTargetMemory( inTID, fp, 
+                                frameRecord, sizeof( frameRecord ) ) ) {
+            break;
+            }
+        
+        if( frameRecord[1] == 0 ) {
+            break;
+            }
+
+        addSampleFrame( makeAddressFrame( frameRecord[1] ) );
+
+        // stack grows down, so callers' frames are always at higher
+        // addresses.  Anything else means we've walked off into garbage.
+        if( frameRecord[0] <= fp ) {
+            break;
+            }
+        fp = frameRecord[0];
+        }
+    }
+
+
+
+// result destroyed by caller
+static char *readNativeThreadName( int inTID ) {
+    char *commFileName = autoSprintf( "/proc/%d/task/%d/comm",
+                                      targetPID, inTID );
+    FILE *commFile = fopen( commFileName, "r" );
+    delete [] commFileName;
+    
+    char name[64];
+    name[0] = '\0';
+    
+    if( commFile != NULL ) {
+        if( fgets( name, sizeof( name ), commFile ) == NULL ) {
+            name[0] = '\0';
+            }
+        fclose( commFile );
+        }
+    
+    char *newlinePos = strstr( name, "\n" );
+    if( newlinePos != NULL ) {
+        newlinePos[0] = '\0';
+        }
+    
+    return stringDuplicate( name );
+    }
+
+
+
+static int findNativeThread( int inTID ) {
+    for( int i=0; i<nativeThreads.size(); i++ ) {
+        if( nativeThreads.getElement( i )->tid == inTID ) {
+            return i;
+            }
+        }
+    return -1;
+    }
+
+
+
+static void addNativeThread( int inTID ) {
+    if( findNativeThread( inTID ) != -1 ) {
+        return;
+        }
+    
+    NativeThread t = { inTID, -1 };
+    
+    if( sampleAllThreads ) {
+        char *name = readNativeThreadName( inTID );
+        t.threadIndex = getThreadIndex( inTID, name );
+        delete [] name;
+        }
+    
+    nativeThreads.push_back( t );
+    }
+
+
+
+// a PTRACE_EVENT_STOP is either our PTRACE_INTERRUPT (SIGTRAP), or a
+// group-stop, where the target was stopped by someone else (with SIGSTOP,
+// say) and must stay stopped until it gets a SIGCONT
+static char isNativeGroupStop( int inStatus ) {
+    if( ! WIFSTOPPED( inStatus ) || 
+        ( inStatus >> 16 ) != PTRACE_EVENT_STOP ) {
+        return false;
+        }
+    int signal = WSTOPSIG( inStatus );
+    
+    return signal == SIGSTOP || signal == SIGTSTP || 
+        signal == SIGTTIN || signal == SIGTTOU;
+    }
+
+
+
+// services one ptrace stop or exit that we did not ask for
+static void handleNativeEvent( int inTID, int inStatus ) {
+    if( WIFEXITED( inStatus ) || WIFSIGNALED( inStatus ) ) {
+        int index = findNativeThread( inTID );
+        if( index != -1 ) {
+            nativeThreads.deleteElement( index );
+            }
+        
+        if( inTID == targetPID ) {
+            programExited = true;
+            }
+        return;
+        }
+
+    if( ! WIFSTOPPED( inStatus ) ) {
+        return;
+        }
+    
+    int event = inStatus >> 16;
+    int signal = WSTOPSIG( inStatus );
+
+    if( sampleAllThreads ) {
+        // new threads can report their first stop before we hear 
+        // about them from their parent
+        addNativeThread( inTID );
+        }
+    
+    if( event == PTRACE_EVENT_CLONE ) {
+        unsigned long newTID;
+        
+        if( ptrace( PTRACE_GETEVENTMSG, inTID, NULL, &newTID ) == 0 ) {
+            addNativeThread( (int)newTID );
+            }
+        ptrace( PTRACE_CONT, inTID, NULL, NULL );
+        }
+    else if( event == PTRACE_EVENT_EXIT ) {
+        // last chance to see the address space of the target
+        if( targetMapsStale ) {
+            readTargetMaps();
+            }
+        ptrace( PTRACE_CONT, inTID, NULL, NULL );
+        }
+    else if( isNativeGroupStop( inStatus ) ) {
+        // leave it stopped, but still hear about its SIGCONT
+        ptrace( PTRACE_LISTEN, inTID, NULL, NULL );
+        }
+    else if( event != 0 ) {
+        // leftover interrupt, keep it running
+        ptrace( PTRACE_CONT, inTID, NULL, NULL );
+        }
+    else {
+        // signal-delivery-stop, pass the signal along to the target
+        ptrace( PTRACE_CONT, inTID, NULL, (void*)(long)signal );
+        }
+    }
+
+
+
+static void drainNativeEvents() {
+    while( true ) {
+        int status;
+        int tid = waitpid( -1, &status, __WALL | WNOHANG );
+
+        if( tid <= 0 ) {
+            return;
+            }
+        handleNativeEvent( tid, status );
+        }
+    }
+
+
+
+// sleeps until inDeadline (a getMonotonicTime value), but wakes up 
+// to service target signals and exits
+static void nativeSleepUntil( double inDeadline ) {
+    struct timespec deadline = monotonicTimeToTimespec( inDeadline );
+    
+    while( ! programExited ) {
+        drainNativeEvents();
+
+        struct timespec now;
+        clock_gettime( CLOCK_MONOTONIC, &now );
+        
+        struct timespec remaining;
+        remaining.tv_sec = deadline.tv_sec - now.tv_sec;
+        remaining.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+        if( remaining.tv_nsec < 0 ) {
+            remaining.tv_sec --;
+            remaining.tv_nsec += 1000000000;
+            }
+        
+        if( remaining.tv_sec < 0 ) {
+            return;
+            }
+        
+        sigtimedwait( &nativeChildSignalSet, NULL, &remaining );
+        }
+    }
+
+
+
+// waits until inTID enters the stop caused by our PTRACE_INTERRUPT
+// returns false if inTID went away instead
+// a group-stop counts only if inAcceptGroupStop is set (for detaching),
+// otherwise it returns false for one, leaving inTID stopped (it isn't 
+// running, so there's nothing to sample)
+static char waitForNativeStop( int inTID, char inAcceptGroupStop ) {
+    while( true ) {
+        int status;
+        int result = waitpid( inTID, &status, __WALL );
+        
+        if( result == -1 ) {
+            if( errno == EINTR ) {
+                continue;
+                }
+            return false;
+            }
+        
+        if( WIFSTOPPED( status ) && 
+            ( status >> 16 ) == PTRACE_EVENT_STOP &&
+            ( inAcceptGroupStop || ! isNativeGroupStop( status ) ) ) {
+            return true;
+            }
+        
+        // something else happened first, like a signal arriving
+        // our interrupt is still pending, unless this was a group-stop
+        handleNativeEvent( inTID, status );
+        
+        if( WIFEXITED( status ) || WIFSIGNALED( status ) ||
+            isNativeGroupStop( status ) ) {
+            return false;
+            }
+        }
+    }
+
+
+
+// threads for each phase of takeNativeSamples
+// kept from sample to sample, like sampleStacks
+SimpleVector<NativeThread> threadsToStop;
+SimpleVector<NativeThread> interruptedThreads;
+SimpleVector<NativeThread> stoppedThreads;
+
+
+
+// stops all seized threads, grabs their stacks, and resumes them
+// returns true if any samples were taken
+static char takeNativeSamples() {
+    
+    // threads may be removed from nativeThreads as we go
+    threadsToStop.deleteStartElements( threadsToStop.size() );
+    
+    for( int i=0; i<nativeThreads.size(); i++ ) {
+        threadsToStop.push_back( nativeThreads.getElementDirect( i ) );
+        }
+    
+    interruptedThreads.deleteStartElements( interruptedThreads.size() );
+    stoppedThreads.deleteStartElements( stoppedThreads.size() );
+    
+    // stop everyone first, so that all stacks come from the same moment
+    currentPause.interrupted = getMonotonicTime();
+    
+    for( int i=0; i<threadsToStop.size(); i++ ) {
+        NativeThread t = threadsToStop.getElementDirect( i );
+        
+        if( ptrace( PTRACE_INTERRUPT, t.tid, NULL, NULL ) == 0 ) {
+            interruptedThreads.push_back( t );
+            }
+        }
+
+    for( int i=0; i<interruptedThreads.size(); i++ ) {
+        NativeThread t = interruptedThreads.getElementDirect( i );
+        
+        if( waitForNativeStop( t.tid, false ) ) {
+            stoppedThreads.push_back( t );
+            }
+        }
+    
+    currentPause.stopped = getMonotonicTime();
+    
+    clearSampleStacks();
+
+    for( int i=0; i<stoppedThreads.size(); i++ ) {
+        NativeThread t = stoppedThreads.getElementDirect( i );
+        
+        startSampleStack( t.threadIndex );
+        walkNativeStack( t.tid );
+        }
+    
+    currentPause.captured = getMonotonicTime();
+    
+    for( int i=0; i<stoppedThreads.size(); i++ ) {
+        ptrace( PTRACE_CONT, stoppedThreads.getElementDirect( i ).tid, 
+                NULL, NULL );
+        }
+    
+    currentPause.resumed = getMonotonicTime();
+    
+    // target running again, now do our bookkeeping
+    
+    char anyStacks = false;
+    
+    for( int s=0; s<sampleStacks.size(); s++ ) {
+        SampleStack *thisStack = sampleStacks.getElement( s );
+        
+        if( thisStack->numFrames == 0 ) {
+            continue;
+            }
+        anyStacks = true;
+        
+        if( ! addSampleStack( s, 1, currentSampleWeight ) ) {
+            continue;
+            }
+
+        // new stack
+        // threads often name themselves after they start
+        if( thisStack->threadIndex >= 0 ) {
+            ThreadRecord *r = 
+                threadLog.getElement( thisStack->threadIndex );
+            char *name = readNativeThreadName( r->id );
+            
+            if( name[0] != '\0' ) {
+                getThreadIndex( r->id, name );
+                }
+            delete [] name;
+            }
+        }
+
+    if( targetMapsStale ) {
+        readTargetMaps();
+        }
+
+    return anyStacks;
+    }
+
+
+
+// returns false on failure
+static char nativeSeize( int inPID, int inOptions ) {
+    int options = inOptions | PTRACE_O_TRACEEXIT;
+    
+    if( sampleAllThreads ) {
+        // new threads get seized automatically
+        options |= PTRACE_O_TRACECLONE;
+        }
+    
+    if( ptrace( PTRACE_SEIZE, inPID, NULL, (void*)(long)options ) == -1 ) {
+        return false;
+        }
+    
+    targetPID = inPID;
+    addNativeThread( inPID );
+    
+    if( sampleAllThreads ) {
+        // seize threads that already exist
+        // keep scanning until no new ones show up, in case threads are
+        // being created while we scan
+        char *taskDirName = autoSprintf( "/proc/%d/task", inPID );
+        
+        char foundNew = true;
+        
+        while( foundNew ) {
+            foundNew = false;
+            
+            DIR *taskDir = opendir( taskDirName );
+            
+            if( taskDir == NULL ) {
+                break;
+                }
+            
+            struct dirent *entry;
+            
+            while( ( entry = readdir( taskDir ) ) != NULL ) {
+                int tid;
+                
+                if( sscanf( entry->d_name, "%d", &tid ) == 1 &&
+                    findNativeThread( tid ) == -1 &&
+                    ptrace( PTRACE_SEIZE, tid, NULL, 
+                            (void*)(long)options ) == 0 ) {
+                    
+                    addNativeThread( tid );
+                    foundNew = true;
+                    }
+                }
+            closedir( taskDir );
+            }
+        
+        delete [] taskDirName;
+        }
+    
+    sigemptyset( &nativeChildSignalSet );
+    sigaddset( &nativeChildSignalSet, SIGCHLD );
+    sigprocmask( SIG_BLOCK, &nativeChildSignalSet, NULL );
+    
+    return true;
+    }
+
+
+
+// starts inProgName under our control, with output redirected
+// to wcOut.txt like GDB's run
+// returns PID, or -1 on failure
+static int nativeStartProgram( const char *inProgName, 
+                               const char *inProgArgs ) {
+    
+    int childPID = fork();
+    
+    if( childPID == -1 ) {
+        return -1;
+        }
+    else if( childPID == 0 ) {
+        // wait here until parent has seized us
+        kill( getpid(), SIGSTOP );
+        
+        // let the shell handle args and redirection, then replace itself
+        // with the program so that the PID stays the same
+        char *command = autoSprintf( "exec %s %s > wcOut.txt", 
+                                     inProgName, inProgArgs );
+        
+        execl( "/bin/sh", "sh", "-c", command, (char*)NULL );
+        
+        exit( 1 );
+        }
+    
+    int status;
+    waitpid( childPID, &status, WUNTRACED );
+
+    if( ! nativeSeize( childPID, PTRACE_O_EXITKILL ) ) {
+        kill( childPID, SIGKILL );
+        return -1;
+        }
+    
+    kill( childPID, SIGCONT );
+    
+    return childPID;
+    }
+
+
+
+static void nativeDetach() {
+    SimpleVector<NativeThread> threadsToDetach = nativeThreads;
+    
+    for( int i=0; i<threadsToDetach.size(); i++ ) {
+        int tid = threadsToDetach.getElementDirect( i ).tid;
+        
+        // a thread in a group-stop stays stopped after we detach
+        if( ptrace( PTRACE_INTERRUPT, tid, NULL, NULL ) == 0 &&
+            waitForNativeStop( tid, true ) ) {
+        
+            ptrace( PTRACE_DETACH, tid, NULL, NULL );
+            }
+        }
+    }
+
+
+
+
+// **************************************
+// on-CPU samples from perf_event_open
+
+// Stopping the target tells us where each thread is, but not whether
+// it was running or waiting.  With --perf, the kernel also samples each
+// thread's user-space call chain every millisecond of CPU time that it
+// uses, into a ring buffer for each thread that we drain between stops,
+// without stopping anything.
+//
+// After sampling, each reported stack is matched against these on-CPU
+// samples to see how much of its wall-clock time was spent on a CPU.
+
+
+char usePerf = false;
+
+// one on-CPU sample for each millisecond of CPU time
+#define PERF_SAMPLE_PERIOD_NS 1000000
+
+// size of each thread's ring buffer, not counting the header page
+// we drain between stops, so this only needs to hold a few dozen samples
+#define PERF_RING_PAGES 32
+
+
+typedef struct PerfThread {
+        int tid;
+        int fd;
+        unsigned char *ring;
+        // for noticing threads that have exited
+        char seen;
+    } PerfThread;
+
+
+// the kernel won't let events of different threads share a ring buffer
+// unless they're bound to a CPU, so each thread gets its own
+SimpleVector<PerfThread> perfThreads;
+
+size_t perfRingLength = 0;
+size_t perfPageSize = 0;
+
+// from PERF_RECORD_LOST, if we don't drain fast enough
+long perfLostCount = 0;
+
+int numPerfSamples = 0;
+
+// unique on-CPU stacks
+// frames don't own their strings, and only the innermost frame gets a
+// name from resolveFrameNames
+SimpleVector<Stack> perfStackLog;
+
+HashIndex perfStackLogIndex = { NULL, NULL, 0, 0 };
+
+// parallel to perfStackLog while sampling
+SimpleVector<StackKey> perfStackLogKeys;
+
+
+
+static int openPerfEvent( int inTID ) {
+    struct perf_event_attr attr;
+    memset( &attr, 0, sizeof( attr ) );
+    
+    attr.size = sizeof( attr );
+    attr.type = PERF_TYPE_SOFTWARE;
+    attr.config = PERF_COUNT_SW_TASK_CLOCK;
+    attr.sample_period = PERF_SAMPLE_PERIOD_NS;
+    attr.sample_type = PERF_SAMPLE_TID | PERF_SAMPLE_CALLCHAIN;
+    attr.disabled = 1;
+    // we only want to walk user stacks, but time spent in system calls
+    // is on-CPU time too
+    attr.exclude_callchain_kernel = 1;
+    
+    int fd = syscall( SYS_perf_event_open, &attr, inTID, -1, -1, 
+                      PERF_FLAG_FD_CLOEXEC );
+
+    if( fd == -1 && errno == EACCES ) {
+        // not allowed to see kernel-side samples, settle for user time
+        attr.exclude_kernel = 1;
+        fd = syscall( SYS_perf_event_open, &attr, inTID, -1, -1, 
+                      PERF_FLAG_FD_CLOEXEC );
+        }
+    return fd;
+    }
+
+
+
+static void drainPerfRing( unsigned char *inRing );
+
+
+
+// opens events for threads of the target that we don't know about yet,
+// and closes events of threads that are gone
+// returns false if perf events can't be used at all
+static char updatePerfThreads() {
+    char *taskDirName = autoSprintf( "/proc/%d/task", targetPID );
+    
+    DIR *taskDir = opendir( taskDirName );
+    
+    delete [] taskDirName;
+    
+    if( taskDir == NULL ) {
+        // target gone, keep what we had
+        return true;
+        }
+    
+    for( int i=0; i<perfThreads.size(); i++ ) {
+        perfThreads.getElement( i )->seen = false;
+        }
+    
+    char failed = false;
+    
+    struct dirent *entry;
+    
+    while( ( entry = readdir( taskDir ) ) != NULL && !failed ) {
+        int tid;
+        
+        if( sscanf( entry->d_name, "%d", &tid ) != 1 ) {
+            continue;
+            }
+        
+        char known = false;
+        for( int i=0; i<perfThreads.size(); i++ ) {
+            PerfThread *t = perfThreads.getElement( i );
+            if( t->tid == tid ) {
+                t->seen = true;
+                known = true;
+                break;
+                }
+            }
+        if( known ) {
+            continue;
+            }
+        
+        int fd = openPerfEvent( tid );
+        
+        if( fd == -1 ) {
+            if( perfThreads.size() == 0 ) {
+                printf( "Failed to open perf event for thread %d (%s)\n",
+                        tid, strerror( errno ) );
+                failed = true;
+                }
+            // else thread exited while we were looking at it
+            continue;
+            }
+        
+        if( perfPageSize == 0 ) {
+            perfPageSize = sysconf( _SC_PAGESIZE );
+            perfRingLength = ( 1 + PERF_RING_PAGES ) * perfPageSize;
+            }
+        
+        void *ring = mmap( NULL, perfRingLength, 
+                           PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+        
+        if( ring == MAP_FAILED ) {
+            printf( "Failed to map perf ring buffer for thread %d (%s)\n",
+                    tid, strerror( errno ) );
+            close( fd );
+            if( perfThreads.size() == 0 ) {
+                failed = true;
+                }
+            continue;
+            }
+        
+        ioctl( fd, PERF_EVENT_IOC_ENABLE, 0 );
+        
+        PerfThread t = { tid, fd, (unsigned char*)ring, true };
+        perfThreads.push_back( t );
+        }
+    closedir( taskDir );
+    
+    for( int i=perfThreads.size() - 1; i>=0; i-- ) {
+        PerfThread *t = perfThreads.getElement( i );
+        
+        if( ! t->seen ) {
+            // get its last samples
+            drainPerfRing( t->ring );
+            
+            munmap( t->ring, perfRingLength );
+            close( t->fd );
+            perfThreads.deleteElement( i );
+            }
+        }
+    
+    return !failed;
+    }
+
+
+
+// copies inLength bytes out of a ring buffer's data area, 
+// which may wrap around
+static void readPerfRing( unsigned char *inRing, uint64_t inOffset, 
+                          void *outData, size_t inLength ) {
+    size_t dataSize = PERF_RING_PAGES * perfPageSize;
+    unsigned char *data = &( inRing[ perfPageSize ] );
+    
+    size_t start = inOffset % dataSize;
+    size_t firstPart = inLength;
+    
+    if( start + firstPart > dataSize ) {
+        firstPart = dataSize - start;
+        }
+    memcpy( outData, &( data[ start ] ), firstPart );
+    
+    if( firstPart < inLength ) {
+        memcpy( (unsigned char*)outData + firstPart, data, 
+                inLength - firstPart );
+        }
+    }
+
+
+
+// frame IDs of the sample being read, reused for every sample
+SimpleVector<unsigned int> perfFrameIDs;
+
+// big enough for the biggest record we've read so far
+unsigned char *perfRecordBuffer = NULL;
+unsigned int perfRecordBufferSize = 0;
+
+
+
+static void addPerfSample( unsigned int *inFrameIDs, int inNumFrames ) {
+    numPerfSamples++;
+    
+    char isNew;
+    
+    int index = findOrAddStack( &perfStackLog, &perfStackLogKeys,
+                                &perfStackLogIndex,
+                                inFrameIDs, inNumFrames, -1, &isNew );
+    
+    perfStackLog.getElement( index )->sampleCount++;
+    
+    if( isNew ) {
+        checkFramesMapped( inFrameIDs, inNumFrames );
+        logPerfStackRecord( inFrameIDs, inNumFrames );
+        }
+    
+    logPerfSampleRecord( index );
+    }
+
+
+
+// pulls all waiting samples out of one thread's ring buffer
+static void drainPerfRing( unsigned char *inRing ) {
+    struct perf_event_mmap_page *header = 
+        (struct perf_event_mmap_page*)inRing;
+
+    uint64_t head = __atomic_load_n( &( header->data_head ), 
+                                     __ATOMIC_ACQUIRE );
+    uint64_t tail = header->data_tail;
+    
+    while( tail < head ) {
+        struct perf_event_header h;
+        readPerfRing( inRing, tail, &h, sizeof( h ) );
+        
+        if( h.size < sizeof( h ) ) {
+            // corrupt, give up on what's left
+            tail = head;
+            break;
+            }
+        
+        if( h.size > perfRecordBufferSize ) {
+            if( perfRecordBuffer != NULL ) {
+                delete [] perfRecordBuffer;
+                }
+            perfRecordBufferSize = h.size;
+            perfRecordBuffer = new unsigned char[ perfRecordBufferSize ];
+            }
+        
+        unsigned char *r = perfRecordBuffer;
+        readPerfRing( inRing, tail, r, h.size );
+        
+        if( h.type == PERF_RECORD_SAMPLE ) {
+            // pid, tid, then call chain
+            uint64_t numIPs;
+            memcpy( &numIPs, &( r[ sizeof( h ) + 8 ] ), 8 );
+            
+            uint64_t *ips = (uint64_t*)&( r[ sizeof( h ) + 16 ] );
+            
+            if( sizeof( h ) + 16 + numIPs * 8 > h.size ) {
+                numIPs = 0;
+                }
+            
+            perfFrameIDs.deleteStartElements( perfFrameIDs.size() );
+            
+            for( uint64_t i=0; i<numIPs; i++ ) {
+                // skip PERF_CONTEXT_USER and friends
+                if( ips[i] < (uint64_t)PERF_CONTEXT_MAX ) {
+                    perfFrameIDs.push_back( 
+                        internFrame( makeAddressFrame( ips[i] ) ) );
+                    }
+                }
+            
+            if( perfFrameIDs.size() > 0 ) {
+                addPerfSample( perfFrameIDs.getElement( 0 ), 
+                               perfFrameIDs.size() );
+                }
+            }
+        else if( h.type == PERF_RECORD_LOST ) {
+            // id, then count
+            uint64_t lost;
+            memcpy( &lost, &( r[ sizeof( h ) + 8 ] ), 8 );
+            perfLostCount += lost;
+            }
+        
+        
+        tail += h.size;
+        }
+    
+    __atomic_store_n( &( header->data_tail ), tail, __ATOMIC_RELEASE );
+    }
+
+
+
+static void drainPerfSamples() {
+    for( int i=0; i<perfThreads.size(); i++ ) {
+        drainPerfRing( perfThreads.getElement( i )->ring );
+        }
+    }
+
+
+
+static void stopPerfSampling() {
+    for( int i=0; i<perfThreads.size(); i++ ) {
+        ioctl( perfThreads.getElement( i )->fd, PERF_EVENT_IOC_DISABLE, 0 );
+        }
+    
+    drainPerfSamples();
+    
+    for( int i=0; i<perfThreads.size(); i++ ) {
+        PerfThread *t = perfThreads.getElement( i );
+        munmap( t->ring, perfRingLength );
+        close( t->fd );
+        }
+    perfThreads.deleteAll();
+    
+    if( perfRecordBuffer != NULL ) {
+        delete [] perfRecordBuffer;
+        perfRecordBuffer = NULL;
+        perfRecordBufferSize = 0;
+        }
+    perfFrameIDs.deleteAll();
+    }
+
+
+
+// returns false if perf events can't be used
+static char startPerfSampling() {
+    if( ! updatePerfThreads() || perfThreads.size() == 0 ) {
+        stopPerfSampling();
+        return false;
+        }
+    return true;
+    }
+
+
+
+// on-CPU samples and report stacks match if they have the same
+// innermost function and the same return addresses
+// partial stacks (stack roots) only need their frames to match the
+// outermost frames of a deeper on-CPU stack
+//
+// stacks (wall-clock or on-CPU) that match each other share a group
+typedef struct OnCPUGroup {
+        // first stack found for the group, whose frames stand for all
+        // of them
+        Stack *stack;
+        double wallSeconds;
+        int onCPUSamples;
+    } OnCPUGroup;
+
+
+
+typedef struct OnCPUGroupLookup {
+        SimpleVector<OnCPUGroup> *groups;
+        Stack *stack;
+        // frames of stack to match, starting at skip
+        int skip;
+        int numFrames;
+        char isPartial;
+    } OnCPUGroupLookup;
+
+
+
+// covers what a match compares: frame addresses, except the innermost
+// frame of a full stack, which only counts by name
+static unsigned int hashOnCPUGroupKey( OnCPUGroupLookup *inKey ) {
+    uint64_t h = 14695981039346656037ULL;
+    
+    int f = 0;
+    
+    if( ! inKey->isPartial ) {
+        char *funcName = 
+            inKey->stack->frames.getElement( inKey->skip )->funcName;
+        h ^= hashBytes( funcName, strlen( funcName ) );
+        h *= 1099511628211ULL;
+        f = 1;
+        }
+    
+    for( ; f<inKey->numFrames; f++ ) {
+        h ^= (uint64_t)(uintptr_t)
+            inKey->stack->frames.getElement( inKey->skip + f )->address;
+        h *= 1099511628211ULL;
+        h ^= h >> 29;
+        }
+    
+    return (unsigned int)( h ^ ( h >> 32 ) );
+    }
+
+
+
+static char onCPUGroupMatches( int inNumber, void *inKey ) {
+    OnCPUGroupLookup *l = (OnCPUGroupLookup*)inKey;
+    Stack *groupStack = l->groups->getElement( inNumber )->stack;
+    
+    if( groupStack->frames.size() != l->numFrames ) {
+        return false;
+        }
+    
+    int f = 0;
+    
+    if( ! l->isPartial ) {
+        if( strcmp( groupStack->frames.getElement( 0 )->funcName,
+                    l->stack->frames.getElement( l->skip )->funcName ) 
+            != 0 ) {
+            return false;
+            }
+        f = 1;
+        }
+    
+    for( ; f<l->numFrames; f++ ) {
+        if( groupStack->frames.getElement( f )->address !=
+            l->stack->frames.getElement( l->skip + f )->address ) {
+            return false;
+            }
+        }
+    return true;
+    }
+
+
+
+// sets onCPUFraction for each stack in ioStacks
+// names must already be resolved
+// the stacks are gathered into groups of matching stacks, and each 
+// on-CPU stack is looked up in those groups, rather than comparing 
+// every stack against every other one
+static void labelOnCPUFractions( SimpleVector<Stack> *ioStacks,
+                                 char inIsPartial ) {
+    
+    double perfSecondsPerSample = PERF_SAMPLE_PERIOD_NS / 1000000000.0;
+    
+    SimpleVector<OnCPUGroup> groups;
+    HashIndex index = { NULL, NULL, 0, 0 };
+    
+    OnCPUGroupLookup lookup;
+    lookup.groups = &groups;
+    lookup.skip = 0;
+    lookup.isPartial = inIsPartial;
+    
+    int *stackGroups = new int[ ioStacks->size() ];
+    
+    int maxFrames = 0;
+    
+    for( int i=0; i<ioStacks->size(); i++ ) {
+        Stack *s = ioStacks->getElement( i );
+        
+        // the same stack from different threads, or with different
+        // instructions in the innermost function, matches the same
+        // on-CPU samples, so their time has to be added up
+        lookup.stack = s;
+        lookup.numFrames = s->frames.size();
+        
+        unsigned int hash = hashOnCPUGroupKey( &lookup );
+        
+        int g = findInHashIndex( &index, hash, onCPUGroupMatches, &lookup );
+        
+        if( g == -1 ) {
+            OnCPUGroup newGroup = { s, 0, 0 };
+            groups.push_back( newGroup );
+            g = groups.size() - 1;
+            addToHashIndex( &index, g, hash );
+            }
+        
+        groups.getElement( g )->wallSeconds += s->sampleSeconds;
+        stackGroups[i] = g;
+        
+        if( lookup.numFrames > maxFrames ) {
+            maxFrames = lookup.numFrames;
+            }
+        }
+    
+    for( int j=0; j<perfStackLog.size(); j++ ) {
+        Stack *p = perfStackLog.getElement( j );
+        
+        lookup.stack = p;
+        
+        // a partial stack matches the roots of deeper on-CPU stacks, 
+        // but not a whole on-CPU stack
+        int minFrames = p->frames.size();
+        int maxFramesToTry = p->frames.size();
+        
+        if( inIsPartial ) {
+            minFrames = 1;
+            maxFramesToTry = p->frames.size() - 1;
+            
+            if( maxFramesToTry > maxFrames ) {
+                maxFramesToTry = maxFrames;
+                }
+            }
+        
+        for( int n=minFrames; n<=maxFramesToTry; n++ ) {
+            lookup.numFrames = n;
+            lookup.skip = p->frames.size() - n;
+            
+            int g = findInHashIndex( &index, hashOnCPUGroupKey( &lookup ),
+                                     onCPUGroupMatches, &lookup );
+            if( g != -1 ) {
+                groups.getElement( g )->onCPUSamples += p->sampleCount;
+                }
+            }
+        }
+    
+    for( int i=0; i<ioStacks->size(); i++ ) {
+        OnCPUGroup *g = groups.getElement( stackGroups[i] );
+        
+        double fraction = 
+            ( g->onCPUSamples * perfSecondsPerSample ) / g->wallSeconds;
+        
+        if( fraction > 1 ) {
+            fraction = 1;
+            }
+        ioStacks->getElement( i )->onCPUFraction = fraction;
+        }
+    
+    delete [] stackGroups;
+    freeHashIndex( &index );
+    }
+
+
+
+
+// **************************************
+// address to name lookup, for frames that only have addresses
+
+// Frames from the native backend, or from the GDB backend in 
+// --lazySymbols mode, only have addresses while we're sampling.
+// After sampling, we gather up every unique address and have GDB look
+// them all up at once.
+
+
+// return addresses point after the call, which may be past the end of 
+// the calling line (or even the calling function), so we look up
+// the byte before instead
+#define RETURN_ADDRESS_LOOKUP_OFFSET 1
+
+
+typedef struct SymbolInfo {
+        uintptr_t address;
+        char *funcName;
+        char *fileName;
+        int lineNum;
+    } SymbolInfo;
+
+
+// one entry for each unique lookup address, sorted by address
+// owns its strings
+SimpleVector<SymbolInfo> symbolCache;
+
+// names from the symbol records of a sample log that we're reporting 
+// on, sorted by address, so they don't have to be looked up again
+// strings are interned
+SimpleVector<SymbolInfo> loggedSymbols;
+
+
+// how many addresses to look up with each GDB command
+#define SYMBOL_BATCH_SIZE 100
+
+
+
+// concatenates the text of all ~"..." console stream records 
+// in inResponse, unescaping them along the way
+// result destroyed by caller
+static char *getConsoleStreamText( char *inResponse ) {
+    SimpleVector<char> text;
+    
+    char *recordStart = strstr( inResponse, "~\"" );
+    
+    while( recordStart != NULL ) {
+        char *start = &( recordStart[2] );
+        char *c = start;
+        
+        // find the closing quote
+        while( c[0] != '\0' && c[0] != '"' ) {
+            if( c[0] == '\\' && c[1] != '\0' ) {
+                c = &( c[1] );
+                }
+            c = &( c[1] );
+            }
+        
+        char *unescaped = new char[ c - start ];
+        int length = unescapeGDBString( start, c, unescaped );
+        text.push_back( unescaped, length );
+        delete [] unescaped;
+        
+        recordStart = strstr( c, "\n~\"" );
+        if( recordStart != NULL ) {
+            recordStart = &( recordStart[1] );
+            }
+        }
+    
+    return text.getElementString();
+    }
+
+
+
+// parses a line of output from "info symbol ADDR", which looks like:
+// fseek + 10 in section .text of /lib/x86_64-linux-gnu/libc.so.6
+// returns true if inLine was info symbol output
+static char parseSymbolLine( char *inLine, SymbolInfo *ioInfo ) {
+    if( strstr( inLine, "No symbol matches" ) == inLine ) {
+        // same as GDB's name for frames it knows nothing about
+        ioInfo->funcName = stringDuplicate( "??" );
+        return true;
+        }
+    
+    char *sectionPos = strstr( inLine, " in section " );
+    
+    if( sectionPos == NULL ) {
+        return false;
+        }
+
+    char *name = stringDuplicate( inLine );
+    name[ sectionPos - inLine ] = '\0';
+    
+    char *offsetPos = strstr( name, " + " );
+    if( offsetPos != NULL ) {
+        offsetPos[0] = '\0';
+        }
+    
+    ioInfo->funcName = name;
+    return true;
+    }
+
+
+
+// parses a line of output from "info line *ADDR", which looks like:
+// Line 15 of "testProf.cpp" starts at address ...
+// returns true if inLine was info line output
+static char parseLineLine( char *inLine, SymbolInfo *ioInfo ) {
+    if( strstr( inLine, "No line number information" ) == inLine ) {
+        ioInfo->fileName = stringDuplicate( "" );
+        return true;
+        }
+    
+    const char *fileMarker = " of \"";
+    
+    char *filePos = strstr( inLine, fileMarker );
+    
+    if( strstr( inLine, "Line " ) != inLine || filePos == NULL ) {
+        return false;
+        }
+    
+    sscanf( inLine, "Line %d", &( ioInfo->lineNum ) );
+    
+    char *fileName = stringDuplicate( &( filePos[ strlen( fileMarker ) ] ) );
+    
+    char *fileEnd = strstr( fileName, "\"" );
+    if( fileEnd != NULL ) {
+        fileEnd[0] = '\0';
+        }
+    
+    ioInfo->fileName = fileName;
+    return true;
+    }
+
+
+
+// adds the real path of inPath to ioPaths, if it exists
+static void addRealPath( SimpleVector<char*> *ioPaths, const char *inPath ) {
+    char *path = realpath( inPath, NULL );
+    
+    if( path != NULL ) {
+        ioPaths->push_back( stringDuplicate( path ) );
+        free( path );
+        }
+    }
+
+
+
+// gets the real paths of the objects that GDB already has symbols for: 
+// the program it was started with, and the shared libraries it knows 
+// are loaded in the target (none once the target has exited)
+static void getGDBLoadedObjects( SimpleVector<char*> *outPaths ) {
+    const char *commands[2] = { "info files", "info sharedlibrary" };
+    
+    for( int c=0; c<2; c++ ) {
+        sendCommand( commands[c] );
+        
+        char *response = getGDBResponse();
+        char *text = getConsoleStreamText( response );
+        delete [] response;
+        
+        int numLines;
+        char **lines = split( text, "\n", &numLines );
+        delete [] text;
+        
+        for( int i=0; i<numLines; i++ ) {
+            char *line = lines[i];
+            
+            // Symbols from "/home/me/myProgram".
+            const char *symbolsMarker = "Symbols from \"";
+            
+            if( strstr( line, symbolsMarker ) == line ) {
+                char *path = &( line[ strlen( symbolsMarker ) ] );
+                char *pathEnd = strstr( path, "\"" );
+                
+                if( pathEnd != NULL ) {
+                    pathEnd[0] = '\0';
+                    addRealPath( outPaths, path );
+                    }
+                }
+            
+            // From  To  Syms Read  Shared Object Library
+            // 0x00007ffff7fc5090  0x00007ffff7fee315  Yes  /lib64/ld...
+            // "No" if GDB couldn't read the library's symbols
+            char *yesPos = strstr( line, "  Yes " );
+            char *path = strstr( line, "/" );
+            
+            if( strstr( line, "0x" ) == line && yesPos != NULL && 
+                path != NULL && path > yesPos ) {
+                addRealPath( outPaths, path );
+                }
+            
+            delete [] line;
+            }
+        delete [] lines;
+        }
+    }
+
+
+
+// tells GDB where each shared object containing one of our sampled
+// addresses was loaded in the target, unless GDB already knows
+static void loadTargetSymbolsIntoGDB() {
+    
+    sendCommand( "set confirm off" );
+    skipGDBResponse();
+    
+    // adding an object GDB already has would load its symbols twice
+    SimpleVector<char*> gdbLoadedPaths;
+    
+    getGDBLoadedObjects( &gdbLoadedPaths );
+    
+    SimpleVector<char*> loadedPaths;
+    
+    for( int i=0; i<targetMaps.size(); i++ ) {
+        MapRegion *r = targetMaps.getElement( i );
+        
+        if( r->path[0] != '/' ) {
+            // [vdso] and friends have no file
+            continue;
+            }
+        
+        char alreadyLoaded = false;
+        for( int p=0; p<loadedPaths.size(); p++ ) {
+            if( strcmp( loadedPaths.getElementDirect( p ), r->path ) == 0 ) {
+                alreadyLoaded = true;
+                break;
+                }
+            }
+        for( int p=0; p<gdbLoadedPaths.size(); p++ ) {
+            if( strcmp( gdbLoadedPaths.getElementDirect( p ), 
+                        r->path ) == 0 ) {
+                alreadyLoaded = true;
+                break;
+                }
+            }
+        if( alreadyLoaded ) {
+            continue;
+            }
+        loadedPaths.push_back( r->path );
+
+        uintptr_t bias;
+        
+        if( ! getLoadBias( r, &bias ) || bias == 0 ) {
+            // not relocated, a non-PIE executable that GDB already
+            // loaded at its link-time addresses
+            continue;
+            }
+        
+        char *command = autoSprintf( "add-symbol-file %s -o 0x%lx",
+                                     r->path, (unsigned long)bias );
+        sendCommand( command );
+        delete [] command;
+        
+        skipGDBResponse();
+        }
+    
+    for( int p=0; p<gdbLoadedPaths.size(); p++ ) {
+        delete [] gdbLoadedPaths.getElementDirect( p );
+        }
+    }
+
+
+
+// looks up one address with its own pair of GDB commands
+static void resolveSymbolAlone( SymbolInfo *ioInfo ) {
+    const char *commandFormats[2] = { "info symbol 0x%lx",
+                                      "info line *0x%lx" };
+    
+    for( int c=0; c<2; c++ ) {
+        char *command = autoSprintf( commandFormats[c], 
+                                     (unsigned long)ioInfo->address );
+        sendCommand( command );
+        delete [] command;
+    
+        char *response = getGDBResponse();
+        char *text = getConsoleStreamText( response );
+        delete [] response;
+        
+        int numLines;
+        char **lines = split( text, "\n", &numLines );
+        delete [] text;
+        
+        for( int i=0; i<numLines; i++ ) {
+            if( ioInfo->funcName == NULL ) {
+                parseSymbolLine( lines[i], ioInfo );
+                }
+            if( ioInfo->fileName == NULL ) {
+                parseLineLine( lines[i], ioInfo );
+                }
+            delete [] lines[i];
+            }
+        delete [] lines;
+        }
+    }
+
+
+
+// looks up a batch of symbolCache entries with one GDB round trip,
+// by sourcing a script of info commands
+static void resolveSymbolBatch( int inStart, int inEnd ) {
+    char scriptPath[] = "/tmp/wcSymbolsXXXXXX";
+    
+    int scriptFD = mkstemp( scriptPath );
+    
+    FILE *scriptFile = NULL;
+    
+    if( scriptFD != -1 ) {
+        scriptFile = fdopen( scriptFD, "w" );
+        }
+    
+    if( scriptFile != NULL ) {
+        for( int i=inStart; i<inEnd; i++ ) {
+            unsigned long address = 
+                (unsigned long)symbolCache.getElement( i )->address;
+            
+            fprintf( scriptFile, 
+                     "echo wcp-addr %d\\n\n"
+                     "info symbol 0x%lx\n"
+                     "info line *0x%lx\n",
+                     i, address, address );
+            }
+        fclose( scriptFile );
+        
+        char *command = autoSprintf( "source %s", scriptPath );
+        sendCommand( command );
+        delete [] command;
+        
+        char *response = getGDBResponse();
+        char *text = getConsoleStreamText( response );
+        delete [] response;
+        
+        unlink( scriptPath );
+        
+        int numLines;
+        char **lines = split( text, "\n", &numLines );
+        delete [] text;
+        
+        SymbolInfo *current = NULL;
+        
+        for( int i=0; i<numLines; i++ ) {
+            int index;
+            
+            if( sscanf( lines[i], "wcp-addr %d", &index ) == 1 ) {
+                current = NULL;
+                if( index >= inStart && index < inEnd ) {
+                    current = symbolCache.getElement( index );
+                    }
+                }
+            else if( current != NULL ) {
+                if( current->funcName == NULL ) {
+                    parseSymbolLine( lines[i], current );
+                    }
+                if( current->fileName == NULL ) {
+                    parseLineLine( lines[i], current );
+                    }
+                }
+            delete [] lines[i];
+            }
+        delete [] lines;
+        }
+    
+    // anything the batch missed (for example, if the script stopped
+    // early because of an error) gets looked up on its own
+    for( int i=inStart; i<inEnd; i++ ) {
+        SymbolInfo *info = symbolCache.getElement( i );
+        
+        if( info->funcName == NULL || info->fileName == NULL ) {
+            resolveSymbolAlone( info );
+            }
+        if( info->funcName == NULL ) {
+            info->funcName = stringDuplicate( "??" );
+            }
+        if( info->fileName == NULL ) {
+            info->fileName = stringDuplicate( "" );
+            }
+        }
+    }
+
+
+
+// **************************************
+// built-in symbol lookup, straight from ELF files
+
+// GDB can take minutes to load the symbols of a big binary, and looking
+// up names through it costs a round trip per batch.  With 
+// --builtinSymbols, we map each object file that our samples came from,
+// read its symbol table and DWARF line table into sorted arrays, and 
+// look up every address with a couple of binary searches.
+//
+// This doesn't know about inlined functions, and compressed debug
+// sections are skipped.
+
+
+char useBuiltinSymbols = false;
+
+
+typedef struct ELFSymbol {
+        uintptr_t address;
+        uintptr_t size;
+        // points into mapped string table
+        const char *name;
+        // prefer global names when several symbols share an address
+        int bindRank;
+    } ELFSymbol;
+
+
+typedef struct LineRow {
+        uintptr_t address;
+        // index into SymbolFile's lineFileNames
+        int fileIndex;
+        int lineNum;
+        char isEndSequence;
+    } LineRow;
+
+
+typedef struct MappedFile {
+        unsigned char *data;
+        size_t length;
+    } MappedFile;
+
+
+typedef struct ELFSection {
+        const char *name;
+        unsigned long nameOffset;
+        unsigned int type;
+        unsigned long flags;
+        unsigned long offset;
+        unsigned long size;
+        unsigned int link;
+        unsigned long entrySize;
+    } ELFSection;
+
+
+typedef struct SymbolFile {
+        char *path;
+        uintptr_t bias;
+
+        // the object itself, and its separate debug file, if any
+        MappedFile files[2];
+        
+        // sorted by address
+        SimpleVector<ELFSymbol> symbols;
+        SimpleVector<LineRow> lineRows;
+
+        SimpleVector<char*> lineFileNames;
+        // parallel to lineFileNames, absolute path of each, or NULL if
+        // the unit didn't say where it was built
+        SimpleVector<char*> lineFilePaths;
+    } SymbolFile;
+
+
+SimpleVector<SymbolFile*> symbolFiles;
+
+char warnedAboutCompression = false;
+
+
+
+// maps all of a (non-empty) file, read-only
+static char mapWholeFile( const char *inPath, MappedFile *outFile ) {
+    outFile->data = NULL;
+    outFile->length = 0;
+
+    int fd = open( inPath, O_RDONLY );
+    
+    if( fd == -1 ) {
+        return false;
+        }
+    
+    off_t length = lseek( fd, 0, SEEK_END );
+    
+    if( length <= 0 ) {
+        close( fd );
+        return false;
+        }
+    
+    void *data = mmap( NULL, length, PROT_READ, MAP_PRIVATE, fd, 0 );
+    
+    close( fd );
+    
+    if( data == MAP_FAILED ) {
+        return false;
+        }
+    
+    outFile->data = (unsigned char*)data;
+    outFile->length = length;
+    return true;
+    }
+
+
+
+static char mapFile( const char *inPath, MappedFile *outFile ) {
+    if( ! mapWholeFile( inPath, outFile ) ) {
+        return false;
+        }
+
+    if( outFile->length < EI_NIDENT || 
+        memcmp( outFile->data, ELFMAG, SELFMAG ) != 0 ) {
+        munmap( outFile->data, outFile->length );
+        outFile->data = NULL;
+        outFile->length = 0;
+        return false;
+        }
+    
+    return true;
+    }
+
+
+
+static char isELF64( MappedFile *inFile ) {
+    return inFile->data[ EI_CLASS ] == ELFCLASS64;
+    }
+
+
+
+// reads all section headers of a mapped ELF file
+static void getSections( MappedFile *inFile, 
+                         SimpleVector<ELFSection> *outSections ) {
+    unsigned long shOffset, shEntrySize;
+    int shCount, shStringIndex;
+    
+    if( isELF64( inFile ) ) {
+        Elf64_Ehdr *h = (Elf64_Ehdr*)inFile->data;
+        shOffset = h->e_shoff;
+        shEntrySize = h->e_shentsize;
+        shCount = h->e_shnum;
+        shStringIndex = h->e_shstrndx;
+        }
+    else {
+        Elf32_Ehdr *h = (Elf32_Ehdr*)inFile->data;
+        shOffset = h->e_shoff;
+        shEntrySize = h->e_shentsize;
+        shCount = h->e_shnum;
+        shStringIndex = h->e_shstrndx;
+        }
+
+    if( shOffset == 0 || 
+        shOffset + shCount * shEntrySize > inFile->length ) {
+        return;
+        }
+    
+    for( int i=0; i<shCount; i++ ) {
+        unsigned char *sh = &( inFile->data[ shOffset + i * shEntrySize ] );
+        
+        ELFSection s;
+        s.name = "";
+        
+        if( isELF64( inFile ) ) {
+            Elf64_Shdr *h = (Elf64_Shdr*)sh;
+            s.nameOffset = h->sh_name;
+            s.type = h->sh_type;
+            s.flags = h->sh_flags;
+            s.offset = h->sh_offset;
+            s.size = h->sh_size;
+            s.link = h->sh_link;
+            s.entrySize = h->sh_entsize;
+            }
+        else {
+            Elf32_Shdr *h = (Elf32_Shdr*)sh;
+            s.nameOffset = h->sh_name;
+            s.type = h->sh_type;
+            s.flags = h->sh_flags;
+            s.offset = h->sh_offset;
+            s.size = h->sh_size;
+            s.link = h->sh_link;
+            s.entrySize = h->sh_entsize;
+            }
+
+        if( s.type != SHT_NOBITS && s.offset + s.size > inFile->length ) {
+            // truncated file, ignore this section
+            s.type = SHT_NULL;
+            s.size = 0;
+            }
+        
+        outSections->push_back( s );
+        }
+    
+    // now that we know where section names are, fill in names
+    ELFSection *nameSection = outSections->getElement( shStringIndex );
+    
+    for( int i=0; i<outSections->size(); i++ ) {
+        ELFSection *s = outSections->getElement( i );
+        
+        if( nameSection != NULL && s->nameOffset < nameSection->size ) {
+            s->name = 
+                (const char*)&( inFile->data[ nameSection->offset + 
+                                              s->nameOffset ] );
+            }
+        }
+    }
+
+
+
+static ELFSection *findSection( SimpleVector<ELFSection> *inSections,
+                                const char *inName ) {
+    for( int i=0; i<inSections->size(); i++ ) {
+        ELFSection *s = inSections->getElement( i );
+        
+        if( strcmp( s->name, inName ) == 0 && 
+            s->type != SHT_NOBITS && s->type != SHT_NULL ) {
+            
+            if( s->flags & SHF_COMPRESSED ) {
+                if( ! warnedAboutCompression ) {
+                    printf( "Skipping compressed debug sections, "
+                            "line numbers may be missing\n" );
+                    warnedAboutCompression = true;
+                    }
+                return NULL;
+                }
+            return s;
+            }
+        }
+    return NULL;
+    }
+
+
+
+static void readSymbolTable( MappedFile *inFile, 
+                             SimpleVector<ELFSection> *inSections,
+                             ELFSection *inTable,
+                             SimpleVector<ELFSymbol> *outSymbols ) {
+    
+    ELFSection *strings = inSections->getElement( inTable->link );
+    
+    if( strings == NULL || strings->type == SHT_NULL ) {
+        return;
+        }
+    
+    const char *stringData = (const char*)&( inFile->data[ strings->offset ] );
+
+    int numSymbols = 0;
+    if( inTable->entrySize > 0 ) {
+        numSymbols = inTable->size / inTable->entrySize;
+        }
+    
+    for( int i=0; i<numSymbols; i++ ) {
+        unsigned char *entry = 
+            &( inFile->data[ inTable->offset + i * inTable->entrySize ] );
+        
+        ELFSymbol sym;
+        unsigned int nameOffset;
+        unsigned char info;
+        unsigned int sectionIndex;
+        
+        if( isELF64( inFile ) ) {
+            Elf64_Sym *s = (Elf64_Sym*)entry;
+            sym.address = s->st_value;
+            sym.size = s->st_size;
+            nameOffset = s->st_name;
+            info = s->st_info;
+            sectionIndex = s->st_shndx;
+            }
+        else {
+            Elf32_Sym *s = (Elf32_Sym*)entry;
+            sym.address = s->st_value;
+            sym.size = s->st_size;
+            nameOffset = s->st_name;
+            info = s->st_info;
+            sectionIndex = s->st_shndx;
+            }
+        
+        int type = ELF64_ST_TYPE( info );
+        
+        if( ( type != STT_FUNC && type != STT_GNU_IFUNC ) ||
+            sectionIndex == SHN_UNDEF ||
+            sym.address == 0 ||
+            nameOffset >= strings->size ) {
+            continue;
+            }
+        
+        sym.name = &( stringData[ nameOffset ] );
+        
+        switch( ELF64_ST_BIND( info ) ) {
+            case STB_GLOBAL:
+                sym.bindRank = 0;
+                break;
+            case STB_WEAK:
+                sym.bindRank = 1;
+                break;
+            default:
+                sym.bindRank = 2;
+                break;
+            }
+        
+        outSymbols->push_back( sym );
+        }
+    }
+
+
+
+// little reader for walking through DWARF data
+typedef struct DWARFReader {
+        unsigned char *pos;
+        unsigned char *end;
+        char is64;
+        int addressSize;
+        char failed;
+    } DWARFReader;
+
+
+
+static unsigned long long readFixed( DWARFReader *inR, int inSize ) {
+    if( inR->pos + inSize > inR->end ) {
+        inR->failed = true;
+        inR->pos = inR->end;
+        return 0;
+        }
+    
+    // DWARF in our own target is in our own byte order
+    unsigned long long value = 0;
+    memcpy( &value, inR->pos, inSize );
+    inR->pos = &( inR->pos[ inSize ] );
+    
+    return value;
+    }
+
+
+
+static unsigned long long readULEB( DWARFReader *inR ) {
+    unsigned long long value = 0;
+    int shift = 0;
+    
+    while( inR->pos < inR->end ) {
+        unsigned char b = inR->pos[0];
+        inR->pos = &( inR->pos[1] );
+        
+        if( shift < 64 ) {
+            value |= (unsigned long long)( b & 0x7f ) << shift;
+            }
+        shift += 7;
+        
+        if( ( b & 0x80 ) == 0 ) {
+            return value;
+            }
+        }
+    inR->failed = true;
+    return value;
+    }
+
+
+
+static long long readSLEB( DWARFReader *inR ) {
+    long long value = 0;
+    int shift = 0;
+    unsigned char b = 0;
+    
+    while( inR->pos < inR->end ) {
+        b = inR->pos[0];
+        inR->pos = &( inR->pos[1] );
+        
+        if( shift < 64 ) {
+            value |= (long long)( b & 0x7f ) << shift;
+            }
+        shift += 7;
+        
+        if( ( b & 0x80 ) == 0 ) {
+            if( shift < 64 && ( b & 0x40 ) ) {
+                // sign extend
+                value |= - ( 1LL << shift );
+                }
+            return value;
+            }
+        }
+    inR->failed = true;
+    return value;
+    }
+
+
+
+static const char *readString( DWARFReader *inR ) {
+    const char *s = (const char*)inR->pos;
+    
+    while( inR->pos < inR->end && inR->pos[0] != '\0' ) {
+        inR->pos = &( inR->pos[1] );
+        }
+    
+    if( inR->pos >= inR->end ) {
+        inR->failed = true;
+        return "";
+        }
+    // skip \0
+    inR->pos = &( inR->pos[1] );
+    return s;
+    }
+
+
+
+// DWARF 5 forms we might see in line table headers
+#define DW_FORM_block 0x09
+#define DW_FORM_data1 0x0b
+#define DW_FORM_data2 0x05
+#define DW_FORM_data4 0x06
+#define DW_FORM_data8 0x07
+#define DW_FORM_data16 0x1e
+#define DW_FORM_string 0x08
+#define DW_FORM_strp 0x0e
+#define DW_FORM_line_strp 0x1f
+#define DW_FORM_udata 0x0f
+
+#define DW_LNCT_path 1
+#define DW_LNCT_directory_index 2
+
+
+
+// reads one DWARF 5 entry attribute
+// string results point into mapped data, NULL for non-string forms
+// returns false for forms we don't understand
+static char readLineHeaderForm( DWARFReader *inR, int inForm, 
+                                MappedFile *inFile,
+                                ELFSection *inStrings,
+                                ELFSection *inLineStrings,
+                                const char **outString,
+                                unsigned long long *outValue ) {
+    *outString = NULL;
+    *outValue = 0;
+    
+    ELFSection *stringSection = inStrings;
+    
+    switch( inForm ) {
+        case DW_FORM_string:
+            *outString = readString( inR );
+            return true;
+        case DW_FORM_line_strp:
+            stringSection = inLineStrings;
+            // fall through
+        case DW_FORM_strp: {
+            unsigned long long offset = readFixed( inR, inR->is64 ? 8 : 4 );
+            
+            if( stringSection != NULL && offset < stringSection->size ) {
+                *outString = 
+                    (const char*)&( inFile->data[ stringSection->offset + 
+                                                  offset ] );
+                }
+            else {
+                *outString = "";
+                }
+            return true;
+            }
+        case DW_FORM_udata:
+            *outValue = readULEB( inR );
+            return true;
+        case DW_FORM_data1:
+            *outValue = readFixed( inR, 1 );
+            return true;
+        case DW_FORM_data2:
+            *outValue = readFixed( inR, 2 );
+            return true;
+        case DW_FORM_data4:
+            *outValue = readFixed( inR, 4 );
+            return true;
+        case DW_FORM_data8:
+            *outValue = readFixed( inR, 8 );
+            return true;
+        case DW_FORM_data16:
+            readFixed( inR, 8 );
+            readFixed( inR, 8 );
+            return true;
+        case DW_FORM_block: {
+            unsigned long long length = readULEB( inR );
+            if( inR->pos + length > inR->end ) {
+                inR->failed = true;
+                return false;
+                }
+            inR->pos = &( inR->pos[ length ] );
+            return true;
+            }
+        default:
+            return false;
+        }
+    }
+
+
+
+// more forms, that compilation unit DIEs can have
+#define DW_FORM_addr 0x01
+#define DW_FORM_block2 0x03
+#define DW_FORM_block4 0x04
+#define DW_FORM_block1 0x0a
+#define DW_FORM_flag 0x0c
+#define DW_FORM_sdata 0x0d
+#define DW_FORM_ref_addr 0x10
+#define DW_FORM_ref1 0x11
+#define DW_FORM_ref2 0x12
+#define DW_FORM_ref4 0x13
+#define DW_FORM_ref8 0x14
+#define DW_FORM_ref_udata 0x15
+#define DW_FORM_indirect 0x16
+#define DW_FORM_sec_offset 0x17
+#define DW_FORM_exprloc 0x18
+#define DW_FORM_flag_present 0x19
+#define DW_FORM_ref_sig8 0x20
+
+#define DW_AT_stmt_list 0x10
+#define DW_AT_comp_dir 0x1b
+
+
+
+// reads one attribute of a DWARF 2 to 4 DIE, the same way as 
+// readLineHeaderForm
+static char readDIEForm( DWARFReader *inR, int inForm, int inVersion,
+                         MappedFile *inFile,
+                         ELFSection *inStrings,
+                         ELFSection *inLineStrings,
+                         const char **outString,
+                         unsigned long long *outValue ) {
+    *outString = NULL;
+    *outValue = 0;
+    
+    int blockLengthSize = 0;
+    
+    switch( inForm ) {
+        case DW_FORM_addr:
+            *outValue = readFixed( inR, inR->addressSize );
+            return true;
+        case DW_FORM_flag:
+        case DW_FORM_ref1:
+            *outValue = readFixed( inR, 1 );
+            return true;
+        case DW_FORM_ref2:
+            *outValue = readFixed( inR, 2 );
+            return true;
+        case DW_FORM_ref4:
+            *outValue = readFixed( inR, 4 );
+            return true;
+        case DW_FORM_ref8:
+        case DW_FORM_ref_sig8:
+            *outValue = readFixed( inR, 8 );
+            return true;
+        case DW_FORM_ref_udata:
+            *outValue = readULEB( inR );
+            return true;
+        case DW_FORM_sdata:
+            *outValue = readSLEB( inR );
+            return true;
+        case DW_FORM_flag_present:
+            *outValue = 1;
+            return true;
+        case DW_FORM_ref_addr:
+            // address sized in DWARF 2, offset sized after that
+            if( inVersion == 2 ) {
+                *outValue = readFixed( inR, inR->addressSize );
+                }
+            else {
+                *outValue = readFixed( inR, inR->is64 ? 8 : 4 );
+                }
+            return true;
+        case DW_FORM_sec_offset:
+            *outValue = readFixed( inR, inR->is64 ? 8 : 4 );
+            return true;
+        case DW_FORM_exprloc:
+            return readLineHeaderForm( inR, DW_FORM_block, inFile,
+                                       inStrings, inLineStrings,
+                                       outString, outValue );
+        case DW_FORM_indirect:
+            return readDIEForm( inR, readULEB( inR ), inVersion, inFile,
+                                inStrings, inLineStrings, 
+                                outString, outValue );
+        case DW_FORM_block1:
+            blockLengthSize = 1;
+            break;
+        case DW_FORM_block2:
+            blockLengthSize = 2;
+            break;
+        case DW_FORM_block4:
+            blockLengthSize = 4;
+            break;
+        default:
+            return readLineHeaderForm( inR, inForm, inFile,
+                                       inStrings, inLineStrings,
+                                       outString, outValue );
+        }
+    
+    unsigned long long length = readFixed( inR, blockLengthSize );
+    if( inR->pos + length > inR->end ) {
+        inR->failed = true;
+        return false;
+        }
+    inR->pos = &( inR->pos[ length ] );
+    return true;
+    }
+
+
+
+typedef struct CompDir {
+        // offset of the unit's line table in .debug_line
+        unsigned long long lineOffset;
+        // points into the mapped file
+        const char *dir;
+    } CompDir;
+
+
+
+// DWARF 2 to 4 line tables leave out the directory that the unit was 
+// compiled in, which their directory 0 stands for, so it's read from
+// the first DIE of each compilation unit in .debug_info instead
+static void readCompDirs( MappedFile *inMapped, 
+                          SimpleVector<ELFSection> *inSections,
+                          SimpleVector<CompDir> *outDirs ) {
+    ELFSection *info = findSection( inSections, ".debug_info" );
+    ELFSection *abbrev = findSection( inSections, ".debug_abbrev" );
+    
+    if( info == NULL || abbrev == NULL ) {
+        return;
+        }
+    
+    ELFSection *strings = findSection( inSections, ".debug_str" );
+    ELFSection *lineStrings = findSection( inSections, ".debug_line_str" );
+    
+    unsigned char *pos = &( inMapped->data[ info->offset ] );
+    unsigned char *end = &( pos[ info->size ] );
+    
+    unsigned char *abbrevStart = &( inMapped->data[ abbrev->offset ] );
+    unsigned char *abbrevEnd = &( abbrevStart[ abbrev->size ] );
+    
+    while( pos < end ) {
+        DWARFReader r = { pos, end, false, 
+                          isELF64( inMapped ) ? 8 : 4, false };
+        
+        unsigned long long unitLength = readFixed( &r, 4 );
+        
+        if( unitLength == 0xffffffff ) {
+            r.is64 = true;
+            unitLength = readFixed( &r, 8 );
+            }
+        
+        if( r.failed || unitLength > (unsigned long long)( end - r.pos ) ) {
+            return;
+            }
+        
+        unsigned char *unitEnd = &( r.pos[ unitLength ] );
+        r.end = unitEnd;
+        pos = unitEnd;
+        
+        int version = readFixed( &r, 2 );
+        
+        if( version < 2 || version > 4 ) {
+            // DWARF 5 line tables name their compilation directory
+            continue;
+            }
+        
+        unsigned long long abbrevOffset = readFixed( &r, r.is64 ? 8 : 4 );
+        r.addressSize = readFixed( &r, 1 );
+        
+        unsigned long long code = readULEB( &r );
+        
+        if( r.failed || code == 0 || abbrevOffset >= abbrev->size ) {
+            continue;
+            }
+        
+        // find the abbreviation that the unit's first DIE uses
+        DWARFReader a = { &( abbrevStart[ abbrevOffset ] ), abbrevEnd, 
+                          false, 0, false };
+        
+        char foundAbbrev = false;
+        
+        while( !a.failed && !foundAbbrev ) {
+            unsigned long long abbrevCode = readULEB( &a );
+            
+            if( abbrevCode == 0 ) {
+                break;
+                }
+            // tag and children flag
+            readULEB( &a );
+            readFixed( &a, 1 );
+            
+            if( abbrevCode == code ) {
+                foundAbbrev = true;
+                break;
+                }
+            
+            while( !a.failed ) {
+                unsigned long long attribute = readULEB( &a );
+                unsigned long long form = readULEB( &a );
+                
+                if( attribute == 0 && form == 0 ) {
+                    break;
+                    }
+                }
+            }
+        
+        if( !foundAbbrev || a.failed ) {
+            continue;
+            }
+        
+        const char *dir = NULL;
+        unsigned long long lineOffset = 0;
+        char foundLines = false;
+        
+        while( !a.failed && !r.failed ) {
+            unsigned long long attribute = readULEB( &a );
+            unsigned long long form = readULEB( &a );
+            
+            if( attribute == 0 && form == 0 ) {
+                break;
+                }
+            
+            const char *stringValue;
+            unsigned long long value;
+            
+            if( ! readDIEForm( &r, form, version, inMapped,
+                               strings, lineStrings, 
+                               &stringValue, &value ) ) {
+                break;
+                }
+            
+            if( attribute == DW_AT_comp_dir && stringValue != NULL ) {
+                dir = stringValue;
+                }
+            else if( attribute == DW_AT_stmt_list ) {
+                lineOffset = value;
+                foundLines = true;
+                }
+            }
+        
+        if( dir != NULL && foundLines && !r.failed ) {
+            CompDir d = { lineOffset, dir };
+            outDirs->push_back( d );
+            }
+        }
+    }
+
+
+
+// compilation directory of the line table at inLineOffset, or NULL
+// units are usually in the same order in both sections, so the search
+// starts just past the last one found
+static const char *findCompDir( SimpleVector<CompDir> *inDirs,
+                                unsigned long long inLineOffset,
+                                int *ioNext ) {
+    int numDirs = inDirs->size();
+    
+    for( int i=0; i<numDirs; i++ ) {
+        int d = ( *ioNext + i ) % numDirs;
+        
+        CompDir *c = inDirs->getElement( d );
+        
+        if( c->lineOffset == inLineOffset ) {
+            *ioNext = d + 1;
+            return c->dir;
+            }
+        }
+    return NULL;
+    }
+
+
+
+// adds "dir/name" (or just name, for names in the compilation directory)
+// to inFile's lineFileNames and returns its index
+// inCompDir is the unit's compilation directory, or NULL if not known,
+// and relative directories and names are taken from there for 
+// lineFilePaths
+static int addLineFileName( SymbolFile *inFile, const char *inCompDir,
+                            const char *inDir, const char *inName ) {
+    char *fullName;
+    
+    if( inDir != NULL && inDir[0] != '\0' && inName[0] != '/' ) {
+        fullName = autoSprintf( "%s/%s", inDir, inName );
+        }
+    else {
+        fullName = stringDuplicate( inName );
+        }
+    
+    char *path = NULL;
+    
+    if( fullName[0] == '/' ) {
+        path = stringDuplicate( fullName );
+        }
+    else if( inCompDir != NULL && inCompDir[0] == '/' ) {
+        path = autoSprintf( "%s/%s", inCompDir, fullName );
+        }
+    
+    inFile->lineFileNames.push_back( fullName );
+    inFile->lineFilePaths.push_back( path );
+    return inFile->lineFileNames.size() - 1;
+    }
+
+
+
+// parses one line number program unit, adding its rows to inFile
+// inCompDir is the directory the unit was compiled in, or NULL if not
+// known, for units older than DWARF 5, which don't name it themselves
+// returns pointer to start of next unit, or NULL on failure
+static unsigned char *readLineUnit( SymbolFile *inFile,
+                                    MappedFile *inMapped,
+                                    unsigned char *inStart,
+                                    unsigned char *inSectionEnd,
+                                    ELFSection *inStrings,
+                                    ELFSection *inLineStrings,
+                                    const char *inCompDir ) {
+    DWARFReader r = { inStart, inSectionEnd, false, 
+                      isELF64( inMapped ) ? 8 : 4, false };
+    
+    unsigned long long unitLength = readFixed( &r, 4 );
+    
+    if( unitLength == 0xffffffff ) {
+        r.is64 = true;
+        unitLength = readFixed( &r, 8 );
+        }
+    
+    if( r.failed || r.pos + unitLength > inSectionEnd ) {
+        return NULL;
+        }
+    
+    unsigned char *unitEnd = &( r.pos[ unitLength ] );
+    r.end = unitEnd;
+    
+    int version = readFixed( &r, 2 );
+    
+    if( version < 2 || version > 5 ) {
+        return unitEnd;
+        }
+    
+    if( version >= 5 ) {
+        r.addressSize = readFixed( &r, 1 );
+        // segment selector size
+        readFixed( &r, 1 );
+        }
+    
+    unsigned long long headerLength = readFixed( &r, r.is64 ? 8 : 4 );
+    
+    unsigned char *programStart = &( r.pos[ headerLength ] );
+    
+    int minInstructionLength = readFixed( &r, 1 );
+    
+    if( version >= 4 ) {
+        // maximum operations per instruction, only for VLIW
+        readFixed( &r, 1 );
+        }
+    
+    // default is_stmt
+    readFixed( &r, 1 );
+    
+    int lineBase = (signed char)readFixed( &r, 1 );
+    int lineRange = readFixed( &r, 1 );
+    int opcodeBase = readFixed( &r, 1 );
+    
+    if( r.failed || lineRange == 0 || opcodeBase == 0 ) {
+        return unitEnd;
+        }
+
+    unsigned char *standardOpcodeLengths = r.pos;
+    r.pos = &( r.pos[ opcodeBase - 1 ] );
+    
+    
+    // file numbers in the program index into this, which maps them
+    // to lineFileNames
+    SimpleVector<int> fileIndices;
+    
+    
+    if( version < 5 ) {
+        SimpleVector<const char*> dirs;
+        // directory 0 is the compilation directory
+        dirs.push_back( "" );
+        
+        while( !r.failed ) {
+            const char *dir = readString( &r );
+            if( dir[0] == '\0' ) {
+                break;
+                }
+            dirs.push_back( dir );
+            }
+        
+        // file numbers start at 1
+        fileIndices.push_back( -1 );
+        
+        while( !r.failed ) {
+            const char *name = readString( &r );
+            if( name[0] == '\0' ) {
+                break;
+                }
+            unsigned int dirIndex = readULEB( &r );
+            // modification time and length
+            readULEB( &r );
+            readULEB( &r );
+            
+            fileIndices.push_back( 
+                addLineFileName( inFile, inCompDir,
+                                 dirs.getElementDirect( dirIndex ), name ) );
+            }
+        }
+    else {
+        SimpleVector<const char*> dirs;
+        
+        for( int pass=0; pass<2; pass++ ) {
+            // directories first, then files, in the same format
+            int formatCount = readFixed( &r, 1 );
+            
+            SimpleVector<int> contentTypes;
+            SimpleVector<int> forms;
+            
+            for( int f=0; f<formatCount; f++ ) {
+                contentTypes.push_back( readULEB( &r ) );
+                forms.push_back( readULEB( &r ) );
+                }
+            
+            int count = readULEB( &r );
+            
+            for( int e=0; e<count && !r.failed; e++ ) {
+                const char *path = "";
+                int dirIndex = 0;
+                
+                for( int f=0; f<formatCount; f++ ) {
+                    const char *stringValue;
+                    unsigned long long value;
+                    
+                    if( ! readLineHeaderForm( &r, forms.getElementDirect( f ),
+                                              inMapped, 
+                                              inStrings, inLineStrings,
+                                              &stringValue, &value ) ) {
+                        // can't parse the rest of this header
+                        return unitEnd;
+                        }
+                    
+                    int type = contentTypes.getElementDirect( f );
+                    
+                    if( type == DW_LNCT_path && stringValue != NULL ) {
+                        path = stringValue;
+                        }
+                    else if( type == DW_LNCT_directory_index ) {
+                        dirIndex = value;
+                        }
+                    }
+                
+                if( pass == 0 ) {
+                    dirs.push_back( path );
+                    }
+                else {
+                    // directory 0 is the compilation directory
+                    const char *dir = NULL;
+                    if( dirIndex > 0 ) {
+                        dir = dirs.getElementDirect( dirIndex );
+                        }
+                    if( dirs.size() > 0 ) {
+                        inCompDir = dirs.getElementDirect( 0 );
+                        }
+                    fileIndices.push_back( 
+                        addLineFileName( inFile, inCompDir, dir, path ) );
+                    }
+                }
+            }
+        }
+    
+    if( r.failed ) {
+        return unitEnd;
+        }
+    
+    
+    // now run the line number program
+    r.pos = programStart;
+
+    uintptr_t address = 0;
+    unsigned int file = 1;
+    int line = 1;
+    
+    while( r.pos < unitEnd && !r.failed ) {
+        int opcode = readFixed( &r, 1 );
+        
+        char emitRow = false;
+        char endSequence = false;
+        
+        if( opcode >= opcodeBase ) {
+            // special opcode
+            int adjusted = opcode - opcodeBase;
+            address += ( adjusted / lineRange ) * minInstructionLength;
+            line += lineBase + ( adjusted % lineRange );
+            emitRow = true;
+            }
+        else if( opcode == 0 ) {
+            // extended opcode
+            unsigned long long length = readULEB( &r );
+            unsigned char *nextPos = &( r.pos[ length ] );
+            
+            if( length == 0 || nextPos > unitEnd ) {
+                break;
+                }
+            
+            int extendedOpcode = readFixed( &r, 1 );
+            
+            switch( extendedOpcode ) {
+                case 1:
+                    // end_sequence
+                    emitRow = true;
+                    endSequence = true;
+                    break;
+                case 2:
+                    // set_address
+                    address = readFixed( &r, length - 1 );
+                    break;
+                case 3: {
+                    // define_file, old versions only
+                    const char *name = readString( &r );
+                    readULEB( &r );
+                    readULEB( &r );
+                    readULEB( &r );
+                    fileIndices.push_back( 
+                        addLineFileName( inFile, inCompDir, NULL, name ) );
+                    break;
+                    }
+                default:
+                    break;
+                }
+            r.pos = nextPos;
+            }
+        else {
+            switch( opcode ) {
+                case 1:
+                    // copy
+                    emitRow = true;
+                    break;
+                case 2:
+                    // advance_pc
+                    address += readULEB( &r ) * minInstructionLength;
+                    break;
+                case 3:
+                    // advance_line
+                    line += readSLEB( &r );
+                    break;
+                case 4:
+                    // set_file
+                    file = readULEB( &r );
+                    break;
+                case 8:
+                    // const_add_pc
+                    address += ( ( 255 - opcodeBase ) / lineRange ) * 
+                        minInstructionLength;
+                    break;
+                case 9:
+                    // fixed_advance_pc
+                    address += readFixed( &r, 2 );
+                    break;
+                default:
+                    // skip operands of anything else
+                    for( int i=0; i<standardOpcodeLengths[ opcode - 1 ]; 
+                         i++ ) {
+                        readULEB( &r );
+                        }
+                    break;
+                }
+            }
+        
+        if( emitRow ) {
+            LineRow row = { address, -1, line, endSequence };
+            
+            if( file < (unsigned int)fileIndices.size() ) {
+                row.fileIndex = fileIndices.getElementDirect( file );
+                }
+            
+            inFile->lineRows.push_back( row );
+            
+            if( endSequence ) {
+                address = 0;
+                file = 1;
+                line = 1;
+                }
+            }
+        }
+    
+    return unitEnd;
+    }
+
+
+
+static int compareELFSymbols( const void *inA, const void *inB ) {
+    ELFSymbol *a = (ELFSymbol*)inA;
+    ELFSymbol *b = (ELFSymbol*)inB;
+    
+    if( a->address != b->address ) {
+        return ( a->address < b->address ) ? -1 : 1;
+        }
+    return a->bindRank - b->bindRank;
+    }
+
+
+
+static int compareLineRows( const void *inA, const void *inB ) {
+    LineRow *a = (LineRow*)inA;
+    LineRow *b = (LineRow*)inB;
+    
+    if( a->address != b->address ) {
+        return ( a->address < b->address ) ? -1 : 1;
+        }
+    // a sequence can start right where another ends, and the start
+    // should win
+    return b->isEndSequence - a->isEndSequence;
+    }
+
+
+
+// looks for a separate debug file using build ID or .gnu_debuglink
+// result destroyed by caller, NULL if not found
+static char *findDebugFile( MappedFile *inFile, 
+                            SimpleVector<ELFSection> *inSections,
+                            const char *inPath ) {
+    
+    ELFSection *buildID = findSection( inSections, ".note.gnu.build-id" );
+    
+    if( buildID != NULL && buildID->size > 16 ) {
+        unsigned char *note = &( inFile->data[ buildID->offset ] );
+        
+        unsigned int nameSize, descSize;
+        memcpy( &nameSize, &( note[0] ), 4 );
+        memcpy( &descSize, &( note[4] ), 4 );
+        
+        unsigned int descStart = 12 + ( ( nameSize + 3 ) & ~3 );
+        
+        if( descSize > 1 && descStart + descSize <= buildID->size ) {
+            unsigned char *desc = &( note[ descStart ] );
+            
+            SimpleVector<char> path;
+            path.appendElementString( "/usr/lib/debug/.build-id/" );
+            
+            for( unsigned int i=0; i<descSize; i++ ) {
+                char hex[3];
+                snprintf( hex, sizeof( hex ), "%02x", desc[i] );
+                path.appendElementString( hex );
+                if( i == 0 ) {
+                    path.push_back( '/' );
+                    }
+                }
+            path.appendElementString( ".debug" );
+            
+            char *pathString = path.getElementString();
+            
+            if( access( pathString, R_OK ) == 0 ) {
+                return pathString;
+                }
+            delete [] pathString;
+            }
+        }
+    
+    ELFSection *debugLink = findSection( inSections, ".gnu_debuglink" );
+    
+    if( debugLink != NULL ) {
+        const char *linkName = 
+            (const char*)&( inFile->data[ debugLink->offset ] );
+        
+        if( strnlen( linkName, debugLink->size ) < debugLink->size ) {
+            
+            char *dir = stringDuplicate( inPath );
+            char *slashPos = strrchr( dir, '/' );
+            if( slashPos != NULL ) {
+                slashPos[0] = '\0';
+                }
+            
+            const char *formats[3] = { "%s/%s",
+                                       "%s/.debug/%s",
+                                       "/usr/lib/debug%s/%s" };
+            
+            for( int i=0; i<3; i++ ) {
+                char *path = autoSprintf( formats[i], dir, linkName );
+                
+                if( strcmp( path, inPath ) != 0 && 
+                    access( path, R_OK ) == 0 ) {
+                    delete [] dir;
+                    return path;
+                    }
+                delete [] path;
+                }
+            delete [] dir;
+            }
+        }
+    
+    return NULL;
+    }
+
+
+
+static SymbolFile *loadSymbolFile( MapRegion *inRegion ) {
+    SymbolFile *f = new SymbolFile;
+    
+    f->path = stringDuplicate( inRegion->path );
+    f->bias = 0;
+    f->files[0].data = NULL;
+    f->files[1].data = NULL;
+    
+    symbolFiles.push_back( f );
+    
+    if( ! getLoadBias( inRegion, &( f->bias ) ) ||
+        ! mapFile( f->path, &( f->files[0] ) ) ) {
+        return f;
+        }
+    
+    SimpleVector<ELFSection> sections[2];
+    
+    getSections( &( f->files[0] ), &( sections[0] ) );
+
+    char *debugPath = findDebugFile( &( f->files[0] ), &( sections[0] ),
+                                     f->path );
+    
+    if( debugPath != NULL ) {
+        if( mapFile( debugPath, &( f->files[1] ) ) ) {
+            getSections( &( f->files[1] ), &( sections[1] ) );
+            }
+        delete [] debugPath;
+        }
+    
+    
+    // full symbol table from either file, or else dynamic symbols
+    char foundSymbols = false;
+    
+    for( int i=0; i<2 && !foundSymbols; i++ ) {
+        ELFSection *symtab = findSection( &( sections[i] ), ".symtab" );
+        
+        if( symtab != NULL ) {
+            readSymbolTable( &( f->files[i] ), &( sections[i] ), symtab,
+                             &( f->symbols ) );
+            foundSymbols = true;
+            }
+        }
+    if( !foundSymbols ) {
+        ELFSection *dynsym = findSection( &( sections[0] ), ".dynsym" );
+        
+        if( dynsym != NULL ) {
+            readSymbolTable( &( f->files[0] ), &( sections[0] ), dynsym,
+                             &( f->symbols ) );
+            }
+        }
+    
+    if( f->symbols.size() > 0 ) {
+        qsort( f->symbols.getElement( 0 ), f->symbols.size(), 
+               sizeof( ELFSymbol ), compareELFSymbols );
+        }
+
+    
+    for( int i=0; i<2; i++ ) {
+        ELFSection *lines = findSection( &( sections[i] ), ".debug_line" );
+        
+        if( lines == NULL ) {
+            continue;
+            }
+        
+        ELFSection *strings = findSection( &( sections[i] ), ".debug_str" );
+        ELFSection *lineStrings = 
+            findSection( &( sections[i] ), ".debug_line_str" );
+        
+        SimpleVector<CompDir> compDirs;
+        readCompDirs( &( f->files[i] ), &( sections[i] ), &compDirs );
+        
+        int nextCompDir = 0;
+        
+        unsigned char *start = &( f->files[i].data[ lines->offset ] );
+        unsigned char *end = &( start[ lines->size ] );
+        unsigned char *pos = start;
+        
+        while( pos != NULL && pos < end ) {
+            const char *compDir = findCompDir( &compDirs, pos - start,
+                                               &nextCompDir );
+            
+            pos = readLineUnit( f, &( f->files[i] ), pos, end, 
+                                strings, lineStrings, compDir );
+            }
+        break;
+        }
+    
+    if( f->lineRows.size() > 0 ) {
+        qsort( f->lineRows.getElement( 0 ), f->lineRows.size(), 
+               sizeof( LineRow ), compareLineRows );
+        }
+    
+    return f;
+    }
+
+
+
+static SymbolFile *getSymbolFile( MapRegion *inRegion ) {
+    for( int i=0; i<symbolFiles.size(); i++ ) {
+        SymbolFile *f = symbolFiles.getElementDirect( i );
+        
+        if( strcmp( f->path, inRegion->path ) == 0 ) {
+            return f;
+            }
+        }
+    return loadSymbolFile( inRegion );
+    }
+
+
+
+// finds last element with address <= inAddress in a sorted array 
+// of structs that start with a uintptr_t address
+// returns -1 if there isn't one
+static int findLastAtOrBefore( void *inArray, int inCount, 
+                               int inElementSize, uintptr_t inAddress ) {
+    int low = 0;
+    int high = inCount - 1;
+    int found = -1;
+    
+    while( low <= high ) {
+        int mid = ( low + high ) / 2;
+        
+        uintptr_t midAddress = 
+            *(uintptr_t*)( (char*)inArray + mid * inElementSize );
+        
+        if( midAddress <= inAddress ) {
+            found = mid;
+            low = mid + 1;
+            }
+        else {
+            high = mid - 1;
+            }
+        }
+    return found;
+    }
+
+
+
+static void resolveSymbolBuiltin( SymbolInfo *ioInfo ) {
+    MapRegion *region = findMapRegion( ioInfo->address );
+    
+    if( region == NULL || region->path[0] != '/' ) {
+        return;
+        }
+    
+    SymbolFile *f = getSymbolFile( region );
+    
+    uintptr_t fileAddress = ioInfo->address - f->bias;
+    
+    
+    if( f->symbols.size() > 0 ) {
+        int i = findLastAtOrBefore( f->symbols.getElement( 0 ), 
+                                    f->symbols.size(), sizeof( ELFSymbol ),
+                                    fileAddress );
+        
+        if( i >= 0 ) {
+            // step back to the best-ranked symbol at this address
+            while( i > 0 && 
+                   f->symbols.getElement( i - 1 )->address == 
+                   f->symbols.getElement( i )->address ) {
+                i--;
+                }
+            
+            ELFSymbol *sym = f->symbols.getElement( i );
+            
+            if( sym->size == 0 || fileAddress < sym->address + sym->size ) {
+                int status;
+                char *demangled = 
+                    abi::__cxa_demangle( sym->name, NULL, NULL, &status );
+                
+                if( demangled != NULL ) {
+                    ioInfo->funcName = stringDuplicate( demangled );
+                    free( demangled );
+                    }
+                else {
+                    ioInfo->funcName = stringDuplicate( sym->name );
+                    }
+                }
+            }
+        }
+    
+    if( f->lineRows.size() > 0 ) {
+        int i = findLastAtOrBefore( f->lineRows.getElement( 0 ), 
+                                    f->lineRows.size(), sizeof( LineRow ),
+                                    fileAddress );
+        
+        if( i >= 0 ) {
+            LineRow *row = f->lineRows.getElement( i );
+            
+            if( ! row->isEndSequence && row->fileIndex >= 0 ) {
+                ioInfo->fileName = stringDuplicate( 
+                    f->lineFileNames.getElementDirect( row->fileIndex ) );
+                ioInfo->lineNum = row->lineNum;
+                
+                const char *path = 
+                    f->lineFilePaths.getElementDirect( row->fileIndex );
+                
+                if( path != NULL ) {
+                    path = internString( path, strlen( path ) );
+                    }
+                recordSourcePath( ioInfo->fileName, path );
+                }
+            }
+        }
+    }
+
+
+
+static void freeSymbolFiles() {
+    for( int i=0; i<symbolFiles.size(); i++ ) {
+        SymbolFile *f = symbolFiles.getElementDirect( i );
+        
+        for( int m=0; m<2; m++ ) {
+            if( f->files[m].data != NULL ) {
+                munmap( f->files[m].data, f->files[m].length );
+                }
+            }
+        f->lineFileNames.deallocateStringElements();
+        f->lineFilePaths.deallocateStringElements();
+        
+        delete [] f->path;
+        delete f;
+        }
+    symbolFiles.deleteAll();
+    }
+
+
+
+static int compareSymbolInfo( const void *inA, const void *inB ) {
+    uintptr_t a = ( (SymbolInfo*)inA )->address;
+    uintptr_t b = ( (SymbolInfo*)inB )->address;
+    
+    if( a < b ) {
+        return -1;
+        }
+    if( a > b ) {
+        return 1;
+        }
+    return 0;
+    }
+
+
+
+static SymbolInfo *findLoggedSymbol( uintptr_t inLookupAddress ) {
+    if( loggedSymbols.size() == 0 ) {
+        return NULL;
+        }
+    
+    SymbolInfo key;
+    key.address = inLookupAddress;
+    
+    return (SymbolInfo*)bsearch( &key, loggedSymbols.getElement( 0 ), 
+                                 loggedSymbols.size(), sizeof( SymbolInfo ),
+                                 compareSymbolInfo );
+    }
+
+
+
+static SymbolInfo *findSymbolInfo( void *inAddress, char inIsReturnAddress ) {
+    SymbolInfo key;
+    key.address = (uintptr_t)inAddress;
+    
+    if( inIsReturnAddress ) {
+        key.address -= RETURN_ADDRESS_LOOKUP_OFFSET;
+        }
+    
+    if( symbolCache.size() == 0 ) {
+        return NULL;
+        }
+    
+    return (SymbolInfo*)bsearch( &key, symbolCache.getElement( 0 ), 
+                                 symbolCache.size(), sizeof( SymbolInfo ),
+                                 compareSymbolInfo );
+    }
+
+
+
+static void addLookupAddress( SimpleVector<SymbolInfo> *ioList,
+                              void *inAddress, char inIsReturnAddress ) {
+    SymbolInfo info = { (uintptr_t)inAddress, NULL, NULL, -1 };
+    
+    if( inIsReturnAddress ) {
+        info.address -= RETURN_ADDRESS_LOOKUP_OFFSET;
+        }
+    ioList->push_back( info );
+    }
+
+
+
+// fills in names for frames that only have addresses
+static void resolveFrameNames() {
+    
+    // gather every address that needs a name
+    // partial stack frames are never the innermost frame of a sample,
+    // so they're always return addresses
+    SimpleVector<SymbolInfo> toLookUp;
+    
+    for( int i=0; i<stackLog.size(); i++ ) {
+        Stack *s = stackLog.getElement( i );
+        
+        for( int f=0; f<s->frames.size(); f++ ) {
+            StackFrame *sf = s->frames.getElement( f );
+            
+            if( sf->funcName == NULL ) {
+                addLookupAddress( &toLookUp, sf->address, f > 0 );
+                }
+            }
+        }
+    
+    // on-CPU stacks are only matched by the name of their innermost
+    // function
+    for( int i=0; i<perfStackLog.size(); i++ ) {
+        Stack *s = perfStackLog.getElement( i );
+        
+        addLookupAddress( &toLookUp, s->frames.getElement( 0 )->address, 
+                          false );
+        }
+    
+    if( toLookUp.size() == 0 ) {
+        return;
+        }
+    
+    // only nodes that some sample passed through (rather than ended at)
+    // show up in partial stacks
+    for( int i=0; i<callTree.size(); i++ ) {
+        CallTreeNode *node = callTree.getElement( i );
+        
+        if( node->frame.funcName == NULL && 
+            node->sampleCount > node->endCount ) {
+            addLookupAddress( &toLookUp, node->frame.address, true );
+            }
+        }
+    
+    // sort and remove duplicates
+    qsort( toLookUp.getElement( 0 ), toLookUp.size(), sizeof( SymbolInfo ),
+           compareSymbolInfo );
+    
+    for( int i=0; i<toLookUp.size(); i++ ) {
+        SymbolInfo info = toLookUp.getElementDirect( i );
+        
+        if( symbolCache.size() == 0 ||
+            symbolCache.getLastElement()->address != info.address ) {
+            symbolCache.push_back( info );
+            }
+        }
+    
+    printf( "Looking up names for %d unique sampled addresses...\n",
+            symbolCache.size() );
+
+    if( useBuiltinSymbols ) {
+        for( int i=0; i<symbolCache.size(); i++ ) {
+            SymbolInfo *info = symbolCache.getElement( i );
+            
+            SymbolInfo *logged = findLoggedSymbol( info->address );
+            
+            if( logged != NULL ) {
+                // looked up back when the sample log was written
+                info->funcName = stringDuplicate( logged->funcName );
+                info->fileName = stringDuplicate( logged->fileName );
+                info->lineNum = logged->lineNum;
+                }
+            else {
+                resolveSymbolBuiltin( info );
+                }
+            
+            if( info->funcName == NULL ) {
+                info->funcName = stringDuplicate( "??" );
+                }
+            if( info->fileName == NULL ) {
+                info->fileName = stringDuplicate( "" );
+                }
+            }
+        }
+    else {
+        loadTargetSymbolsIntoGDB();
+        
+        for( int i=0; i<symbolCache.size(); i += SYMBOL_BATCH_SIZE ) {
+            int end = i + SYMBOL_BATCH_SIZE;
+            if( end > symbolCache.size() ) {
+                end = symbolCache.size();
+                }
+            resolveSymbolBatch( i, end );
+            }
+        }
+    
+    // frames just point into symbolCache
+    for( int i=0; i<stackLog.size(); i++ ) {
+        Stack *s = stackLog.getElement( i );
+        
+        for( int f=0; f<s->frames.size(); f++ ) {
+            StackFrame *sf = s->frames.getElement( f );
+            
+            if( sf->funcName == NULL ) {
+                SymbolInfo *info = findSymbolInfo( sf->address, f > 0 );
+                
+                sf->funcName = info->funcName;
+                sf->fileName = info->fileName;
+                sf->lineNum = info->lineNum;
+                }
+            }
+        }
+
+    // as do tree nodes
+    for( int i=0; i<callTree.size(); i++ ) {
+        CallTreeNode *node = callTree.getElement( i );
+        StackFrame *sf = &( node->frame );
+        
+        if( sf->funcName == NULL && node->sampleCount > node->endCount ) {
+            SymbolInfo *info = findSymbolInfo( sf->address, true );
+            
+            sf->funcName = info->funcName;
+            sf->fileName = info->fileName;
+            sf->lineNum = info->lineNum;
+            }
+        }
+    
+    for( int i=0; i<perfStackLog.size(); i++ ) {
+        StackFrame *sf = perfStackLog.getElement( i )->frames.getElement( 0 );
+        
+        SymbolInfo *info = findSymbolInfo( sf->address, false );
+        
+        sf->funcName = info->funcName;
+        sf->fileName = info->fileName;
+        sf->lineNum = info->lineNum;
+        }
+    }
+
+
+
+// **************************************
+// offline reports
+
+// --report reads a sample log back in through the same functions that
+// sampling uses, and the report comes out as it would have right after
+// sampling.  The log is mapped rather than read in, and is walked
+// through once, so only its unique stacks and names end up in memory,
+// however many samples it holds.  A log that stops part way through a
+// record, because the profiler was killed, is reported on up to that
+// record.
+
+
+// names that were looked up after sampling go into the log too, so a
+// report from the log doesn't need GDB or the target's files
+// so do the source paths we know, so the report can still show lines
+static void logSymbolRecords() {
+    if( sampleLogFile == NULL ) {
+        return;
+        }
+    
+    for( int i=0; i<symbolCache.size(); i++ ) {
+        SymbolInfo *info = symbolCache.getElement( i );
+        
+        putc_unlocked( SAMPLE_LOG_SYMBOL, sampleLogFile );
+        logNumber( info->address );
+        logBytes( info->funcName, strlen( info->funcName ) );
+        logBytes( info->fileName, strlen( info->fileName ) );
+        logNumber( info->lineNum + 1 );
+        }
+    
+    for( int i=0; i<sourcePaths.size(); i++ ) {
+        SourcePath *p = sourcePaths.getElement( i );
+        
+        if( p->path == NULL ) {
+            continue;
+            }
+        putc_unlocked( SAMPLE_LOG_SOURCE_PATH, sampleLogFile );
+        logBytes( p->name, strlen( p->name ) );
+        logBytes( p->path, strlen( p->path ) );
+        }
+    }
+
+
+
+typedef struct SampleLogSummary {
+        double requestedRate;
+        double samplingSeconds;
+        int numSamples;
+    } SampleLogSummary;
+
+
+
+static double readLogDouble( DWARFReader *inR ) {
+    unsigned long long bits = readFixed( inR, sizeof( double ) );
+    
+    double value;
+    memcpy( &value, &bits, sizeof( double ) );
+    
+    return value;
+    }
+
+
+
+// reads the number of one of inCount earlier records
+static int readLogRecordNumber( DWARFReader *inR, int inCount ) {
+    unsigned long long n = readULEB( inR );
+    
+    if( n >= (unsigned long long)inCount ) {
+        inR->failed = true;
+        return 0;
+        }
+    return (int)n;
+    }
+
+
+
+// reads a count of things that take at least a byte each
+static int readLogCount( DWARFReader *inR ) {
+    unsigned long long n = readULEB( inR );
+    
+    if( n > (unsigned long long)( inR->end - inR->pos ) ) {
+        inR->failed = true;
+        return 0;
+        }
+    return (int)n;
+    }
+
+
+
+// returns an interned copy of a string in the log
+static char *readLogString( DWARFReader *inR ) {
+    int length = readLogCount( inR );
+    
+    if( inR->failed ) {
+        return NULL;
+        }
+    
+    char *s = internString( (const char*)inR->pos, length );
+    inR->pos = &( inR->pos[ length ] );
+    
+    return s;
+    }
+
+
+
+// reads frame numbers into ioFrameIDs, as IDs in frameTable
+static void readLogFrames( DWARFReader *inR, 
+                           SimpleVector<unsigned int> *inFrameIDs,
+                           SimpleVector<unsigned int> *ioFrameIDs ) {
+    ioFrameIDs->deleteStartElements( ioFrameIDs->size() );
+    
+    int numFrames = readLogCount( inR );
+    
+    for( int i=0; i<numFrames && !inR->failed; i++ ) {
+        ioFrameIDs->push_back( inFrameIDs->getElementDirect( 
+            readLogRecordNumber( inR, inFrameIDs->size() ) ) );
+        }
+    }
+
+
+
+// fills stackLog, perfStackLog, threadLog, sampleRecords, targetMaps 
+// and loggedSymbols from a log written with --sampleLog
+// returns false if there's nothing in inFileName to report on
+static char readSampleLog( const char *inFileName, 
+                           SampleLogSummary *outSummary ) {
+    MappedFile file;
+    
+    if( ! mapWholeFile( inFileName, &file ) ) {
+        printf( "Could not read sample log %s\n", inFileName );
+        return false;
+        }
+    
+    if( file.length < SAMPLE_LOG_MAGIC_LENGTH ||
+        memcmp( file.data, SAMPLE_LOG_MAGIC, 
+                SAMPLE_LOG_MAGIC_LENGTH ) != 0 ) {
+        printf( "%s is not a sample log\n", inFileName );
+        munmap( file.data, file.length );
+        return false;
+        }
+    
+    // we only pass through once
+    madvise( file.data, file.length, MADV_SEQUENTIAL );
+    
+    DWARFReader r = { &( file.data[ SAMPLE_LOG_MAGIC_LENGTH ] ),
+                      &( file.data[ file.length ] ), false, 8, false };
+    
+    unsigned long long version = readULEB( &r );
+    
+    if( version != SAMPLE_LOG_VERSION ) {
+        printf( "Sample log %s is version %llu, "
+                "we can only read version %d\n", 
+                inFileName, version, SAMPLE_LOG_VERSION );
+        munmap( file.data, file.length );
+        return false;
+        }
+    
+    printf( "Reading sample log %s (%.1f MB)\n", inFileName, 
+            file.length / ( 1024.0 * 1024.0 ) );
+    
+    // what the log's numbers stand for here
+    SimpleVector<char*> strings;
+    SimpleVector<unsigned int> frameIDs;
+    SimpleVector<int> threadIndices;
+    SimpleVector<int> stackIndices;
+    SimpleVector<int> perfStackIndices;
+    
+    SimpleVector<unsigned int> stackFrameIDs;
+    
+    char sawStart = false;
+    char sawEnd = false;
+    char unknownRecord = false;
+    
+    while( r.pos < r.end && !r.failed && !unknownRecord ) {
+        int type = r.pos[0];
+        r.pos = &( r.pos[1] );
+        
+        switch( type ) {
+            case SAMPLE_LOG_STRING: {
+                char *s = readLogString( &r );
+                
+                if( !r.failed ) {
+                    strings.push_back( s );
+                    }
+                break;
+                }
+            case SAMPLE_LOG_FRAME: {
+                StackFrame f;
+                f.address = (void*)(uintptr_t)readULEB( &r );
+                
+                int funcNumber = 
+                    readLogRecordNumber( &r, strings.size() + 1 );
+                int fileNumber = 
+                    readLogRecordNumber( &r, strings.size() + 1 );
+                
+                f.lineNum = (int)readULEB( &r ) - 1;
+                
+                if( !r.failed ) {
+                    f.funcName = NULL;
+                    f.fileName = NULL;
+                    
+                    if( funcNumber > 0 ) {
+                        f.funcName = strings.getElementDirect( 
+                            funcNumber - 1 );
+                        }
+                    if( fileNumber > 0 ) {
+                        f.fileName = strings.getElementDirect( 
+                            fileNumber - 1 );
+                        }
+                    frameIDs.push_back( internFrame( f ) );
+                    }
+                break;
+                }
+            case SAMPLE_LOG_THREAD: {
+                // a thread that's been seen before is being renamed
+                int index = 
+                    readLogRecordNumber( &r, threadIndices.size() + 1 );
+                int id = (int)readULEB( &r );
+                char *name = readLogString( &r );
+                
+                if( !r.failed ) {
+                    int localIndex = getThreadIndex( id, name );
+                    
+                    if( index == threadIndices.size() ) {
+                        threadIndices.push_back( localIndex );
+                        }
+                    }
+                break;
+                }
+            case SAMPLE_LOG_STACK: {
+                int thread = 
+                    readLogRecordNumber( &r, threadIndices.size() + 1 );
+                
+                readLogFrames( &r, &frameIDs, &stackFrameIDs );
+                
+                if( !r.failed ) {
+                    int threadIndex = -1;
+                    if( thread > 0 ) {
+                        threadIndex = 
+                            threadIndices.getElementDirect( thread - 1 );
+                        }
+                    
+                    char isNew;
+                    stackIndices.push_back( 
+                        addStack( stackFrameIDs.getElement( 0 ),
+                                  stackFrameIDs.size(), threadIndex,
+                                  &isNew ) );
+                    }
+                break;
+                }
+            case SAMPLE_LOG_SAMPLES: {
+                int stack = readLogRecordNumber( &r, stackIndices.size() );
+                int count = (int)readULEB( &r );
+                double seconds = readLogDouble( &r );
+                
+                if( !r.failed ) {
+                    addStackSamples( stackIndices.getElementDirect( stack ),
+                                     count, seconds );
+                    }
+                break;
+                }
+            case SAMPLE_LOG_STOP: {
+                SampleRecord s;
+                s.time = readLogDouble( &r );
+                s.interval = readLogDouble( &r );
+                s.stopSeconds = readLogDouble( &r );
+                s.captureSeconds = readLogDouble( &r );
+                s.resumeSeconds = readLogDouble( &r );
+                
+                if( !r.failed ) {
+                    sampleRecords.push_back( s );
+                    addTimelineStop( &s );
+                    }
+                break;
+                }
+            case SAMPLE_LOG_PERF_STACK: {
+                readLogFrames( &r, &frameIDs, &stackFrameIDs );
+                
+                if( !r.failed ) {
+                    char isNew;
+                    perfStackIndices.push_back(
+                        findOrAddStack( &perfStackLog, &perfStackLogKeys,
+                                        &perfStackLogIndex,
+                                        stackFrameIDs.getElement( 0 ),
+                                        stackFrameIDs.size(), -1, 
+                                        &isNew ) );
+                    }
+                break;
+                }
+            case SAMPLE_LOG_PERF_SAMPLE: {
+                int stack = 
+                    readLogRecordNumber( &r, perfStackIndices.size() );
+                
+                if( !r.failed ) {
+                    numPerfSamples++;
+                    perfStackLog.getElement( 
+                        perfStackIndices.getElementDirect( stack ) )->
+                        sampleCount++;
+                    }
+                break;
+                }
+            case SAMPLE_LOG_MAPS: {
+                SimpleVector<MapRegion> regions;
+                
+                int numRegions = readLogCount( &r );
+                
+                for( int i=0; i<numRegions && !r.failed; i++ ) {
+                    MapRegion m;
+                    m.start = readULEB( &r );
+                    m.end = readULEB( &r );
+                    m.offset = readULEB( &r );
+                    m.path = readLogString( &r );
+                    
+                    regions.push_back( m );
+                    }
+                
+                if( !r.failed ) {
+                    for( int i=0; i<targetMaps.size(); i++ ) {
+                        delete [] targetMaps.getElementDirect( i ).path;
+                        }
+                    targetMaps.deleteAll();
+                    
+                    for( int i=0; i<regions.size(); i++ ) {
+                        MapRegion m = regions.getElementDirect( i );
+                        m.path = stringDuplicate( m.path );
+                        targetMaps.push_back( m );
+                        }
+                    }
+                break;
+                }
+            case SAMPLE_LOG_START: {
+                double rate = readLogDouble( &r );
+                char allThreads = (char)readULEB( &r );
+                char onCPU = (char)readULEB( &r );
+                
+                if( !r.failed ) {
+                    outSummary->requestedRate = rate;
+                    sampleAllThreads = allThreads;
+                    usePerf = onCPU;
+                    sawStart = true;
+                    }
+                break;
+                }
+            case SAMPLE_LOG_END: {
+                int numSamples = (int)readULEB( &r );
+                double seconds = readLogDouble( &r );
+                long lost = (long)readULEB( &r );
+                
+                if( !r.failed ) {
+                    outSummary->numSamples = numSamples;
+                    outSummary->samplingSeconds = seconds;
+                    perfLostCount = lost;
+                    sawEnd = true;
+                    }
+                break;
+                }
+            case SAMPLE_LOG_SYMBOL: {
+                SymbolInfo info;
+                info.address = readULEB( &r );
+                info.funcName = readLogString( &r );
+                info.fileName = readLogString( &r );
+                info.lineNum = (int)readULEB( &r ) - 1;
+                
+                if( !r.failed ) {
+                    loggedSymbols.push_back( info );
+                    }
+                break;
+                }
+            case SAMPLE_LOG_SOURCE_PATH: {
+                const char *name = readLogString( &r );
+                const char *path = readLogString( &r );
+                
+                if( !r.failed ) {
+                    recordSourcePath( name, path );
+                    }
+                break;
+                }
+            default:
+                printf( "Unknown record type %d at byte %ld of "
+                        "sample log, stopping there\n", type, 
+                        (long)( r.pos - file.data - 1 ) );
+                unknownRecord = true;
+                break;
+            }
+        }
+    
+    munmap( file.data, file.length );
+    
+    if( r.failed ) {
+        printf( "Sample log stops part way through a record, "
+                "reporting on what came before it\n" );
+        }
+    
+    if( ! sawStart ) {
+        printf( "Sample log %s has no samples in it\n", inFileName );
+        return false;
+        }
+    
+    if( ! sawEnd ) {
+        // profiler didn't get to finish, so go by the stops we have
+        printf( "Sample log %s was not finished\n", inFileName );
+        
+        outSummary->numSamples = sampleRecords.size();
+        outSummary->samplingSeconds = 0;
+        
+        if( sampleRecords.size() > 0 ) {
+            outSummary->samplingSeconds = 
+                sampleRecords.getLastElement()->time;
+            }
+        }
+    
+    if( loggedSymbols.size() > 0 ) {
+        qsort( loggedSymbols.getElement( 0 ), loggedSymbols.size(), 
+               sizeof( SymbolInfo ), compareSymbolInfo );
+        }
+    
+    return true;
+    }
+
+
+
+// **************************************
+// pprof output
+
+// With --pprof, the samples also go into a profile.proto message, for
+// pprof and the tools built around it.  Each unique stack becomes one
+// pprof sample, with its sample count and its wall-clock nanoseconds as
+// values.  Protobuf lets a message's fields come in any order, so the
+// profile is written out as it's encoded:  each string, function and
+// location goes out the first time a stack needs it, right before that
+// stack's sample, and only the tables for finding them again are kept
+// in memory.  A file name ending in .gz gets a gzip wrapper, with the
+// profile in stored (uncompressed) deflate blocks, since we don't have
+// a compressor of our own.
+
+
+// set with --pprof
+const char *pprofFileName = NULL;
+
+// wall-clock time when sampling started, or 0 if we don't know
+time_t samplingStartTime = 0;
+
+
+// protobuf wire types
+#define PROTO_VARINT 0
+#define PROTO_LENGTH 2
+
+// fields of the messages in profile.proto that we fill in
+#define PROFILE_SAMPLE_TYPE 1
+#define PROFILE_SAMPLE 2
+#define PROFILE_MAPPING 3
+#define PROFILE_LOCATION 4
+#define PROFILE_FUNCTION 5
+#define PROFILE_STRING_TABLE 6
+#define PROFILE_TIME_NANOS 9
+#define PROFILE_DURATION_NANOS 10
+#define PROFILE_PERIOD_TYPE 11
+#define PROFILE_PERIOD 12
+#define PROFILE_DEFAULT_SAMPLE_TYPE 14
+
+#define VALUE_TYPE_TYPE 1
+#define VALUE_TYPE_UNIT 2
+
+#define SAMPLE_LOCATION_ID 1
+#define SAMPLE_VALUE 2
+#define SAMPLE_LABEL 3
+
+#define LABEL_KEY 1
+#define LABEL_STR 2
+#define LABEL_NUM 3
+
+#define MAPPING_ID 1
+#define MAPPING_MEMORY_START 2
+#define MAPPING_MEMORY_LIMIT 3
+#define MAPPING_FILE_OFFSET 4
+#define MAPPING_FILENAME 5
+#define MAPPING_HAS_FUNCTIONS 7
+#define MAPPING_HAS_FILENAMES 8
+#define MAPPING_HAS_LINE_NUMBERS 9
+
+#define LOCATION_ID 1
+#define LOCATION_MAPPING_ID 2
+#define LOCATION_ADDRESS 3
+#define LOCATION_LINE 4
+
+#define LINE_FUNCTION_ID 1
+#define LINE_LINE 2
+
+#define FUNCTION_ID 1
+#define FUNCTION_NAME 2
+#define FUNCTION_SYSTEM_NAME 3
+#define FUNCTION_FILENAME 4
+
+
+
+static void protoVarint( SimpleVector<unsigned char> *ioMessage, 
+                         unsigned long long inValue ) {
+    do {
+        unsigned char b = inValue & 0x7f;
+        inValue >>= 7;
+        
+        if( inValue != 0 ) {
+            b |= 0x80;
+            }
+        ioMessage->push_back( b );
+        } while( inValue != 0 );
+    }
+
+
+
+// zero is the default, so it's left out
+static void protoVarintField( SimpleVector<unsigned char> *ioMessage, 
+                              int inField, unsigned long long inValue ) {
+    if( inValue != 0 ) {
+        protoVarint( ioMessage, inField << 3 | PROTO_VARINT );
+        protoVarint( ioMessage, inValue );
+        }
+    }
+
+
+
+static void protoBytesField( SimpleVector<unsigned char> *ioMessage, 
+                             int inField, 
+                             const unsigned char *inBytes, int inLength ) {
+    protoVarint( ioMessage, inField << 3 | PROTO_LENGTH );
+    protoVarint( ioMessage, inLength );
+    ioMessage->push_back( (unsigned char*)inBytes, inLength );
+    }
+
+
+
+static void protoMessageField( SimpleVector<unsigned char> *ioMessage, 
+                               int inField, 
+                               SimpleVector<unsigned char> *inSubMessage ) {
+    protoBytesField( ioMessage, inField, inSubMessage->getElement( 0 ),
+                     inSubMessage->size() );
+    }
+
+
+
+// packed repeated field
+static void protoPackedField( SimpleVector<unsigned char> *ioMessage, 
+                              int inField, 
+                              unsigned long long *inValues, 
+                              int inNumValues ) {
+    SimpleVector<unsigned char> packed;
+    
+    for( int i=0; i<inNumValues; i++ ) {
+        protoVarint( &packed, inValues[i] );
+        }
+    protoMessageField( ioMessage, inField, &packed );
+    }
+
+
+
+FILE *pprofFile = NULL;
+
+char pprofGzip = false;
+
+// a stored deflate block can hold up to 65535 bytes
+#define PPROF_BLOCK_SIZE 65535
+
+unsigned char pprofBlock[ PPROF_BLOCK_SIZE ];
+int pprofBlockUsed = 0;
+
+// of everything that went into the gzip wrapper, for its trailer
+unsigned int pprofCRC = 0;
+unsigned int pprofLength = 0;
+
+
+unsigned int crcTable[256];
+char crcTableMade = false;
+
+
+
+// CRC-32, as gzip uses it
+static unsigned int updateCRC32( unsigned int inCRC, 
+                                 const unsigned char *inBytes, 
+                                 int inLength ) {
+    if( ! crcTableMade ) {
+        for( unsigned int n=0; n<256; n++ ) {
+            unsigned int c = n;
+            for( int k=0; k<8; k++ ) {
+                if( c & 1 ) {
+                    c = 0xEDB88320U ^ ( c >> 1 );
+                    }
+                else {
+                    c = c >> 1;
+                    }
+                }
+            crcTable[n] = c;
+            }
+        crcTableMade = true;
+        }
+    
+    unsigned int c = inCRC ^ 0xFFFFFFFFU;
+    
+    for( int i=0; i<inLength; i++ ) {
+        c = crcTable[ ( c ^ inBytes[i] ) & 0xff ] ^ ( c >> 8 );
+        }
+    return c ^ 0xFFFFFFFFU;
+    }
+
+
+
+static void writeLittleEndian( unsigned int inValue, int inNumBytes ) {
+    for( int i=0; i<inNumBytes; i++ ) {
+        putc( ( inValue >> ( 8 * i ) ) & 0xff, pprofFile );
+        }
+    }
+
+
+
+static void writeStoredBlock( char inFinal ) {
+    putc( inFinal ? 1 : 0, pprofFile );
+    writeLittleEndian( pprofBlockUsed, 2 );
+    writeLittleEndian( ~pprofBlockUsed & 0xffff, 2 );
+    
+    fwrite( pprofBlock, 1, pprofBlockUsed, pprofFile );
+    pprofBlockUsed = 0;
+    }
+
+
+
+static void writePprofBytes( const unsigned char *inBytes, int inLength ) {
+    if( ! pprofGzip ) {
+        fwrite( inBytes, 1, inLength, pprofFile );
+        return;
+        }
+    
+    pprofCRC = updateCRC32( pprofCRC, inBytes, inLength );
+    pprofLength += inLength;
+    
+    while( inLength > 0 ) {
+        int numToCopy = PPROF_BLOCK_SIZE - pprofBlockUsed;
+        if( numToCopy > inLength ) {
+            numToCopy = inLength;
+            }
+        memcpy( &( pprofBlock[ pprofBlockUsed ] ), inBytes, numToCopy );
+        pprofBlockUsed += numToCopy;
+        
+        inBytes = &( inBytes[ numToCopy ] );
+        inLength -= numToCopy;
+        
+        if( pprofBlockUsed == PPROF_BLOCK_SIZE ) {
+            writeStoredBlock( false );
+            }
+        }
+    }
+
+
+
+// writes one field of the top-level Profile message
+static void writeProfileField( int inField, 
+                               SimpleVector<unsigned char> *inMessage ) {
+    SimpleVector<unsigned char> header;
+    
+    protoVarint( &header, inField << 3 | PROTO_LENGTH );
+    protoVarint( &header, inMessage->size() );
+    
+    writePprofBytes( header.getElement( 0 ), header.size() );
+    writePprofBytes( inMessage->getElement( 0 ), inMessage->size() );
+    }
+
+
+
+static void writeProfileVarint( int inField, unsigned long long inValue ) {
+    SimpleVector<unsigned char> field;
+    
+    protoVarintField( &field, inField, inValue );
+    
+    writePprofBytes( field.getElement( 0 ), field.size() );
+    }
+
+
+
+// the profile's string table, where a string's index is what messages
+// use to refer to it
+// strings aren't copied, and must live until the profile is written
+SimpleVector<const char*> pprofStrings;
+
+HashIndex pprofStringIndex = { NULL, NULL, 0, 0 };
+
+
+typedef struct PprofFunction {
+        int nameIndex;
+        int fileIndex;
+    } PprofFunction;
+
+// a function's ID is its index + 1
+SimpleVector<PprofFunction> pprofFunctions;
+
+HashIndex pprofFunctionIndex = { NULL, NULL, 0, 0 };
+
+
+typedef struct PprofLocation {
+        uintptr_t address;
+        int functionID;
+        int lineNum;
+    } PprofLocation;
+
+// a location's ID is its index + 1
+SimpleVector<PprofLocation> pprofLocations;
+
+HashIndex pprofLocationIndex = { NULL, NULL, 0, 0 };
+
+
+
+static char pprofStringMatches( int inNumber, void *inKey ) {
+    return strcmp( pprofStrings.getElementDirect( inNumber ), 
+                   (const char*)inKey ) == 0;
+    }
+
+
+
+// returns the string's index in the string table, writing it out
+// if it's new
+static int getPprofString( const char *inString ) {
+    if( inString == NULL ) {
+        inString = "";
+        }
+    
+    int length = strlen( inString );
+    unsigned int hash = hashBytes( inString, length );
+    
+    int found = findInHashIndex( &pprofStringIndex, hash, 
+                                 pprofStringMatches, (void*)inString );
+    if( found != -1 ) {
+        return found;
+        }
+    
+    pprofStrings.push_back( inString );
+    addToHashIndex( &pprofStringIndex, pprofStrings.size() - 1, hash );
+    
+    SimpleVector<unsigned char> field;
+    protoBytesField( &field, PROFILE_STRING_TABLE, 
+                     (const unsigned char*)inString, length );
+    
+    writePprofBytes( field.getElement( 0 ), field.size() );
+    
+    return pprofStrings.size() - 1;
+    }
+
+
+
+static char pprofFunctionMatches( int inNumber, void *inKey ) {
+    PprofFunction *a = pprofFunctions.getElement( inNumber );
+    PprofFunction *b = (PprofFunction*)inKey;
+    
+    return a->nameIndex == b->nameIndex && a->fileIndex == b->fileIndex;
+    }
+
+
+
+// returns the ID of the function, writing it out if it's new
+static int getPprofFunction( const char *inName, const char *inFileName ) {
+    if( inName == NULL ) {
+        inName = "??";
+        }
+    
+    PprofFunction f = { getPprofString( inName ), 
+                        getPprofString( inFileName ) };
+    
+    int parts[2] = { f.nameIndex, f.fileIndex };
+    unsigned int hash = hashBytes( (const char*)parts, sizeof( parts ) );
+    
+    int found = findInHashIndex( &pprofFunctionIndex, hash, 
+                                 pprofFunctionMatches, &f );
+    if( found != -1 ) {
+        return found + 1;
+        }
+    
+    pprofFunctions.push_back( f );
+    addToHashIndex( &pprofFunctionIndex, pprofFunctions.size() - 1, hash );
+    
+    int id = pprofFunctions.size();
+    
+    SimpleVector<unsigned char> message;
+    protoVarintField( &message, FUNCTION_ID, id );
+    protoVarintField( &message, FUNCTION_NAME, f.nameIndex );
+    protoVarintField( &message, FUNCTION_SYSTEM_NAME, f.nameIndex );
+    protoVarintField( &message, FUNCTION_FILENAME, f.fileIndex );
+    
+    writeProfileField( PROFILE_FUNCTION, &message );
+    
+    return id;
+    }
+
+
+
+static char pprofLocationMatches( int inNumber, void *inKey ) {
+    PprofLocation *a = pprofLocations.getElement( inNumber );
+    PprofLocation *b = (PprofLocation*)inKey;
+    
+    return a->address == b->address && a->functionID == b->functionID &&
+        a->lineNum == b->lineNum;
+    }
+
+
+
+// returns the ID of the frame's location, writing it out if it's new
+// the same address can have two locations, since return addresses 
+// are looked up one byte back
+static int getPprofLocation( StackFrame *inFrame ) {
+    PprofLocation l = { (uintptr_t)inFrame->address,
+                        getPprofFunction( inFrame->funcName, 
+                                          inFrame->fileName ),
+                        inFrame->lineNum };
+    
+    uint64_t parts[3] = { (uint64_t)l.address, 
+                          (uint64_t)l.functionID, 
+                          (uint64_t)(unsigned int)l.lineNum };
+    unsigned int hash = hashBytes( (const char*)parts, sizeof( parts ) );
+    
+    int found = findInHashIndex( &pprofLocationIndex, hash, 
+                                 pprofLocationMatches, &l );
+    if( found != -1 ) {
+        return found + 1;
+        }
+    
+    pprofLocations.push_back( l );
+    addToHashIndex( &pprofLocationIndex, pprofLocations.size() - 1, hash );
+    
+    int id = pprofLocations.size();
+    
+    SimpleVector<unsigned char> line;
+    protoVarintField( &line, LINE_FUNCTION_ID, l.functionID );
+    if( l.lineNum > 0 ) {
+        protoVarintField( &line, LINE_LINE, l.lineNum );
+        }
+    
+    SimpleVector<unsigned char> message;
+    protoVarintField( &message, LOCATION_ID, id );
+    
+    MapRegion *region = findMapRegion( l.address );
+    
+    if( region != NULL ) {
+        protoVarintField( &message, LOCATION_MAPPING_ID, 
+                          region - targetMaps.getElement( 0 ) + 1 );
+        }
+    protoVarintField( &message, LOCATION_ADDRESS, l.address );
+    protoMessageField( &message, LOCATION_LINE, &line );
+    
+    writeProfileField( PROFILE_LOCATION, &message );
+    
+    return id;
+    }
+
+
+
+static void writePprofValueType( int inField, const char *inType,
+                                 const char *inUnit ) {
+    SimpleVector<unsigned char> message;
+    protoVarintField( &message, VALUE_TYPE_TYPE, getPprofString( inType ) );
+    protoVarintField( &message, VALUE_TYPE_UNIT, getPprofString( inUnit ) );
+    
+    writeProfileField( inField, &message );
+    }
+
+
+
+static void writePprofLabel( SimpleVector<unsigned char> *ioSample,
+                             const char *inKey, const char *inString,
+                             long long inNumber ) {
+    SimpleVector<unsigned char> message;
+    protoVarintField( &message, LABEL_KEY, getPprofString( inKey ) );
+    
+    if( inString != NULL ) {
+        protoVarintField( &message, LABEL_STR, getPprofString( inString ) );
+        }
+    else {
+        protoVarintField( &message, LABEL_NUM, inNumber );
+        }
+    
+    protoMessageField( ioSample, SAMPLE_LABEL, &message );
+    }
+
+
+
+// call after names are resolved
+static void writePprofProfile( const char *inFileName, 
+                               double inRequestedRate,
+                               double inSamplingSeconds ) {
+    pprofFile = fopen( inFileName, "wb" );
+    
+    if( pprofFile == NULL ) {
+        printf( "Could not open %s to write pprof profile\n", inFileName );
+        return;
+        }
+    
+    int nameLength = strlen( inFileName );
+    
+    pprofGzip = nameLength > 3 && 
+        strcmp( &( inFileName[ nameLength - 3 ] ), ".gz" ) == 0;
+    
+    if( pprofGzip ) {
+        // no timestamp, no flags, Unix
+        const unsigned char header[10] = 
+            { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3 };
+        fwrite( header, 1, sizeof( header ), pprofFile );
+        
+        pprofCRC = 0;
+        pprofLength = 0;
+        pprofBlockUsed = 0;
+        }
+    
+    // string 0 has to be empty
+    getPprofString( "" );
+    
+    writePprofValueType( PROFILE_SAMPLE_TYPE, "samples", "count" );
+    writePprofValueType( PROFILE_SAMPLE_TYPE, "wall", "nanoseconds" );
+    
+    for( int i=0; i<targetMaps.size(); i++ ) {
+        MapRegion *r = targetMaps.getElement( i );
+        
+        SimpleVector<unsigned char> message;
+        protoVarintField( &message, MAPPING_ID, i + 1 );
+        protoVarintField( &message, MAPPING_MEMORY_START, r->start );
+        protoVarintField( &message, MAPPING_MEMORY_LIMIT, r->end );
+        protoVarintField( &message, MAPPING_FILE_OFFSET, r->offset );
+        protoVarintField( &message, MAPPING_FILENAME, 
+                          getPprofString( r->path ) );
+        
+        // names are already looked up
+        protoVarintField( &message, MAPPING_HAS_FUNCTIONS, 1 );
+        protoVarintField( &message, MAPPING_HAS_FILENAMES, 1 );
+        protoVarintField( &message, MAPPING_HAS_LINE_NUMBERS, 1 );
+        
+        writeProfileField( PROFILE_MAPPING, &message );
+        }
+    
+    SimpleVector<unsigned long long> locationIDs;
+    
+    for( int i=0; i<stackLog.size(); i++ ) {
+        Stack *s = stackLog.getElement( i );
+        
+        if( s->sampleCount == 0 ) {
+            continue;
+            }
+        
+        // innermost first, same as pprof
+        locationIDs.deleteStartElements( locationIDs.size() );
+        
+        for( int f=0; f<s->frames.size(); f++ ) {
+            locationIDs.push_back( 
+                getPprofLocation( s->frames.getElement( f ) ) );
+            }
+        
+        unsigned long long values[2] = 
+            { (unsigned long long)s->sampleCount, 
+              (unsigned long long)llround( s->sampleSeconds * 1e9 ) };
+        
+        SimpleVector<unsigned char> message;
+        
+        if( locationIDs.size() > 0 ) {
+            protoPackedField( &message, SAMPLE_LOCATION_ID, 
+                              locationIDs.getElement( 0 ), 
+                              locationIDs.size() );
+            }
+        protoPackedField( &message, SAMPLE_VALUE, values, 2 );
+        
+        if( s->threadIndex >= 0 ) {
+            ThreadRecord *t = threadLog.getElement( s->threadIndex );
+            
+            writePprofLabel( &message, "thread", t->name, 0 );
+            writePprofLabel( &message, "thread id", NULL, t->id );
+            }
+        
+        writeProfileField( PROFILE_SAMPLE, &message );
+        }
+    
+    writePprofValueType( PROFILE_PERIOD_TYPE, "wall", "nanoseconds" );
+    
+    if( inRequestedRate > 0 ) {
+        writeProfileVarint( PROFILE_PERIOD, llround( 1e9 / inRequestedRate ) );
+        }
+    if( samplingStartTime != 0 ) {
+        writeProfileVarint( PROFILE_TIME_NANOS, 
+                            (unsigned long long)samplingStartTime * 
+                            1000000000ULL );
+        }
+    writeProfileVarint( PROFILE_DURATION_NANOS, 
+                        llround( inSamplingSeconds * 1e9 ) );
+    writeProfileVarint( PROFILE_DEFAULT_SAMPLE_TYPE, 
+                        getPprofString( "wall" ) );
+    
+    if( pprofGzip ) {
+        writeStoredBlock( true );
+        
+        writeLittleEndian( pprofCRC, 4 );
+        writeLittleEndian( pprofLength, 4 );
+        }
+    
+    fclose( pprofFile );
+    pprofFile = NULL;
+    
+    printf( "Wrote pprof profile with %d locations to %s\n", 
+            pprofLocations.size(), inFileName );
+    
+    pprofStrings.deleteAll();
+    pprofFunctions.deleteAll();
+    pprofLocations.deleteAll();
+    freeHashIndex( &pprofStringIndex );
+    freeHashIndex( &pprofFunctionIndex );
+    freeHashIndex( &pprofLocationIndex );
+    }
+
+
+
+// **************************************
+// flame graphs
+
+// --folded writes each unique stack on a line of its own, outermost
+// frame first, in the collapsed format that flame graph tools read:
+//     main;readRandFileValue;fseek 1234
+// The number is the stack's wall-clock time in microseconds, so the
+// stacks add up the same way the report's percentages do.
+//
+// --flameGraph draws the graph itself, as an SVG file with no scripts.
+// Stacks are merged by function name into a tree (each thread is its
+// own root with --allThreads), siblings are sorted by name, and each
+// node is laid out in one pass over the nodes sorted by parent, since
+// a parent always comes before its children.  Boxes too narrow to see
+// are left out, so the file stays small however many stacks there are.
+
+
+// set with --folded and --flameGraph
+const char *foldedFileName = NULL;
+const char *flameGraphFileName = NULL;
+
+// root at the top instead of the bottom, set with --icicle
+char flameGraphIcicle = false;
+
+
+#define FLAME_GRAPH_WIDTH 1200
+#define FLAME_FRAME_HEIGHT 16
+#define FLAME_FONT_SIZE 12
+// rough width of a character, for fitting names into boxes
+#define FLAME_CHAR_WIDTH 7
+// space around the graph, with room for the title at the top
+#define FLAME_MARGIN 10
+#define FLAME_TITLE_HEIGHT 40
+// boxes narrower than this many pixels are left out
+#define FLAME_MIN_WIDTH 0.1
+
+
+
+// names as they go into a collapsed stack line, where ; separates
+// frames and the last space comes before the count
+static void writeFoldedName( FILE *inFile, const char *inName ) {
+    if( inName == NULL ) {
+        inName = "??";
+        }
+    for( const char *c = inName; *c != '\0'; c++ ) {
+        if( *c == ';' ) {
+            putc( ':', inFile );
+            }
+        else if( *c == '\n' ) {
+            putc( ' ', inFile );
+            }
+        else {
+            putc( *c, inFile );
+            }
+        }
+    }
+
+
+
+// root frame for a thread's stacks, name-id like perf's collapsed
+// stacks, so same-named threads stay apart
+// destroyed by caller
+static char *getFlameThreadName( int inThreadIndex ) {
+    ThreadRecord *t = threadLog.getElement( inThreadIndex );
+    
+    return autoSprintf( "%s-%d", t->name, t->id );
+    }
+
+
+
+static void writeFoldedStacks( const char *inFileName ) {
+    FILE *file = fopen( inFileName, "w" );
+    
+    if( file == NULL ) {
+        printf( "Could not open %s to write folded stacks\n", inFileName );
+        return;
+        }
+    
+    for( int i=0; i<stackLog.size(); i++ ) {
+        Stack *s = stackLog.getElement( i );
+        
+        if( s->sampleCount == 0 ) {
+            continue;
+            }
+        
+        if( s->threadIndex >= 0 ) {
+            char *threadName = getFlameThreadName( s->threadIndex );
+            writeFoldedName( file, threadName );
+            putc( ';', file );
+            delete [] threadName;
+            }
+        
+        for( int f = s->frames.size() - 1; f >= 0; f-- ) {
+            writeFoldedName( file, s->frames.getElement( f )->funcName );
+            
+            if( f > 0 ) {
+                putc( ';', file );
+                }
+            }
+        fprintf( file, " %lld\n", llround( s->sampleSeconds * 1e6 ) );
+        }
+    
+    fclose( file );
+    
+    printf( "Wrote folded stacks to %s\n", inFileName );
+    }
+
+
+
+typedef struct FlameNode {
+        // interned
+        const char *name;
+        // index in flameNodes, -1 for roots
+        int parent;
+        // roots have depth 0
+        int depth;
+        int sampleCount;
+        double sampleSeconds;
+        // time in the baseline profile, for differential graphs
+        double baseSeconds;
+        // left edge, in seconds from the left of the graph
+        double x;
+    } FlameNode;
+
+
+SimpleVector<FlameNode> flameNodes;
+
+HashIndex flameNodeIndex = { NULL, NULL, 0, 0 };
+
+
+typedef struct FlameNodeKey {
+        int parent;
+        const char *name;
+    } FlameNodeKey;
+
+
+
+static unsigned int hashFlameNodeKey( FlameNodeKey *inKey ) {
+    uint64_t h = (uint64_t)(uintptr_t)inKey->name;
+    
+    h ^= (uint64_t)(unsigned int)inKey->parent << 32;
+    h *= 0x9E3779B97F4A7C15ULL;
+    
+    return (unsigned int)( h >> 32 );
+    }
+
+
+
+static char flameNodeMatches( int inNumber, void *inKey ) {
+    FlameNode *n = flameNodes.getElement( inNumber );
+    FlameNodeKey *k = (FlameNodeKey*)inKey;
+    
+    return n->parent == k->parent && n->name == k->name;
+    }
+
+
+
+static int getFlameNode( int inParent, const char *inName ) {
+    FlameNodeKey key = { inParent, inName };
+    unsigned int hash = hashFlameNodeKey( &key );
+    
+    int found = findInHashIndex( &flameNodeIndex, hash, 
+                                 flameNodeMatches, &key );
+    if( found != -1 ) {
+        return found;
+        }
+    
+    FlameNode n = { inName, inParent, 0, 0, 0, 0, 0 };
+    
+    if( inParent != -1 ) {
+        n.depth = flameNodes.getElement( inParent )->depth + 1;
+        }
+    
+    flameNodes.push_back( n );
+    addToHashIndex( &flameNodeIndex, flameNodes.size() - 1, hash );
+    
+    return flameNodes.size() - 1;
+    }
+
+
+
+// sorts node indices by parent, then name
+static int compareFlameNodes( const void *inA, const void *inB ) {
+    FlameNode *a = flameNodes.getElement( *(int*)inA );
+    FlameNode *b = flameNodes.getElement( *(int*)inB );
+    
+    if( a->parent != b->parent ) {
+        return ( a->parent < b->parent ) ? -1 : 1;
+        }
+    return strcmp( a->name, b->name );
+    }
+
+
+
+static void writeXMLEscaped( FILE *inFile, const char *inText, 
+                             int inMaxLength ) {
+    for( int i=0; inText[i] != '\0' && i < inMaxLength; i++ ) {
+        switch( inText[i] ) {
+            case '&':
+                fputs( "&amp;", inFile );
+                break;
+            case '<':
+                fputs( "&lt;", inFile );
+                break;
+            case '>':
+                fputs( "&gt;", inFile );
+                break;
+            case '"':
+                fputs( "&quot;", inFile );
+                break;
+            default:
+                putc( inText[i], inFile );
+                break;
+            }
+        }
+    }
+
+
+
+// adds samples to inNode and all the nodes above it
+static void addFlameSamples( int inNode, int inCount, double inSeconds,
+                             double inBaseSeconds ) {
+    int n = inNode;
+    while( n != -1 ) {
+        FlameNode *fn = flameNodes.getElement( n );
+        fn->sampleCount += inCount;
+        fn->sampleSeconds += inSeconds;
+        fn->baseSeconds += inBaseSeconds;
+        n = fn->parent;
+        }
+    }
+
+
+
+static void drawFlameGraph( const char *inFileName, int inTotalSamples,
+                            double inTotalSeconds, 
+                            double inBaseTotalSeconds );
+
+
+
+static void writeFlameGraph( const char *inFileName ) {
+    
+    // merge stacks by function name
+    double totalSeconds = 0;
+    int totalSamples = 0;
+    
+    for( int i=0; i<stackLog.size(); i++ ) {
+        Stack *s = stackLog.getElement( i );
+        
+        int node = -1;
+        
+        if( s->threadIndex >= 0 ) {
+            char *threadName = getFlameThreadName( s->threadIndex );
+            node = getFlameNode( 
+                node, internString( threadName, strlen( threadName ) ) );
+            delete [] threadName;
+            }
+        
+        for( int f = s->frames.size() - 1; f >= 0; f-- ) {
+            const char *name = s->frames.getElement( f )->funcName;
+            if( name == NULL ) {
+                name = "??";
+                }
+            node = getFlameNode( node, internString( name, 
+                                                     strlen( name ) ) );
+            }
+        
+        addFlameSamples( node, s->sampleCount, s->sampleSeconds, 0 );
+        
+        totalSeconds += s->sampleSeconds;
+        totalSamples += s->sampleCount;
+        }
+    
+    drawFlameGraph( inFileName, totalSamples, totalSeconds, 0 );
+    }
+
+
+
+// draws the tree in flameNodes, and frees it
+// with inBaseTotalSeconds above 0, boxes are colored by how their share
+// of the time changed from the baseline:  red for more, blue for less
+static void drawFlameGraph( const char *inFileName, int inTotalSamples,
+                            double inTotalSeconds, 
+                            double inBaseTotalSeconds ) {
+    
+    freeHashIndex( &flameNodeIndex );
+    
+    double totalSeconds = inTotalSeconds;
+    int totalSamples = inTotalSamples;
+    
+    char differential = ( inBaseTotalSeconds > 0 );
+    
+    int maxDepth = 0;
+    // biggest change in share, for scaling colors
+    double maxChange = 0;
+    
+    for( int i=0; i<flameNodes.size(); i++ ) {
+        FlameNode *n = flameNodes.getElement( i );
+        
+        if( n->sampleCount == 0 ) {
+            continue;
+            }
+        if( n->depth > maxDepth ) {
+            maxDepth = n->depth;
+            }
+        if( differential ) {
+            double change = fabs( n->sampleSeconds / totalSeconds - 
+                                  n->baseSeconds / inBaseTotalSeconds );
+            if( change > maxChange ) {
+                maxChange = change;
+                }
+            }
+        }
+    
+    FILE *file = fopen( inFileName, "w" );
+    
+    if( file == NULL ) {
+        printf( "Could not open %s to write flame graph\n", inFileName );
+        flameNodes.deleteAll();
+        return;
+        }
+    
+    int numNodes = flameNodes.size();
+    
+    int *order = new int[ numNodes ];
+    for( int i=0; i<numNodes; i++ ) {
+        order[i] = i;
+        }
+    qsort( order, numNodes, sizeof( int ), compareFlameNodes );
+    
+    // where the next child of each node goes
+    double *nextChildX = new double[ numNodes ];
+    double nextRootX = 0;
+    
+    double graphWidth = FLAME_GRAPH_WIDTH - 2 * FLAME_MARGIN;
+    double pixelsPerSecond = 0;
+    if( totalSeconds > 0 ) {
+        pixelsPerSecond = graphWidth / totalSeconds;
+        }
+    
+    int height = 2 * FLAME_MARGIN + FLAME_TITLE_HEIGHT + 
+        ( maxDepth + 1 ) * FLAME_FRAME_HEIGHT;
+    
+    fprintf( file, 
+             "<?xml version=\"1.0\" standalone=\"no\"?>\n"
+             "<svg version=\"1.1\" width=\"%d\" height=\"%d\" "
+             "viewBox=\"0 0 %d %d\" xmlns=\"http://www.w3.org/2000/svg\">\n"
+             "<style>text { font-family: Verdana, sans-serif; "
+             "font-size: %dpx; fill: black; } "
+             "rect { stroke: white; stroke-width: 0.5; }</style>\n"
+             "<rect x=\"0\" y=\"0\" width=\"100%%\" height=\"100%%\" "
+             "fill=\"#f8f8f8\" stroke=\"none\"/>\n"
+             "<text x=\"%d\" y=\"%d\" text-anchor=\"middle\" "
+             "style=\"font-size: 17px\">Wall-clock %s%s</text>\n"
+             "<text x=\"%d\" y=\"%d\" text-anchor=\"middle\">"
+             "%d samples, %.3f seconds%s</text>\n",
+             FLAME_GRAPH_WIDTH, height, FLAME_GRAPH_WIDTH, height,
+             FLAME_FONT_SIZE,
+             FLAME_GRAPH_WIDTH / 2, FLAME_MARGIN + 14,
+             differential ? "differential " : "",
+             flameGraphIcicle ? "icicle graph" : "flame graph",
+             FLAME_GRAPH_WIDTH / 2, FLAME_MARGIN + 32,
+             totalSamples, totalSeconds,
+             differential ? 
+                 ", red took a bigger share than before, blue smaller" : 
+                 "" );
+    
+    int numDrawn = 0;
+    
+    for( int i=0; i<numNodes; i++ ) {
+        int index = order[i];
+        FlameNode *n = flameNodes.getElement( index );
+        
+        if( n->parent == -1 ) {
+            n->x = nextRootX;
+            nextRootX += n->sampleSeconds;
+            }
+        else {
+            n->x = nextChildX[ n->parent ];
+            nextChildX[ n->parent ] += n->sampleSeconds;
+            }
+        nextChildX[ index ] = n->x;
+        
+        double width = n->sampleSeconds * pixelsPerSecond;
+        
+        if( width < FLAME_MIN_WIDTH ) {
+            continue;
+            }
+        
+        double x = FLAME_MARGIN + n->x * pixelsPerSecond;
+        
+        int y;
+        if( flameGraphIcicle ) {
+            y = FLAME_MARGIN + FLAME_TITLE_HEIGHT + 
+                n->depth * FLAME_FRAME_HEIGHT;
+            }
+        else {
+            y = FLAME_MARGIN + FLAME_TITLE_HEIGHT + 
+                ( maxDepth - n->depth ) * FLAME_FRAME_HEIGHT;
+            }
+        
+        int red, green, blue;
+        
+        fprintf( file, "<g><title>" );
+        writeXMLEscaped( file, n->name, strlen( n->name ) );
+        
+        if( differential ) {
+            double share = n->sampleSeconds / totalSeconds;
+            double baseShare = n->baseSeconds / inBaseTotalSeconds;
+            
+            fprintf( file, " (%d samples, %.2f%% from %.2f%%)</title>",
+                     n->sampleCount, 100 * share, 100 * baseShare );
+            
+            // pale for small changes, deep for the biggest one
+            int fade = 240;
+            if( maxChange > 0 ) {
+                fade = (int)( 240 - 
+                              200 * fabs( share - baseShare ) / maxChange );
+                }
+            red = green = blue = fade;
+            
+            if( share > baseShare ) {
+                red = 255;
+                }
+            else if( share < baseShare ) {
+                blue = 255;
+                }
+            }
+        else {
+            fprintf( file, " (%d samples, %.2f%%)</title>",
+                     n->sampleCount, 100 * n->sampleSeconds / totalSeconds );
+            
+            // warm colors that stay the same for a name from run to run
+            unsigned int h = hashBytes( n->name, strlen( n->name ) );
+            
+            red = 205 + h % 50;
+            green = ( h >> 8 ) % 230;
+            blue = ( h >> 16 ) % 55;
+            }
+        
+        fprintf( file, "<rect x=\"%.1f\" y=\"%d\" width=\"%.1f\" "
+                 "height=\"%d\" fill=\"rgb(%d,%d,%d)\"/>",
+                 x, y, width, FLAME_FRAME_HEIGHT, red, green, blue );
+        
+        // as much of the name as fits, if any of it does
+        int numChars = (int)( width - 6 ) / FLAME_CHAR_WIDTH;
+        int nameLength = strlen( n->name );
+        
+        if( numChars >= 3 ) {
+            fprintf( file, "<text x=\"%.1f\" y=\"%d\">", x + 3, 
+                     y + FLAME_FRAME_HEIGHT - 4 );
+            
+            if( nameLength <= numChars ) {
+                writeXMLEscaped( file, n->name, nameLength );
+                }
+            else {
+                writeXMLEscaped( file, n->name, numChars - 2 );
+                fprintf( file, ".." );
+                }
+            fprintf( file, "</text>" );
+            }
+        fprintf( file, "</g>\n" );
+        
+        numDrawn++;
+        }
+    
+    fprintf( file, "</svg>\n" );
+    
+    fclose( file );
+    
+    printf( "Wrote flame graph with %d of %d boxes to %s\n", 
+            numDrawn, numNodes, inFileName );
+    
+    delete [] order;
+    delete [] nextChildX;
+    flameNodes.deleteAll();
+    }
+
+
+
+// **************************************
+// callgrind output
+
+// With --callgrind, the samples are also written out in callgrind's
+// format, for KCachegrind and callgrind_annotate, straight from the
+// stacks rather than from the text report.  Each stack adds its samples
+// to the self cost of its innermost file:line, and to the call from 
+// each frame's line to the function it called, which is where callgrind
+// tools get inclusive costs from.  Costs are added up in hash tables,
+// then sorted by function, so each function's lines and calls go out 
+// together.  Files and functions are numbered, and only the first
+// mention of each carries its name, like in callgrind's own files.
+
+
+// set with --callgrind
+const char *callgrindFileName = NULL;
+
+
+typedef struct CallgrindFunction {
+        // interned
+        const char *name;
+        // index in callgrindFiles
+        int file;
+        // lowest line seen in it, which is as close as we get to where
+        // it starts
+        int firstLine;
+        char written;
+    } CallgrindFunction;
+
+
+typedef struct CallgrindFile {
+        // interned
+        const char *name;
+        char written;
+    } CallgrindFile;
+
+
+// the samples that ended at a line, or that were in a call made from
+// it
+typedef struct CallgrindCost {
+        int function;
+        int line;
+        // index in callgrindFunctions, or -1 for samples that ended here
+        int callee;
+        int sampleCount;
+        double sampleSeconds;
+    } CallgrindCost;
+
+
+SimpleVector<CallgrindFile> callgrindFiles;
+HashIndex callgrindFileIndex = { NULL, NULL, 0, 0 };
+
+SimpleVector<CallgrindFunction> callgrindFunctions;
+HashIndex callgrindFunctionIndex = { NULL, NULL, 0, 0 };
+
+SimpleVector<CallgrindCost> callgrindCosts;
+HashIndex callgrindCostIndex = { NULL, NULL, 0, 0 };
+
+
+
+static char callgrindFileMatches( int inNumber, void *inKey ) {
+    return callgrindFiles.getElement( inNumber )->name == 
+        (const char*)inKey;
+    }
+
+
+
+static char callgrindFunctionMatches( int inNumber, void *inKey ) {
+    CallgrindFunction *a = callgrindFunctions.getElement( inNumber );
+    CallgrindFunction *b = (CallgrindFunction*)inKey;
+    
+    return a->name == b->name && a->file == b->file;
+    }
+
+
+
+static char callgrindCostMatches( int inNumber, void *inKey ) {
+    CallgrindCost *a = callgrindCosts.getElement( inNumber );
+    CallgrindCost *b = (CallgrindCost*)inKey;
+    
+    return a->function == b->function && a->line == b->line &&
+        a->callee == b->callee;
+    }
+
+
+
+// interns inName, returns its index in callgrindFiles
+static int getCallgrindFile( const char *inName ) {
+    if( inName == NULL || inName[0] == '\0' ) {
+        inName = "???";
+        }
+    inName = internString( inName, strlen( inName ) );
+    
+    unsigned int hash = hashBytes( (const char*)&inName, sizeof( inName ) );
+    
+    int found = findInHashIndex( &callgrindFileIndex, hash,
+                                 callgrindFileMatches, (void*)inName );
+    if( found != -1 ) {
+        return found;
+        }
+    
+    CallgrindFile f = { inName, false };
+    callgrindFiles.push_back( f );
+    addToHashIndex( &callgrindFileIndex, callgrindFiles.size() - 1, hash );
+    
+    return callgrindFiles.size() - 1;
+    }
+
+
+
+// returns inFrame's function's index in callgrindFunctions
+static int getCallgrindFunction( StackFrame *inFrame ) {
+    const char *name = inFrame->funcName;
+    if( name == NULL ) {
+        name = "??";
+        }
+    
+    CallgrindFunction f = { internString( name, strlen( name ) ),
+                            getCallgrindFile( inFrame->fileName ),
+                            inFrame->lineNum, false };
+    
+    if( f.firstLine < 0 ) {
+        f.firstLine = 0;
+        }
+    
+    uintptr_t parts[2] = { (uintptr_t)f.name, (uintptr_t)f.file };
+    unsigned int hash = hashBytes( (const char*)parts, sizeof( parts ) );
+    
+    int found = findInHashIndex( &callgrindFunctionIndex, hash,
+                                 callgrindFunctionMatches, &f );
+    if( found != -1 ) {
+        CallgrindFunction *old = callgrindFunctions.getElement( found );
+        
+        if( f.firstLine < old->firstLine ) {
+            old->firstLine = f.firstLine;
+            }
+        return found;
+        }
+    
+    callgrindFunctions.push_back( f );
+    addToHashIndex( &callgrindFunctionIndex, 
+                    callgrindFunctions.size() - 1, hash );
+    
+    return callgrindFunctions.size() - 1;
+    }
+
+
+
+static void addCallgrindCost( int inFunction, int inLine, int inCallee,
+                              int inCount, double inSeconds ) {
+    if( inLine < 0 ) {
+        inLine = 0;
+        }
+    
+    CallgrindCost c = { inFunction, inLine, inCallee, inCount, inSeconds };
+    
+    int parts[3] = { inFunction, inLine, inCallee };
+    unsigned int hash = hashBytes( (const char*)parts, sizeof( parts ) );
+    
+    int found = findInHashIndex( &callgrindCostIndex, hash,
+                                 callgrindCostMatches, &c );
+    if( found != -1 ) {
+        CallgrindCost *old = callgrindCosts.getElement( found );
+        old->sampleCount += inCount;
+        old->sampleSeconds += inSeconds;
+        return;
+        }
+    
+    callgrindCosts.push_back( c );
+    addToHashIndex( &callgrindCostIndex, callgrindCosts.size() - 1, hash );
+    }
+
+
+
+// by function, then line, with the samples that ended at a line before
+// the calls made from it
+static int compareCallgrindCosts( const void *inA, const void *inB ) {
+    CallgrindCost *a = (CallgrindCost*)inA;
+    CallgrindCost *b = (CallgrindCost*)inB;
+    
+    if( a->function != b->function ) {
+        return ( a->function < b->function ) ? -1 : 1;
+        }
+    if( a->line != b->line ) {
+        return ( a->line < b->line ) ? -1 : 1;
+        }
+    if( a->callee != b->callee ) {
+        return ( a->callee < b->callee ) ? -1 : 1;
+        }
+    return 0;
+    }
+
+
+
+// writes inPrefix and the file's number, and its name the first time
+static void writeCallgrindFile( FILE *inFile, const char *inPrefix, 
+                                int inIndex ) {
+    CallgrindFile *f = callgrindFiles.getElement( inIndex );
+    
+    if( f->written ) {
+        fprintf( inFile, "%s(%d)\n", inPrefix, inIndex + 1 );
+        }
+    else {
+        fprintf( inFile, "%s(%d) %s\n", inPrefix, inIndex + 1, f->name );
+        f->written = true;
+        }
+    }
+
+
+
+static void writeCallgrindFunction( FILE *inFile, const char *inPrefix, 
+                                    int inIndex ) {
+    CallgrindFunction *f = callgrindFunctions.getElement( inIndex );
+    
+    if( f->written ) {
+        fprintf( inFile, "%s(%d)\n", inPrefix, inIndex + 1 );
+        }
+    else {
+        fprintf( inFile, "%s(%d) %s\n", inPrefix, inIndex + 1, f->name );
+        f->written = true;
+        }
+    }
+
+
+
+// wall-clock time as callgrind's second event, in whole microseconds
+static long long getCallgrindMicroseconds( double inSeconds ) {
+    return llround( inSeconds * 1e6 );
+    }
+
+
+
+static void writeCallgrindProfile( const char *inFileName ) {
+    FILE *file = fopen( inFileName, "w" );
+    
+    if( file == NULL ) {
+        printf( "Could not open %s to write callgrind profile\n", 
+                inFileName );
+        return;
+        }
+    
+    int totalSamples = 0;
+    double totalSeconds = 0;
+    
+    SimpleVector<int> functionIDs;
+    
+    for( int i=0; i<stackLog.size(); i++ ) {
+        Stack *s = stackLog.getElement( i );
+        
+        if( s->sampleCount == 0 || s->frames.size() == 0 ) {
+            continue;
+            }
+        
+        totalSamples += s->sampleCount;
+        totalSeconds += s->sampleSeconds;
+        
+        functionIDs.deleteStartElements( functionIDs.size() );
+        
+        for( int f=0; f<s->frames.size(); f++ ) {
+            functionIDs.push_back( 
+                getCallgrindFunction( s->frames.getElement( f ) ) );
+            }
+        
+        // samples ended in the innermost frame
+        addCallgrindCost( functionIDs.getElementDirect( 0 ),
+                          s->frames.getElement( 0 )->lineNum, -1,
+                          s->sampleCount, s->sampleSeconds );
+        
+        // and went through a call at every other frame
+        for( int f=1; f<s->frames.size(); f++ ) {
+            addCallgrindCost( functionIDs.getElementDirect( f ),
+                              s->frames.getElement( f )->lineNum,
+                              functionIDs.getElementDirect( f - 1 ),
+                              s->sampleCount, s->sampleSeconds );
+            }
+        }
+    
+    freeHashIndex( &callgrindFileIndex );
+    freeHashIndex( &callgrindFunctionIndex );
+    freeHashIndex( &callgrindCostIndex );
+    
+    qsort( callgrindCosts.getElement( 0 ), callgrindCosts.size(),
+           sizeof( CallgrindCost ), compareCallgrindCosts );
+    
+    fprintf( file, 
+             "# callgrind format\n"
+             "version: 1\n"
+             "creator: wallClockProfiler\n"
+             "positions: line\n"
+             "event: Samples : Stack samples\n"
+             "event: Wall : Wall-clock microseconds\n"
+             "events: Samples Wall\n"
+             "summary: %d %lld\n",
+             totalSamples, getCallgrindMicroseconds( totalSeconds ) );
+    
+    int lastFunction = -1;
+    int lastFile = -1;
+    
+    for( int i=0; i<callgrindCosts.size(); i++ ) {
+        CallgrindCost *c = callgrindCosts.getElement( i );
+        
+        if( c->function != lastFunction ) {
+            int fileIndex = callgrindFunctions.getElement( c->function )->file;
+            
+            fprintf( file, "\n" );
+            
+            if( fileIndex != lastFile ) {
+                writeCallgrindFile( file, "fl=", fileIndex );
+                lastFile = fileIndex;
+                }
+            writeCallgrindFunction( file, "fn=", c->function );
+            lastFunction = c->function;
+            }
+        
+        if( c->callee != -1 ) {
+            CallgrindFunction *callee = 
+                callgrindFunctions.getElement( c->callee );
+            
+            writeCallgrindFile( file, "cfi=", callee->file );
+            writeCallgrindFunction( file, "cfn=", c->callee );
+            
+            // we don't see calls, only samples inside them, so the 
+            // call count is the sample count
+            fprintf( file, "calls=%d %d\n", c->sampleCount, 
+                     callee->firstLine );
+            }
+        fprintf( file, "%d %d %lld\n", c->line, c->sampleCount,
+                 getCallgrindMicroseconds( c->sampleSeconds ) );
+        }
+    
+    fprintf( file, "\ntotals: %d %lld\n", totalSamples, 
+             getCallgrindMicroseconds( totalSeconds ) );
+    
+    fclose( file );
+    
+    printf( "Wrote callgrind profile with %d functions and %d costs to %s\n",
+            callgrindFunctions.size(), callgrindCosts.size(), inFileName );
+    
+    callgrindFiles.deleteAll();
+    callgrindFunctions.deleteAll();
+    callgrindCosts.deleteAll();
+    }
+
+
+
+// **************************************
+// report order
+
+// A long attach to a big program can leave a million unique stacks.
+// Functions are added up through a hash table instead of a scan of the
+// ones found so far, and each report section is sorted by sorting 
+// small entries that point back at its records, with qsort.  With 
+// --top, a quickselect pass first picks out the entries that will be 
+// printed, and only those get sorted.
+
+
+// list at most this many entries in each report section, or -1 for all
+int reportTopCount = -1;
+
+
+typedef struct ReportEntry {
+        double sampleSeconds;
+        // index of the record in its unsorted vector, which breaks ties,
+        // so equal records are listed in the order they were first seen
+        int index;
+    } ReportEntry;
+
+
+
+// biggest first
+static int compareReportEntries( const void *inA, const void *inB ) {
+    ReportEntry *a = (ReportEntry*)inA;
+    ReportEntry *b = (ReportEntry*)inB;
+    
+    if( a->sampleSeconds > b->sampleSeconds ) {
+        return -1;
+        }
+    if( a->sampleSeconds < b->sampleSeconds ) {
+        return 1;
+        }
+    return a->index - b->index;
+    }
+
+
+
+static void swapReportEntries( ReportEntry *inEntries, int inA, int inB ) {
+    ReportEntry temp = inEntries[ inA ];
+    inEntries[ inA ] = inEntries[ inB ];
+    inEntries[ inB ] = temp;
+    }
+
+
+
+// sorts the inTopCount biggest entries to the front of inEntries, 
+// biggest first, leaving the rest after them in no particular order
+// inTopCount of -1 sorts them all
+// returns the number of entries sorted
+static int sortTopReportEntries( ReportEntry *inEntries, int inNumEntries,
+                                 int inTopCount ) {
+    if( inNumEntries == 0 ) {
+        return 0;
+        }
+    
+    int numToSort = inNumEntries;
+    
+    if( inTopCount >= 0 && inTopCount < inNumEntries ) {
+        numToSort = inTopCount;
+        
+        // quickselect, until the entry that belongs at numToSort is
+        // there, with everything bigger before it
+        int lo = 0;
+        int hi = inNumEntries - 1;
+        
+        while( lo < hi ) {
+            swapReportEntries( inEntries, lo + ( hi - lo ) / 2, hi );
+            
+            ReportEntry pivot = inEntries[ hi ];
+            int pivotPlace = lo;
+            
+            for( int i=lo; i<hi; i++ ) {
+                if( compareReportEntries( &( inEntries[i] ), &pivot ) < 0 ) {
+                    swapReportEntries( inEntries, i, pivotPlace );
+                    pivotPlace++;
+                    }
+                }
+            swapReportEntries( inEntries, pivotPlace, hi );
+            
+            if( pivotPlace == numToSort ) {
+                break;
+                }
+            else if( pivotPlace < numToSort ) {
+                lo = pivotPlace + 1;
+                }
+            else {
+                hi = pivotPlace - 1;
+                }
+            }
+        }
+    
+    qsort( inEntries, numToSort, sizeof( ReportEntry ), 
+           compareReportEntries );
+    
+    return numToSort;
+    }
+
+
+
+// entries for the stacks in inStacks with at least inMinSamples samples
+static void getStackReportEntries( SimpleVector<Stack> *inStacks,
+                                   int inMinSamples,
+                                   SimpleVector<ReportEntry> *outEntries ) {
+    for( int i=0; i<inStacks->size(); i++ ) {
+        Stack *s = inStacks->getElement( i );
+        
+        if( s->sampleCount >= inMinSamples ) {
+            ReportEntry e = { s->sampleSeconds, i };
+            outEntries->push_back( e );
+            }
+        }
+    }
+
+
+
+typedef struct FunctionLookup {
+        SimpleVector<FunctionRecord> *functions;
+        const char *funcName;
+    } FunctionLookup;
+
+
+
+static char functionMatches( int inNumber, void *inKey ) {
+    FunctionLookup *l = (FunctionLookup*)inKey;
+    
+    return strcmp( l->functions->getElement( inNumber )->funcName,
+                   l->funcName ) == 0;
+    }
+
+
+
+// adds up the samples of each function named in inStacks' frames
+// (once for each frame that names it), in the order they're first seen
+// names must already be resolved, and are borrowed from the frames
+static void getFunctionRecords( SimpleVector<Stack> *inStacks,
+                                SimpleVector<FunctionRecord> *outFunctions ) {
+    // names from different places (GDB, symbolCache) are separate
+    // copies, so they're matched by their contents
+    HashIndex index = { NULL, NULL, 0, 0 };
+    
+    FunctionLookup lookup;
+    lookup.functions = outFunctions;
+    
+    for( int i=0; i<inStacks->size(); i++ ) {
+        Stack *s = inStacks->getElement( i );
+        
+        for( int f=0; f<s->frames.size(); f++ ) {
+            char *funcName = s->frames.getElement( f )->funcName;
+            
+            unsigned int hash = hashBytes( funcName, strlen( funcName ) );
+            
+            lookup.funcName = funcName;
+            
+            int r = findInHashIndex( &index, hash, functionMatches, 
+                                     &lookup );
+            
+            if( r != -1 ) {
+                FunctionRecord *func = outFunctions->getElement( r );
+                func->sampleCount += s->sampleCount;
+                func->sampleSeconds += s->sampleSeconds;
+                }
+            else {
+                FunctionRecord newFunc = { funcName, s->sampleCount, 
+                                           s->sampleSeconds };
+                outFunctions->push_back( newFunc );
+                addToHashIndex( &index, outFunctions->size() - 1, hash );
+                }
+            }
+        }
+    
+    freeHashIndex( &index );
+    }
+
+
+
+// **************************************
+// source lines
+
+// Each printed stack shows the source text of its innermost line.  
+// Source files are mapped and indexed by line the first time one of
+// their lines is needed, so every line after that is a lookup.  Only
+// files with a known absolute path in sourcePaths are opened.  Lines 
+// from other files, or files we can't open ourselves (GDB knows more 
+// places to look for sources) are listed by GDB, all in one batch, 
+// before the report is printed, and kept too.
+
+
+typedef struct SourceFile {
+        // name as frames have it, borrowed from the first frame
+        const char *name;
+        // mapped file, or NULL data if we don't know its path, or 
+        // couldn't open it
+        MappedFile file;
+        // offset of the start of each line, plus one past the end
+        size_t *lineStarts;
+        int numLines;
+    } SourceFile;
+
+
+SimpleVector<SourceFile> sourceFiles;
+
+HashIndex sourceFileIndex = { NULL, NULL, 0, 0 };
+
+
+
+// lines of files that we couldn't open, listed by GDB
+typedef struct GDBSourceLine {
+        const char *fileName;
+        int lineNum;
+        char listed;
+        // NULL if GDB couldn't find it either
+        char *text;
+    } GDBSourceLine;
+
+
+SimpleVector<GDBSourceLine> gdbSourceLines;
+
+HashIndex gdbSourceLineIndex = { NULL, NULL, 0, 0 };
+
+
+// GDB stops reading a script at its first error, so don't make each
+// script too long
+#define SOURCE_LINE_BATCH_SIZE 100
+
+
+
+static char sourceFileMatches( int inNumber, void *inKey ) {
+    return strcmp( sourceFiles.getElement( inNumber )->name, 
+                   (const char*)inKey ) == 0;
+    }
+
+
+
+// finds, or maps and indexes, the source file called inName
+static SourceFile *getSourceFile( const char *inName ) {
+    unsigned int hash = hashBytes( inName, strlen( inName ) );
+    
+    int found = findInHashIndex( &sourceFileIndex, hash, 
+                                 sourceFileMatches, (void*)inName );
+    if( found != -1 ) {
+        return sourceFiles.getElement( found );
+        }
+    
+    SourceFile f;
+    f.name = inName;
+    f.file.data = NULL;
+    f.file.length = 0;
+    f.lineStarts = NULL;
+    f.numLines = 0;
+    
+    // a relative name would be opened relative to our own directory,
+    // not the one the target was built in
+    SourcePath *p = findSourcePath( inName );
+    
+    if( p != NULL && p->path != NULL &&
+        mapWholeFile( p->path, &( f.file ) ) ) {
+        const char *text = (const char*)f.file.data;
+        size_t length = f.file.length;
+        
+        f.numLines = 1;
+        
+        const char *c = text;
+        while( ( c = (const char*)memchr( c, '\n', 
+                                          &( text[ length ] ) - c ) ) 
+               != NULL ) {
+            c = &( c[1] );
+            if( c < &( text[ length ] ) ) {
+                f.numLines++;
+                }
+            }
+        
+        f.lineStarts = new size_t[ f.numLines + 1 ];
+        f.lineStarts[0] = 0;
+        
+        int line = 1;
+        for( size_t i=0; i<length && line < f.numLines; i++ ) {
+            if( text[i] == '\n' ) {
+                f.lineStarts[ line++ ] = i + 1;
+                }
+            }
+        f.lineStarts[ f.numLines ] = length;
+        }
+    
+    sourceFiles.push_back( f );
+    addToHashIndex( &sourceFileIndex, sourceFiles.size() - 1, hash );
+    
+    return sourceFiles.getLastElement();
+    }
+
+
+
+typedef struct SourceLineKey {
+        const char *fileName;
+        int lineNum;
+    } SourceLineKey;
+
+
+
+static unsigned int hashSourceLine( const char *inFileName, 
+                                    int inLineNum ) {
+    return hashBytes( inFileName, strlen( inFileName ) ) ^
+        ( (unsigned int)inLineNum * 2654435761U );
+    }
+
+
+
+static char gdbSourceLineMatches( int inNumber, void *inKey ) {
+    GDBSourceLine *l = gdbSourceLines.getElement( inNumber );
+    SourceLineKey *key = (SourceLineKey*)inKey;
+    
+    return l->lineNum == key->lineNum &&
+        strcmp( l->fileName, key->fileName ) == 0;
+    }
+
+
+
+static GDBSourceLine *findGDBSourceLine( const char *inFileName, 
+                                         int inLineNum ) {
+    SourceLineKey key = { inFileName, inLineNum };
+    
+    int found = findInHashIndex( &gdbSourceLineIndex,
+                                 hashSourceLine( inFileName, inLineNum ),
+                                 gdbSourceLineMatches, &key );
+    if( found == -1 ) {
+        return NULL;
+        }
+    return gdbSourceLines.getElement( found );
+    }
+
+
+
+// call this for each innermost frame that will be printed, before
+// listQueuedSourceLines
+static void queueSourceLine( StackFrame *inFrame ) {
+    if( inFrame->lineNum <= 0 || ! useGDB ) {
+        return;
+        }
+    
+    if( getSourceFile( inFrame->fileName )->file.data != NULL ||
+        findGDBSourceLine( inFrame->fileName, inFrame->lineNum ) != NULL ) {
+        return;
+        }
+    
+    GDBSourceLine l = { inFrame->fileName, inFrame->lineNum, false, NULL };
+    gdbSourceLines.push_back( l );
+    
+    addToHashIndex( &gdbSourceLineIndex, gdbSourceLines.size() - 1,
+                    hashSourceLine( inFrame->fileName, inFrame->lineNum ) );
+    }
+
+
+
+// lists lines inStart up to inEnd of gdbSourceLines through a GDB script
+// returns the number of lines that got to run before any error
+static int listSourceLineBatch( int inStart, int inEnd ) {
+    char scriptPath[] = "/tmp/wcSourceXXXXXX";
+    
+    int scriptFD = mkstemp( scriptPath );
+    
+    FILE *scriptFile = NULL;
+    
+    if( scriptFD != -1 ) {
+        scriptFile = fdopen( scriptFD, "w" );
+        }
+    
+    if( scriptFile == NULL ) {
+        if( scriptFD != -1 ) {
+            close( scriptFD );
+            unlink( scriptPath );
+            }
+        return inEnd - inStart;
+        }
+    
+    for( int i=inStart; i<inEnd; i++ ) {
+        GDBSourceLine *l = gdbSourceLines.getElement( i );
+        
+        fprintf( scriptFile, 
+                 "echo wcp-line %d\\n\n"
+                 "list %s:%d,%d\n",
+                 i, l->fileName, l->lineNum, l->lineNum );
+        }
+    fclose( scriptFile );
+    
+    char *command = autoSprintf( "source %s", scriptPath );
+    sendCommand( command );
+    delete [] command;
+    
+    char *response = getGDBResponse();
+    char *text = getConsoleStreamText( response );
+    delete [] response;
+    
+    unlink( scriptPath );
+    
+    int numLines;
+    char **lines = split( text, "\n", &numLines );
+    delete [] text;
+    
+    GDBSourceLine *current = NULL;
+    int numRun = 0;
+    
+    for( int i=0; i<numLines; i++ ) {
+        int index;
+        
+        if( sscanf( lines[i], "wcp-line %d", &index ) == 1 ) {
+            current = NULL;
+            if( index >= inStart && index < inEnd ) {
+                current = gdbSourceLines.getElement( index );
+                current->listed = true;
+                numRun = index - inStart + 1;
+                }
+            }
+        else if( current != NULL && current->text == NULL ) {
+            // looks like:
+            // 42\t    int x = 5;
+            char *tabPos = strstr( lines[i], "\t" );
+            
+            // if name present in line, it's a not-found error
+            if( tabPos != NULL && 
+                atoi( lines[i] ) == current->lineNum &&
+                strstr( tabPos, current->fileName ) == NULL ) {
+                
+                current->text = stringDuplicate( &( tabPos[1] ) );
+                }
+            }
+        delete [] lines[i];
+        }
+    delete [] lines;
+    
+    return numRun;
+    }
+
+
+
+// has GDB list all queued lines that haven't been listed yet
+static void listQueuedSourceLines() {
+    int start = 0;
+    
+    while( start < gdbSourceLines.size() ) {
+        if( gdbSourceLines.getElement( start )->listed ) {
+            start++;
+            continue;
+            }
+        
+        int end = start + SOURCE_LINE_BATCH_SIZE;
+        if( end > gdbSourceLines.size() ) {
+            end = gdbSourceLines.size();
+            }
+        
+        int numRun = listSourceLineBatch( start, end );
+        
+        if( numRun == 0 ) {
+            // script didn't run at all, don't try again
+            numRun = end - start;
+            }
+        
+        // the last one run may have hit an error, and stopped the rest
+        // of the script, so skip it and go on with the ones after it
+        for( int i=start; i<start + numRun; i++ ) {
+            gdbSourceLines.getElement( i )->listed = true;
+            }
+        start += numRun;
+        }
+    }
+
+
+
+// source text of line inLineNum of inFileName, with leading spaces
+// trimmed
+// lines from mapped files aren't \0-terminated, so outLength is set
+// returns NULL if the line can't be found
+static const char *getSourceLine( const char *inFileName, int inLineNum,
+                                  int *outLength ) {
+    if( inLineNum <= 0 ) {
+        return NULL;
+        }
+    
+    const char *start;
+    const char *end;
+    
+    SourceFile *f = getSourceFile( inFileName );
+    
+    if( f->file.data != NULL ) {
+        if( inLineNum > f->numLines ) {
+            return NULL;
+            }
+        const char *text = (const char*)f->file.data;
+        
+        start = &( text[ f->lineStarts[ inLineNum - 1 ] ] );
+        end = &( text[ f->lineStarts[ inLineNum ] ] );
+        }
+    else {
+        GDBSourceLine *l = findGDBSourceLine( inFileName, inLineNum );
+        
+        if( l == NULL || l->text == NULL ) {
+            return NULL;
+            }
+        start = l->text;
+        end = &( start[ strlen( start ) ] );
+        }
+    
+    while( start < end && ( start[0] == ' ' || start[0] == '\t' ) ) {
+        start = &( start[1] );
+        }
+    while( end > start && 
+           ( end[-1] == '\n' || end[-1] == '\r' ) ) {
+        end = &( end[-1] );
+        }
+    
+    *outLength = end - start;
+    return start;
+    }
+
+
+
+static void freeSourceLines() {
+    for( int i=0; i<sourceFiles.size(); i++ ) {
+        SourceFile *f = sourceFiles.getElement( i );
+        
+        if( f->file.data != NULL ) {
+            munmap( f->file.data, f->file.length );
+            delete [] f->lineStarts;
+            }
+        }
+    sourceFiles.deleteAll();
+    freeHashIndex( &sourceFileIndex );
+    
+    for( int i=0; i<gdbSourceLines.size(); i++ ) {
+        GDBSourceLine *l = gdbSourceLines.getElement( i );
+        
+        if( l->text != NULL ) {
+            delete [] l->text;
+            }
+        }
+    gdbSourceLines.deleteAll();
+    freeHashIndex( &gdbSourceLineIndex );
+    }
+
+
+
+// percentages are of inTotalSeconds of sampled wall-clock time
+void printStack( Stack *inStack, double inTotalSeconds ) {
+    Stack *s = inStack;
+    
+    printf( "%7.3f%% ===================================== (%d samples)",
+            100 * s->sampleSeconds / inTotalSeconds,
+            s->sampleCount );
+    
+    if( s->threadIndex >= 0 ) {
+        ThreadRecord *t = threadLog.getElement( s->threadIndex );
+        printf( "  [thread %d \"%s\"]", t->id, t->name );
+        }
+    
+    if( s->onCPUFraction >= 0 ) {
+        printf( "  [%.1f%% on-CPU, %.1f%% off-CPU]", 
+                100 * s->onCPUFraction, 100 * ( 1 - s->onCPUFraction ) );
+        }
+    
+    printf( "\n"
+            "       %3d: %s   (at %s:%d)\n", 
+            1,
+            s->frames.getElement( 0 )->funcName, 
+            s->frames.getElement( 0 )->fileName, 
+            s->frames.getElement( 0 )->lineNum );
+
+    StackFrame *sf = s->frames.getElement( 0 );
+    
+    int lineLength;
+    const char *line = getSourceLine( sf->fileName, sf->lineNum, 
+                                      &lineLength );
+    
+    if( line != NULL ) {
+        printf( "            %d:|   %.*s\n", 
+                sf->lineNum, lineLength, line );
+        }
+    
+
+    // print stack for context below
+    for( int j=1; j<s->frames.size(); j++ ) {
+        StackFrame f = s->frames.getElementDirect( j );
+        printf( "       %3d: %s   (at %s:%d)\n", 
+                j + 1,
+                f.funcName, 
+                f.fileName, 
+                f.lineNum );
+        }
+    printf( "\n\n" );
+    }
+
+
+
+
+
+// no more stacks coming in, and the report shuffles stacks around
+static void finishStackLogs() {
+    for( int i=0; i<stackLog.size(); i++ ) {
+        int treeNode = stackLogTreeNodes.getElementDirect( i );
+        
+        if( treeNode != -1 ) {
+            Stack *s = stackLog.getElement( i );
+            addCallTreeSamples( treeNode, s->sampleCount, 
+                                s->sampleSeconds );
+            }
+        }
+    
+    freeHashIndex( &stackLogIndex );
+    freeHashIndex( &perfStackLogIndex );
+    freeHashIndex( &callTreeChildIndex );
+    freeHashIndex( &frameTableIndex );
+    stackLogTreeNodes.deleteAll();
+    
+    expandStackFrames( &stackLog, &stackLogKeys );
+    expandStackFrames( &perfStackLog, &perfStackLogKeys );
+    }
+
+
+
+// prints the report for everything sampled (or read from a sample log),
+// and frees it all
+static void printReport( int inNumSamples, double inRequestedRate, 
+                         double inSamplingSeconds ) {
+    printf( "%d stack samples taken\n", inNumSamples );
+
+    printf( "%d unique stacks sampled\n", stackLog.size() );
+
+    // when sampling all threads, each stop produces several samples
+    int numReportSamples = inNumSamples;
+    
+    if( sampleAllThreads ) {
+        numReportSamples = 0;
+        for( int i=0; i<threadLog.size(); i++ ) {
+            numReportSamples += threadLog.getElement( i )->sampleCount;
+            }
+        printf( "%d thread stacks sampled from %d threads\n",
+                numReportSamples, threadLog.size() );
+        }
+    
+    // samples aren't evenly spaced, so each one counts for the time
+    // since the one before it
+    double reportSeconds = 0;
+    
+    for( int i=0; i<stackLog.size(); i++ ) {
+        reportSeconds += stackLog.getElement( i )->sampleSeconds;
+        }
+    
+    printSamplingStats( inRequestedRate, inSamplingSeconds );
+
+    if( usePerf ) {
+        printf( "%d on-CPU samples taken (%.3f CPU seconds)\n",
+                numPerfSamples, 
+                numPerfSamples * PERF_SAMPLE_PERIOD_NS / 1000000000.0 );
+        
+        if( perfLostCount > 0 ) {
+            printf( "%ld on-CPU samples lost\n", perfLostCount );
+            }
+        }
+
+    resolveFrameNames();
+    
+    // all the names are known now, so the sample log is complete
+    logSymbolRecords();
+    closeSampleLog();
+    
+    // before the report reorders stackLog
+    if( timelineFileName != NULL ) {
+        writeTimeline( timelineFileName );
+        }
+    if( pprofFileName != NULL ) {
+        writePprofProfile( pprofFileName, inRequestedRate, 
+                           inSamplingSeconds );
+        }
+    if( foldedFileName != NULL ) {
+        writeFoldedStacks( foldedFileName );
+        }
+    if( flameGraphFileName != NULL ) {
+        writeFlameGraph( flameGraphFileName );
+        }
+    if( callgrindFileName != NULL ) {
+        writeCallgrindProfile( callgrindFileName );
+        }
+    
+    SimpleVector<Stack> *rootStacks = 
+        new SimpleVector<Stack>[ reportRootDepth + 1 ];
+    
+    getPartialStacks( reportRootDepth, rootStacks );
+    
+    if( usePerf ) {
+        labelOnCPUFractions( &stackLog, false );
+        
+        for( int r=1; r<=reportRootDepth; r++ ) {
+            labelOnCPUFractions( &( rootStacks[r] ), true );
+            }
+        }
+
+
+    SimpleVector<FunctionRecord> functions;
+    
+    getFunctionRecords( &stackLog, &functions );
+    
+    SimpleVector<ReportEntry> functionEntries;
+    
+    for( int i=0; i<functions.size(); i++ ) {
+        FunctionRecord *f = functions.getElement( i );
+        
+        if( f->sampleCount > 1 ) {
+            ReportEntry e = { f->sampleSeconds, i };
+            functionEntries.push_back( e );
+            }
+        }
+    
+    int numFunctionsToPrint = 
+        sortTopReportEntries( functionEntries.getElement( 0 ),
+                              functionEntries.size(), reportTopCount );
+    
+    
+    SimpleVector<ReportEntry> stackEntries;
+    
+    getStackReportEntries( &stackLog, 1, &stackEntries );
+    
+    int numStacksToPrint = 
+        sortTopReportEntries( stackEntries.getElement( 0 ),
+                              stackEntries.size(), reportTopCount );
+    
+    
+    SimpleVector<ReportEntry> *rootStackEntries = 
+        new SimpleVector<ReportEntry>[ reportRootDepth + 1 ];
+    
+    int *numRootStacksToPrint = new int[ reportRootDepth + 1 ];
+    
+    for( int r=1; r<=reportRootDepth; r++ ) {
+        getStackReportEntries( &( rootStacks[r] ), 2, 
+                               &( rootStackEntries[r] ) );
+        
+        numRootStacksToPrint[r] =
+            sortTopReportEntries( rootStackEntries[r].getElement( 0 ),
+                                  rootStackEntries[r].size(), 
+                                  reportTopCount );
+        }
+    
+    
+    // source lines for all the stacks that will be printed, so any
+    // that GDB has to list are listed together
+    for( int r=1; r<=reportRootDepth; r++ ) {
+        for( int i=0; i<numRootStacksToPrint[r]; i++ ) {
+            Stack *s = rootStacks[r].getElement( 
+                rootStackEntries[r].getElement( i )->index );
+            queueSourceLine( s->frames.getElement( 0 ) );
+            }
+        }
+    for( int i=0; i<numStacksToPrint; i++ ) {
+        Stack *s = stackLog.getElement( stackEntries.getElement( i )->index );
+        queueSourceLine( s->frames.getElement( 0 ) );
+        }
+    
+    listQueuedSourceLines();
+    
+    
+    printf( "\n\n\nReport:\n\n" );
+
+    if( sampleAllThreads ) {
+        printf( "\n\n\nThreads:\n\n" );
+        
+        // few threads, simple selection sort
+        SimpleVector<ThreadRecord> threadsLeft = threadLog;
+        
+        while( threadsLeft.size() > 0 ) {
+            int maxInd = 0;
+            for( int i=1; i<threadsLeft.size(); i++ ) {
+                if( threadsLeft.getElement( i )->sampleSeconds >
+                    threadsLeft.getElement( maxInd )->sampleSeconds ) {
+                    maxInd = i;
+                    }
+                }
+            ThreadRecord t = threadsLeft.getElementDirect( maxInd );
+            threadsLeft.deleteElement( maxInd );
+            
+            if( t.sampleCount == 0 ) {
+                continue;
+                }
+            
+            printf( "%7.3f%% ===================================== "
+                    "(%d samples)\n"
+                    "         thread %d \"%s\"\n\n\n",
+                    100 * t.sampleSeconds / reportSeconds,
+                    t.sampleCount,
+                    t.id, t.name );
+            }
+        }
+
+    printf( "\n\n\nFunctions "
+            "with more than one sample:\n\n" );
+
+    for( int i=0; i<numFunctionsToPrint; i++ ) {
+        FunctionRecord f = functions.getElementDirect( 
+            functionEntries.getElement( i )->index );
+        
+        printf( "%7.3f%% ===================================== (%d samples)\n"
+                "         %s\n\n\n",
+                100 * f.sampleSeconds / reportSeconds,
+                f.sampleCount,
+                f.funcName );
+        }
+                
+
+
+    for( int r=1; r<=reportRootDepth; r++ ) {
+        if( numRootStacksToPrint[r] > 0 ) {
+            
+            printf( "\n\n\nPartial stacks of depth [%d] "
+                    "with more than one sample:\n\n", r );
+            
+            for( int i=0; i<numRootStacksToPrint[r]; i++ ) {
+                printStack( rootStacks[r].getElement( 
+                                rootStackEntries[r].getElement( i )->index ),
+                            reportSeconds );
+                }
+            }
+        }
     
+    
+    printf( "\n\n\nFull stacks "
+            "with at least one sample:\n\n" );
+    
+    for( int i=0; i<numStacksToPrint; i++ ) {
+        printStack( stackLog.getElement( 
+                        stackEntries.getElement( i )->index ),
+                    reportSeconds );
+        }
 
-static StackFrame parseFrame( char *inFrameString ) {
-    StackFrame newF;
+    for( int i=0; i<stackLog.size(); i++ ) {
+        freeStack( stackLog.getElement( i ) );
+        }
     
-    char *openPos = strstr( inFrameString, "{" );
+    delete [] rootStacks;
+    delete [] rootStackEntries;
+    delete [] numRootStacksToPrint;
+
+    for( int i=0; i<symbolCache.size(); i++ ) {
+        SymbolInfo *info = symbolCache.getElement( i );
+        delete [] info->funcName;
+        delete [] info->fileName;
+        }
     
-    if( openPos == NULL ) {
-        printf( "Error parsing stack frame:  %s\n", inFrameString );
-        exit( 1 );
+    freeSymbolFiles();
+    freeSourceLines();
+    freeSourcePaths();
+    
+    for( int i=0; i<perfStackLog.size(); i++ ) {
+        perfStackLog.getElement( i )->frames.deleteAll();
         }
-    openPos = &( openPos[1] );
     
-    char *closePos = strstr( openPos, "}" );
+    frameTable.deleteAll();
+    freeInternedNames();
     
-    if( closePos == NULL ) {
-        printf( "Error parsing stack frame:  %s\n", inFrameString );
-        exit( 1 );
+    for( int i=0; i<threadLog.size(); i++ ) {
+        delete [] threadLog.getElement( i )->name;
         }
-    closePos[0] ='\0';
+    }
+
+
+
+// **************************************
+// differential profiles
+
+// --diff compares two sample logs, say from before and after a change.
+// Addresses move between builds and between runs (ASLR), so frames are
+// matched by function name and file:line instead (just the file's name,
+// since the two builds may come from different checkouts).  Each log is loaded 
+// in a child process, with the same code --report uses, and the child
+// hands back its stacks by name, so the profiles don't share any of the
+// global state that loading uses.  Time is compared as a share of each
+// profile's total, since the runs needn't be the same length, and each
+// change comes with how likely it is to be sampling noise.
+
+
+// changes with a higher p-value than this are marked as possible noise
+#define DIFF_SIGNIFICANCE 0.01
+
+
+// a frame as either profile names it, with interned strings
+typedef struct DiffFrame {
+        const char *funcName;
+        // NULL if unknown
+        const char *fileName;
+        int lineNum;
+    } DiffFrame;
+
+
+// a stack or a function, with its samples in the before [0] and the
+// after [1] profile
+typedef struct DiffRecord {
+        // frames are in diffFrames, innermost first
+        // a function just has one, with its name
+        int firstFrame;
+        int numFrames;
+        int sampleCount[2];
+        double sampleSeconds[2];
+        // last stack that was counted for this function, so a function
+        // that recurses is only counted once per stack
+        int lastStack;
+    } DiffRecord;
+
+
+SimpleVector<DiffFrame> diffFrames;
+
+SimpleVector<DiffRecord> diffStacks;
+SimpleVector<DiffRecord> diffFunctions;
+
+HashIndex diffStackIndex = { NULL, NULL, 0, 0 };
+HashIndex diffFunctionIndex = { NULL, NULL, 0, 0 };
+
+int diffTotalCount[2] = { 0, 0 };
+double diffTotalSeconds[2] = { 0, 0 };
+
+// stack records read so far from both profiles, used to number them,
+// since stack records can be merged, and some have no samples
+int diffStacksRead = 0;
+
+
+
+// child's side of loading a profile
+// writes each stack in inLogName to inFile as a line with its samples,
+// seconds and number of frames, then a line with each frame's name 
+// length, file name length (-1 if unknown) and line number, followed by
+// the names themselves
+static void writeDiffStacks( const char *inLogName, FILE *inFile ) {
+    SampleLogSummary summary;
     
-    int numVals;
-    char **vals = split( openPos, ",", &numVals );
+    if( ! readSampleLog( inLogName, &summary ) ) {
+        fflush( stdout );
+        _exit( 1 );
+        }
     
-    void *address = NULL;
+    finishStackLogs();
+    resolveFrameNames();
     
-    for( int i=0; i<numVals; i++ ) {
-        if( strstr( vals[i], "addr=" ) == vals[i] ) {
-            sscanf( vals[i], "addr=\"%p\"", &address );
-            break;
+    for( int i=0; i<stackLog.size(); i++ ) {
+        Stack *s = stackLog.getElement( i );
+        
+        fprintf( inFile, "%d %.17g %d\n",
+                 s->sampleCount, s->sampleSeconds, s->frames.size() );
+        
+        for( int f=0; f<s->frames.size(); f++ ) {
+            StackFrame *sf = s->frames.getElement( f );
+            
+            const char *funcName = sf->funcName;
+            if( funcName == NULL ) {
+                funcName = "??";
+                }
+            
+            int fileLength = -1;
+            if( sf->fileName != NULL ) {
+                fileLength = strlen( sf->fileName );
+                }
+            
+            fprintf( inFile, "%d %d %d\n%s%s", 
+                     (int)strlen( funcName ), fileLength, sf->lineNum,
+                     funcName, 
+                     ( sf->fileName != NULL ) ? sf->fileName : "" );
             }
         }
-
-    newF.address = address;
-    newF.lineNum = -1;
-    newF.funcName = NULL;
-    newF.fileName = NULL;
     
-    for( int i=0; i<numVals; i++ ) {
-        if( strstr( vals[i], "func=" ) == vals[i] ) {
-            newF.funcName = new char[ 500 ];
-            sscanf( vals[i], "func=\"%499s\"", newF.funcName );
-            }
-        else if( strstr( vals[i], "file=" ) == vals[i] ) {
-            newF.fileName = new char[ 500 ];
-            sscanf( vals[i], "file=\"%499s\"", newF.fileName );
-            }
-        else if( strstr( vals[i], "line=" ) == vals[i] ) {
-            sscanf( vals[i], "line=\"%d\"", &newF.lineNum );
-            }
+    fflush( inFile );
+    fflush( stdout );
+    _exit( 0 );
+    }
+
+
+
+// reads inLength chars from inFile, and interns them
+// returns NULL if inLength is -1, or on a short read
+static const char *readDiffString( FILE *inFile, int inLength ) {
+    if( inLength < 0 ) {
+        return NULL;
         }
     
-    if( newF.fileName == NULL ) {
-        newF.fileName = stringDuplicate( "" );
+    char *buffer = new char[ inLength + 1 ];
+    
+    const char *result = NULL;
+    
+    if( (int)fread( buffer, 1, inLength, inFile ) == inLength ) {
+        result = internString( buffer, inLength );
         }
-    if( newF.funcName == NULL ) {
-        newF.funcName = stringDuplicate( "" );
+    
+    delete [] buffer;
+    
+    return result;
+    }
+
+
+
+typedef struct DiffStackKey {
+        DiffFrame *frames;
+        int numFrames;
+    } DiffStackKey;
+
+
+
+// names are interned, so frames can be hashed and compared by pointer
+static unsigned int hashDiffFrames( DiffFrame *inFrames, int inNumFrames ) {
+    unsigned int h = 2166136261U;
+    
+    for( int i=0; i<inNumFrames; i++ ) {
+        h = ( h ^ (unsigned int)(uintptr_t)inFrames[i].funcName ) * 16777619U;
+        h = ( h ^ (unsigned int)(uintptr_t)inFrames[i].fileName ) * 16777619U;
+        h = ( h ^ (unsigned int)inFrames[i].lineNum ) * 16777619U;
         }
+    return h;
+    }
+
+
+
+static char diffStackMatches( int inNumber, void *inKey ) {
+    DiffStackKey *key = (DiffStackKey*)inKey;
+    DiffRecord *r = diffStacks.getElement( inNumber );
     
-    char *quotePos = strstr( newF.fileName, "\"" );
-    if( quotePos != NULL ) {
-        quotePos[0] ='\0';
+    if( r->numFrames != key->numFrames ) {
+        return false;
         }
-    quotePos = strstr( newF.funcName, "\"" );
-    if( quotePos != NULL ) {
-        quotePos[0] ='\0';
+    
+    for( int i=0; i<r->numFrames; i++ ) {
+        DiffFrame *a = diffFrames.getElement( r->firstFrame + i );
+        DiffFrame *b = &( key->frames[i] );
+        
+        if( a->funcName != b->funcName || a->fileName != b->fileName ||
+            a->lineNum != b->lineNum ) {
+            return false;
+            }
         }
+    return true;
+    }
 
 
-    for( int i=0; i<numVals; i++ ) {
-        delete [] vals[i];
-        }
-    delete [] vals;
 
-    return newF;
+static char diffFunctionMatches( int inNumber, void *inKey ) {
+    DiffRecord *r = diffFunctions.getElement( inNumber );
+    
+    return diffFrames.getElement( r->firstFrame )->funcName == inKey;
     }
 
 
 
-static void logGDBStackResponse() {
-    int numRead = fillBufferWithResponse();
+// finds the record for the frames at inFrames in inRecords, adding it
+// (and a copy of the frames) if needed
+static DiffRecord *getDiffRecord( SimpleVector<DiffRecord> *inRecords,
+                                  HashIndex *inIndex, unsigned int inHash,
+                                  char (*inMatches)( int inNumber, 
+                                                     void *inKey ),
+                                  void *inKey,
+                                  DiffFrame *inFrames, int inNumFrames ) {
+    int found = findInHashIndex( inIndex, inHash, inMatches, inKey );
     
-    if( numRead == 0 ) {
-        return;
+    if( found != -1 ) {
+        return inRecords->getElement( found );
         }
     
-    log( "logGDBStackResponse sees", readBuff );
-
-    checkProgramExited();
-        
-    if( programExited ) {
-        return;
+    DiffRecord r = { diffFrames.size(), inNumFrames, { 0, 0 }, { 0, 0 }, 
+                     -1 };
+    
+    for( int i=0; i<inNumFrames; i++ ) {
+        diffFrames.push_back( inFrames[i] );
         }
     
-    const char *stackStartMarker = ",stack=[";
+    inRecords->push_back( r );
+    addToHashIndex( inIndex, inRecords->size() - 1, inHash );
     
-    char *stackStartPos = strstr( readBuff, ",stack=[" );
-        
-    if( stackStartPos == NULL ) {
-        return;
+    return inRecords->getElement( inRecords->size() - 1 );
+    }
+
+
+
+// loads the sample log inLogName as profile inSide (0 before, 1 after)
+// stacks are also added to the flame graph, if there is one
+// returns false if the log couldn't be read
+static char loadDiffProfile( const char *inLogName, int inSide ) {
+    FILE *file = tmpfile();
+    
+    if( file == NULL ) {
+        printf( "Could not make a temporary file to load %s\n", 
+                inLogName );
+        return false;
         }
     
-    char *stackStart = &( stackStartPos[ strlen( stackStartMarker ) ] );
+    // so the child doesn't print our buffered output again
+    fflush( stdout );
     
-    char *closeBracket = strstr( stackStart, "]\n" );
+    int childPID = fork();
     
-    if( closeBracket == NULL ) {
-        return;
+    if( childPID == -1 ) {
+        printf( "Could not fork to load %s\n", inLogName );
+        fclose( file );
+        return false;
+        }
+    else if( childPID == 0 ) {
+        writeDiffStacks( inLogName, file );
         }
     
-    // terminate at close
-    closeBracket[0] = '\0';
+    int status;
+    waitpid( childPID, &status, 0 );
     
-    const char *frameMarker = "frame=";
+    if( ! WIFEXITED( status ) || WEXITSTATUS( status ) != 0 ) {
+        fclose( file );
+        return false;
+        }
     
-    if( strstr( stackStart, frameMarker ) != stackStart ) {
-        return;
+    rewind( file );
+    
+    // the stack being read
+    SimpleVector<DiffFrame> frames;
+    
+    int count, numFrames;
+    double seconds;
+    
+    while( fscanf( file, "%d %lf %d", &count, &seconds, &numFrames ) == 3 ) {
+        frames.deleteAll();
+        
+        for( int f=0; f<numFrames; f++ ) {
+            int funcLength, fileLength;
+            DiffFrame frame;
+            
+            if( fscanf( file, "%d %d %d", 
+                        &funcLength, &fileLength, &frame.lineNum ) != 3 ||
+                fgetc( file ) != '\n' ) {
+                break;
+                }
+            
+            frame.funcName = readDiffString( file, funcLength );
+            frame.fileName = readDiffString( file, fileLength );
+            
+            // builds from different checkouts have different paths
+            if( frame.fileName != NULL ) {
+                const char *slash = strrchr( frame.fileName, '/' );
+                if( slash != NULL ) {
+                    frame.fileName = internString( slash + 1, 
+                                                   strlen( slash + 1 ) );
+                    }
+                }
+            
+            if( frame.funcName == NULL ) {
+                break;
+                }
+            frames.push_back( frame );
+            }
+        
+        if( frames.size() != numFrames || numFrames == 0 ) {
+            printf( "Stacks loaded from %s are cut off\n", inLogName );
+            fclose( file );
+            return false;
+            }
+        
+        DiffFrame *stackFrames = frames.getElement( 0 );
+        
+        DiffStackKey key = { stackFrames, numFrames };
+        
+        DiffRecord *s = getDiffRecord( 
+            &diffStacks, &diffStackIndex, 
+            hashDiffFrames( stackFrames, numFrames ), 
+            diffStackMatches, &key, stackFrames, numFrames );
+        
+        s->sampleCount[ inSide ] += count;
+        s->sampleSeconds[ inSide ] += seconds;
+        
+        int stackNumber = diffStacksRead++;
+        
+        for( int f=0; f<numFrames; f++ ) {
+            const char *name = stackFrames[f].funcName;
+            DiffFrame nameFrame = { name, NULL, 0 };
+            
+            DiffRecord *fr = getDiffRecord(
+                &diffFunctions, &diffFunctionIndex,
+                hashDiffFrames( &nameFrame, 1 ),
+                diffFunctionMatches, (void*)name, &nameFrame, 1 );
+            
+            if( fr->lastStack != stackNumber ) {
+                fr->lastStack = stackNumber;
+                fr->sampleCount[ inSide ] += count;
+                fr->sampleSeconds[ inSide ] += seconds;
+                }
+            }
+        
+        if( flameGraphFileName != NULL ) {
+            int node = -1;
+            for( int f = numFrames - 1; f >= 0; f-- ) {
+                node = getFlameNode( node, stackFrames[f].funcName );
+                }
+            if( inSide == 0 ) {
+                addFlameSamples( node, 0, 0, seconds );
+                }
+            else {
+                addFlameSamples( node, count, seconds, 0 );
+                }
+            }
+        
+        diffTotalCount[ inSide ] += count;
+        diffTotalSeconds[ inSide ] += seconds;
         }
     
-    // skip first
-    stackStart = &( stackStart[ strlen( frameMarker ) ] );
+    fclose( file );
     
-    int numFrames;
-    char **frames = split( stackStart, frameMarker, &numFrames );
-
-    Stack thisStack;
-    thisStack.sampleCount = 1;
-    for( int i=0; i<numFrames; i++ ) {
-        thisStack.frames.push_back( parseFrame( frames[i] ) );
-        delete [] frames[i];
+    if( diffTotalCount[ inSide ] == 0 ) {
+        printf( "No stacks sampled in %s\n", inLogName );
+        return false;
         }
-    delete [] frames;
+    return true;
+    }
+
+
 
+// how much of its profile's time inRecord took, after minus before
+static double getDiffChange( DiffRecord *inRecord ) {
+    return inRecord->sampleSeconds[1] / diffTotalSeconds[1] -
+        inRecord->sampleSeconds[0] / diffTotalSeconds[0];
+    }
+
+
+
+// chance of a change in share at least this big between two profiles
+// of the same code, from a two-proportion z-test on the sample counts
+static double getDiffPValue( DiffRecord *inRecord ) {
+    double n0 = diffTotalCount[0];
+    double n1 = diffTotalCount[1];
     
-    char match = false;
-    Stack insertedStack = thisStack;
+    double pooled = ( inRecord->sampleCount[0] + inRecord->sampleCount[1] ) 
+        / ( n0 + n1 );
     
-    for( int i=0; i<stackLog.size(); i++ ) {
-        Stack *inOld = stackLog.getElement( i );
+    double variance = pooled * ( 1 - pooled ) * ( 1 / n0 + 1 / n1 );
+    
+    if( variance <= 0 ) {
+        // in none or all of the samples of both
+        return 1;
+        }
+    
+    double z = ( inRecord->sampleCount[1] / n1 - 
+                 inRecord->sampleCount[0] / n0 ) / sqrt( variance );
+    
+    return erfc( fabs( z ) / sqrt( 2.0 ) );
+    }
+
+
+
+// sorts the records with at least inMinSamples samples between the two
+// profiles by the size of their change, and returns how many to print
+static int sortDiffRecords( SimpleVector<DiffRecord> *inRecords,
+                            int inMinSamples,
+                            SimpleVector<ReportEntry> *outEntries ) {
+    for( int i=0; i<inRecords->size(); i++ ) {
+        DiffRecord *r = inRecords->getElement( i );
         
-        if( stackCompare( inOld, &thisStack ) ) {
-            match = true;
-            inOld->sampleCount++;
-            insertedStack = *inOld;
-            break;
+        if( r->sampleCount[0] + r->sampleCount[1] >= inMinSamples ) {
+            ReportEntry e = { fabs( getDiffChange( r ) ), i };
+            outEntries->push_back( e );
             }
         }
     
-    if( match ) {
-        freeStack( &thisStack );
+    return sortTopReportEntries( outEntries->getElement( 0 ), 
+                                 outEntries->size(), reportTopCount );
+    }
+
+
+
+static void printDiffRecordHeader( DiffRecord *inRecord ) {
+    double pValue = getDiffPValue( inRecord );
+    
+    printf( "%+7.3f%% ===================================== "
+            "(%.3f%% -> %.3f%%, %d -> %d samples, ",
+            100 * getDiffChange( inRecord ),
+            100 * inRecord->sampleSeconds[0] / diffTotalSeconds[0],
+            100 * inRecord->sampleSeconds[1] / diffTotalSeconds[1],
+            inRecord->sampleCount[0], inRecord->sampleCount[1] );
+    
+    if( pValue < 0.001 ) {
+        printf( "p < 0.001)" );
         }
     else {
-        stackLog.push_back( thisStack );
+        printf( "p = %.3f)", pValue );
+        }
+    
+    if( pValue >= DIFF_SIGNIFICANCE ) {
+        printf( "  [could be noise]" );
         }
+    printf( "\n" );
+    }
 
-    // now look at roots of inserted stack
-    for( int i=1; 
-         i< insertedStack.frames.size() && 
-             i < NUM_ROOT_STACKS_TO_TRACK; 
-         i++ ) {
+
+
+// prints how the profile in inAfterLogName differs from the one in 
+// inBeforeLogName, and draws the differential flame graph
+// returns false if either log couldn't be loaded
+static char printDiffReport( const char *inBeforeLogName, 
+                             const char *inAfterLogName ) {
+    
+    char loaded = loadDiffProfile( inBeforeLogName, 0 ) &&
+        loadDiffProfile( inAfterLogName, 1 );
+    
+    if( loaded ) {
+        printf( "Before: %d stack samples (%.3f seconds) in %s\n",
+                diffTotalCount[0], diffTotalSeconds[0], inBeforeLogName );
+        printf( "After:  %d stack samples (%.3f seconds) in %s\n",
+                diffTotalCount[1], diffTotalSeconds[1], inAfterLogName );
+        printf( "Changes are in share of each profile's sampled time\n" );
         
-        Stack rootStack = getRoot( insertedStack, i );
+        if( flameGraphFileName != NULL ) {
+            drawFlameGraph( flameGraphFileName, diffTotalCount[1], 
+                            diffTotalSeconds[1], diffTotalSeconds[0] );
+            }
         
-        match = false;
         
-        for( int r=0; r<stackRootLog[i].size(); r++ ) {
-            Stack *inOld = stackRootLog[i].getElement( r );
+        SimpleVector<ReportEntry> functionEntries;
         
-            if( stackCompare( inOld, &rootStack ) ) {
-                match = true;
-                inOld->sampleCount++;
-                break;
+        int numFunctionsToPrint = 
+            sortDiffRecords( &diffFunctions, 2, &functionEntries );
+        
+        SimpleVector<ReportEntry> stackEntries;
+        
+        int numStacksToPrint = 
+            sortDiffRecords( &diffStacks, 1, &stackEntries );
+        
+        
+        printf( "\n\n\nDifferential report:\n\n" );
+        
+        printf( "\n\n\nFunctions with more than one sample, "
+                "by change:\n\n" );
+        
+        for( int i=0; i<numFunctionsToPrint; i++ ) {
+            DiffRecord *r = diffFunctions.getElement( 
+                functionEntries.getElement( i )->index );
+            
+            printDiffRecordHeader( r );
+            printf( "         %s\n\n\n", 
+                    diffFrames.getElement( r->firstFrame )->funcName );
+            }
+        
+        printf( "\n\n\nFull stacks with at least one sample, "
+                "by change:\n\n" );
+        
+        for( int i=0; i<numStacksToPrint; i++ ) {
+            DiffRecord *r = diffStacks.getElement( 
+                stackEntries.getElement( i )->index );
+            
+            printDiffRecordHeader( r );
+            
+            for( int f=0; f<r->numFrames; f++ ) {
+                DiffFrame *frame = diffFrames.getElement( r->firstFrame + f );
+                
+                printf( "       %3d: %s   (at %s:%d)\n", 
+                        f + 1,
+                        frame->funcName, 
+                        ( frame->fileName != NULL ) ? frame->fileName : "??",
+                        frame->lineNum );
                 }
+            printf( "\n\n" );
             }
+        }
     
-        if( !match ) {
-            stackRootLog[i].push_back( rootStack );
-            }
+    diffFrames.deleteAll();
+    diffStacks.deleteAll();
+    diffFunctions.deleteAll();
+    freeHashIndex( &diffStackIndex );
+    freeHashIndex( &diffFunctionIndex );
+    
+    if( flameGraphFileName != NULL && ! loaded ) {
+        flameNodes.deleteAll();
+        freeHashIndex( &flameNodeIndex );
         }
+    
+    freeInternedNames();
+    
+    return loaded;
     }
 
 
 
-void printStack( Stack inStack, int inNumTotalSamples ) {
-    Stack s = inStack;
+int main( int inNumArgs, char **inArgs ) {
     
-    printf( "%7.3f%% ===================================== (%d samples)\n"
-            "       %3d: %s   (at %s:%d)\n", 
-            100 * s.sampleCount / (float )inNumTotalSamples,
-            s.sampleCount,
-            1,
-            s.frames.getElement( 0 )->funcName, 
-            s.frames.getElement( 0 )->fileName, 
-            s.frames.getElement( 0 )->lineNum );
+    parseOptions( &inNumArgs, inArgs );
+    
+    useNativeBackend = isOptionSet( "native" );
+    sampleAllThreads = isOptionSet( "allThreads" );
+    
+    useBuiltinSymbols = isOptionSet( "builtinSymbols" );
+    usePerf = isOptionSet( "perf" );
+    
+    // native frames only have addresses anyway
+    lazySymbols = isOptionSet( "lazySymbols" ) || useNativeBackend ||
+        useBuiltinSymbols || usePerf;
+    
+    if( lazySymbols ) {
+        stackListCommand = "-stack-list-frames --no-frame-filters";
+        }
 
-    StackFrame *sf = inStack.frames.getElement( 0 );
+    const char *jitterName = getOptionValue( "jitter" );
     
-    if( sf->lineNum > 0 ) {
+    if( jitterName != NULL ) {
+        if( strcmp( jitterName, "uniform" ) == 0 ) {
+            jitterMode = JITTER_UNIFORM;
+            }
+        else if( strcmp( jitterName, "poisson" ) == 0 ) {
+            jitterMode = JITTER_POISSON;
+            }
+        else {
+            printf( "Unknown jitter type '%s'\n", jitterName );
+            usage();
+            }
+        srand48( time( NULL ) ^ getpid() );
+        }
+    
+    const char *rootDepthString = getOptionValue( "rootDepth" );
+    
+    if( rootDepthString != NULL ) {
+        reportRootDepth = -1;
+        sscanf( rootDepthString, "%d", &reportRootDepth );
         
-        char *listCommand = autoSprintf( "list %s:%d,%d",
-                                         sf->fileName,
-                                         sf->lineNum,
-                                         sf->lineNum );
-        sendCommand( listCommand );
+        if( reportRootDepth < 0 ) {
+            printf( "Partial stack depth can't be negative\n" );
+            usage();
+            }
+        }
+    
+    const char *topString = getOptionValue( "top" );
+    
+    if( topString != NULL ) {
+        reportTopCount = -1;
+        sscanf( topString, "%d", &reportTopCount );
         
-        delete [] listCommand;
+        if( reportTopCount < 0 ) {
+            printf( "Number of report entries to list can't be "
+                    "negative\n" );
+            usage();
+            }
+        }
+    
+    const char *budgetString = getOptionValue( "budget" );
+    
+    if( budgetString != NULL ) {
+        float budgetPercent = -1;
+        sscanf( budgetString, "%f", &budgetPercent );
         
-        char *response = getGDBResponse();
+        if( budgetPercent <= 0 || budgetPercent >= 100 ) {
+            printf( "Pause budget must be between 0 and 100 percent\n" );
+            usage();
+            }
+        pauseBudget = budgetPercent / 100;
+        }
+
+    pprofFileName = getOptionValue( "pprof" );
+    foldedFileName = getOptionValue( "folded" );
+    flameGraphFileName = getOptionValue( "flameGraph" );
+    flameGraphIcicle = isOptionSet( "icicle" );
+    timelineFileName = getOptionValue( "timeline" );
+    callgrindFileName = getOptionValue( "callgrind" );
+    
+    const char *reportLogName = getOptionValue( "report" );
+    
+    if( isOptionSet( "diff" ) && reportLogName == NULL ) {
+        printf( "--diff compares against the log given with --report\n" );
+        usage();
+        }
+    
+    if( reportLogName != NULL ) {
+        if( inNumArgs != 1 || isOptionSet( "sampleLog" ) ) {
+            usage();
+            }
         
-        char *marker = autoSprintf( "~\"%d\\t", sf->lineNum );
+        // names come from the log, or from the target's files if they're
+        // still around, never from GDB
+        useGDB = false;
+        useBuiltinSymbols = true;
+        lazySymbols = false;
         
-        char *markerSpot = strstr( response, marker );
+        const char *diffLogName = getOptionValue( "diff" );
         
-        // if name present in line, it's a not-found error
-        if( markerSpot != NULL &&
-            strstr( markerSpot, sf->fileName ) == NULL ) {
-            char *lineStart = &( markerSpot[ strlen( marker ) ] );
-            
-            // trim spaces from start
-            while( lineStart[0] == ' ' ) {
-                lineStart = &( lineStart[1] );
+        if( diffLogName != NULL ) {
+            if( pprofFileName != NULL || foldedFileName != NULL ||
+                timelineFileName != NULL || callgrindFileName != NULL ) {
+                printf( "Only --flameGraph can be drawn for a --diff\n" );
+                usage();
                 }
             
-            char *lineEnd = strstr( lineStart, "\\n" );
-            if( lineEnd != NULL ) {
-                lineEnd[0] ='\0';
+            if( ! printDiffReport( diffLogName, reportLogName ) ) {
+                return 1;
                 }
-            printf( "            %d:|   %s\n", sf->lineNum, lineStart );
+            return 0;
             }
         
-        delete [] marker;
-        delete [] response;
-        }
-    
-
-    // print stack for context below
-    for( int j=1; j<s.frames.size(); j++ ) {
-        StackFrame f = s.frames.getElementDirect( j );
-        printf( "       %3d: %s   (at %s:%d)\n", 
-                j + 1,
-                f.funcName, 
-                f.fileName, 
-                f.lineNum );
+        SampleLogSummary summary;
+        
+        if( ! readSampleLog( reportLogName, &summary ) ) {
+            return 1;
+            }
+        
+        finishStackLogs();
+        
+        printReport( summary.numSamples, summary.requestedRate, 
+                     summary.samplingSeconds );
+        
+        return 0;
         }
-    printf( "\n\n" );
-    }
-
-
-
-
-
-int main( int inNumArgs, char **inArgs ) {
     
     if( inNumArgs != 3 && inNumArgs != 4 && inNumArgs != 5 ) {
         usage();
@@ -1478,6 +11048,18 @@ int main( int inNumArgs, char **inArgs ) {
     
     sscanf( inArgs[1], "%f", &samplesPerSecond );
     
+    const char *sampleLogName = getOptionValue( "sampleLog" );
+    
+    if( sampleLogName != NULL ) {
+        if( ! openSampleLog( sampleLogName ) ) {
+            printf( "Could not open sample log %s for writing\n", 
+                    sampleLogName );
+            return 1;
+            }
+        printf( "Writing samples to %s as they're taken\n", 
+                sampleLogName );
+        }
+    
 
 
     int readPipe[2];
@@ -1500,179 +11082,260 @@ int main( int inNumArgs, char **inArgs ) {
         }
     
 
-    int childPID = fork();
+    // GDB is only needed if it's going to do the sampling, or if it's
+    // going to look up names for us afterward
+    useGDB = ! ( useNativeBackend && useBuiltinSymbols );
     
-    if( childPID == -1 ) {
-        printf( "Failed to fork\n" );
+    logFile = fopen( "wcGDBLog.txt", "w" );
+    
+    if( useGDB ) {
+        int childPID = fork();
+    
+        if( childPID == -1 ) {
+            printf( "Failed to fork\n" );
         
-        delete [] progName;
-        delete [] progArgs;
+            delete [] progName;
+            delete [] progArgs;
         
-        return 1;
-        }
-    else if( childPID == 0 ) {
-        // child
-        dup2( writePipe[0], STDIN_FILENO );
-        dup2( readPipe[1], STDOUT_FILENO );
-        dup2( readPipe[1], STDERR_FILENO );
-
-        while( false && true ) {
-            printf( "test\n" );
+            return 1;
             }
+        else if( childPID == 0 ) {
+            // child
+            dup2( writePipe[0], STDIN_FILENO );
+            dup2( readPipe[1], STDOUT_FILENO );
+            dup2( readPipe[1], STDERR_FILENO );
+
+            while( false && true ) {
+                printf( "test\n" );
+                }
         
-        //ask kernel to deliver SIGTERM in case the parent dies
-        prctl( PR_SET_PDEATHSIG, SIGTERM );
+            //ask kernel to deliver SIGTERM in case the parent dies
+            prctl( PR_SET_PDEATHSIG, SIGTERM );
 
-        execlp( "gdb", "gdb", "-nx", "--interpreter=mi", progName, NULL );
+            execlp( "gdb", "gdb", "-nx", "--interpreter=mi", progName, NULL );
         
-        delete [] progName;
-        delete [] progArgs;
+            delete [] progName;
+            delete [] progArgs;
         
-        exit( 0 );
-        }
+            exit( 0 );
+            }
     
-    // else parent
-    printf( "Forked GDB child on PID=%d\n", childPID );
+        // else parent
+        printf( "Forked GDB child on PID=%d\n", childPID );
 
-    logFile = fopen( "wcGDBLog.txt", "w" );
-    
-    printf( "Logging GDB commands and responses to wcGDBLog.txt\n" );
+        printf( "Logging GDB commands and responses to wcGDBLog.txt\n" );
     
     
-    //close unused pipe ends
-    close( writePipe[0] );
-    close( readPipe[1] );
+        //close unused pipe ends
+        close( writePipe[0] );
+        close( readPipe[1] );
     
-    inPipe = readPipe[0];
-    outPipe = writePipe[1];
+        inPipe = readPipe[0];
+        outPipe = writePipe[1];
 
-    fcntl( inPipe, F_SETFL, O_NONBLOCK );
+        fcntl( inPipe, F_SETFL, O_NONBLOCK );
 
-    char *gdbInitResponse = getGDBResponse();
+        char *gdbInitResponse = getGDBResponse();
     
-    if( strstr( gdbInitResponse, "No such file or directory." ) != NULL ) {
+        if( strstr( gdbInitResponse, "No such file or directory." ) != NULL ) {
+            delete [] gdbInitResponse;
+            printf( "GDB failed to start program '%s'\n", progName );
+            fclose( logFile );
+            logFile = NULL;
+            delete [] progName;
+            delete [] progArgs;
+            exit( 0 );
+            }
         delete [] gdbInitResponse;
-        printf( "GDB failed to start program '%s'\n", progName );
-        fclose( logFile );
-        logFile = NULL;
-        delete [] progName;
-        delete [] progArgs;
-        exit( 0 );
-        }
-    delete [] gdbInitResponse;
     
 
     
-    sendCommand( "handle SIGPIPE nostop noprint pass" );
+        sendCommand( "handle SIGPIPE nostop noprint pass" );
     
-    skipGDBResponse();
+        skipGDBResponse();
+        }
+    else {
+        close( readPipe[0] );
+        close( readPipe[1] );
+        close( writePipe[0] );
+        close( writePipe[1] );
+        }
     
 
 
-    if( inNumArgs == 3 ) {
-        char *runCommand = autoSprintf( "run %s > wcOut.txt", progArgs );
+    int pid = -1;
 
-        printf( "\n\nStarting gdb program with '%s', "
-                "redirecting program output to wcOut.txt\n",
-                runCommand );
+    if( useNativeBackend ) {
+        if( inNumArgs == 3 ) {
+            printf( "\n\nStarting program '%s' under ptrace, "
+                    "redirecting program output to wcOut.txt\n",
+                    inArgs[2] );
+            
+            pid = nativeStartProgram( progName, progArgs );
+            
+            if( pid == -1 ) {
+                printf( "Failed to start program '%s'\n", progName );
+                fclose( logFile );
+                logFile = NULL;
+                delete [] progName;
+                delete [] progArgs;
+                exit( 0 );
+                }
+            }
+        else {
+            printf( "\n\nAttaching to PID %s with ptrace\n", inArgs[3] );
+            
+            sscanf( inArgs[3], "%d", &pid );
+            
+            if( ! nativeSeize( pid, 0 ) ) {
+                if( errno == ESRCH ) {
+                    printf( "Could not find process:  %s\n", inArgs[3] );
+                    }
+                else {
+                    printf( "Could not attach to process %s "
+                            "(maybe you need to be root?)\n", inArgs[3] );
+                    }
+                fclose( logFile );
+                logFile = NULL;
+                delete [] progName;
+                delete [] progArgs;
+                exit( 0 );
+                }
+            }
+        
+        delete [] progName;
+        delete [] progArgs;
         
-        sendCommand( runCommand );
-        delete [] runCommand;
+        readTargetMaps();
+        
+        printf( "PID of sampled process = %d\n", pid );
         }
     else {
-        sendCommand( "-gdb-set target-async 1" );
-        skipGDBResponse();
+        if( inNumArgs == 3 ) {
+            char *runCommand = autoSprintf( "run %s > wcOut.txt", progArgs );
+
+            printf( "\n\nStarting gdb program with '%s', "
+                    "redirecting program output to wcOut.txt\n",
+                    runCommand );
+        
+            sendCommand( runCommand );
+            delete [] runCommand;
+            }
+        else {
+            sendCommand( "-gdb-set target-async 1" );
+            
+            char *asyncResponse = getGDBResponse();
+            gdbTargetAsync = 
+                ( strstr( asyncResponse, "^done" ) != NULL );
+            delete [] asyncResponse;
 
-        printf( "\n\nAttaching to PID %s\n", inArgs[3] );
+            printf( "\n\nAttaching to PID %s\n", inArgs[3] );
 
-        char *command = autoSprintf( "-target-attach %s\n", inArgs[3] );
+            char *command = autoSprintf( "-target-attach %s\n", inArgs[3] );
 
-        sendCommand( command ); 
+            sendCommand( command ); 
 
-        delete [] command;
+            delete [] command;
         
         
-        char *gdbAttachResponse = getGDBResponse();
+            char *gdbAttachResponse = getGDBResponse();
         
-        if( strstr( gdbAttachResponse, "ptrace: No such process." ) != NULL ) {
-            delete [] gdbAttachResponse;
-            printf( "GDB could not find process:  %s\n", inArgs[3] );
-            fclose( logFile );
-            logFile = NULL;
-            delete [] progName;
-            delete [] progArgs;
-            exit( 0 );
-            }
-        else if( strstr( gdbAttachResponse, 
-                         "ptrace: Operation not permitted." ) != NULL ) {
-            delete [] gdbAttachResponse;
-            printf( "GDB could not attach to process %s "
-                    "(maybe you need to be root?)\n", inArgs[3] );
-            fclose( logFile );
-            logFile = NULL;
-            delete [] progName;
-            delete [] progArgs;
-            exit( 0 );
-            }
+            if( strstr( gdbAttachResponse, "ptrace: No such process." ) != NULL ) {
+                delete [] gdbAttachResponse;
+                printf( "GDB could not find process:  %s\n", inArgs[3] );
+                fclose( logFile );
+                logFile = NULL;
+                delete [] progName;
+                delete [] progArgs;
+                exit( 0 );
+                }
+            else if( strstr( gdbAttachResponse, 
+                             "ptrace: Operation not permitted." ) != NULL ) {
+                delete [] gdbAttachResponse;
+                printf( "GDB could not attach to process %s "
+                        "(maybe you need to be root?)\n", inArgs[3] );
+                fclose( logFile );
+                logFile = NULL;
+                delete [] progName;
+                delete [] progArgs;
+                exit( 0 );
+                }
         
-        delete [] gdbAttachResponse;
+            delete [] gdbAttachResponse;
 
-        printf( "\n\nResuming attached gdb program with '-exec-continue'\n" );
+            printf( "\n\nResuming attached gdb program with '-exec-continue'\n" );
         
-        sendCommand( "-exec-continue" );
-        }
+            sendCommand( "-exec-continue" );
+            }
 
-    delete [] progArgs;
+        delete [] progArgs;
     
-    usleep( 100000 );
+        usleep( 100000 );
 
-    skipGDBResponse();
+        skipGDBResponse();
     
-    printf( "Debugging program '%s'\n", inArgs[2] );
+        printf( "Debugging program '%s'\n", inArgs[2] );
 
-    char rawProgramName[100];
+        char rawProgramName[100];
     
-    char *endOfPath = strrchr( inArgs[2], '/' );
+        char *endOfPath = strrchr( inArgs[2], '/' );
 
-    char *fullProgName = progName;
+        char *fullProgName = progName;
     
-    if( endOfPath != NULL ) {
-        progName = &( endOfPath[1] );
-        }
+        if( endOfPath != NULL ) {
+            progName = &( endOfPath[1] );
+            }
     
-    char *pidCall = autoSprintf( "pidof %s", progName );
+        char *pidCall = autoSprintf( "pidof %s", progName );
 
-    delete [] fullProgName;
+        delete [] fullProgName;
 
-    FILE *pidPipe = popen( pidCall, "r" );
+        FILE *pidPipe = popen( pidCall, "r" );
     
-    delete [] pidCall;
+        delete [] pidCall;
     
-    if( pidPipe == NULL ) {
-        printf( "Failed to open pipe to pidof to get debugged app pid\n" );
-        fclose( logFile );
-        logFile = NULL;
-        return 1;
-        }
+        if( pidPipe == NULL ) {
+            printf( "Failed to open pipe to pidof to get debugged app pid\n" );
+            fclose( logFile );
+            logFile = NULL;
+            return 1;
+            }
 
-    int pid = -1;
+        // if there are multiple GDP procs, they are printed in newest-first order
+        // this will get the pid of the latest one (our GDB child)
+        int numRead = fscanf( pidPipe, "%d", &pid );
     
-    // if there are multiple GDP procs, they are printed in newest-first order
-    // this will get the pid of the latest one (our GDB child)
-    int numRead = fscanf( pidPipe, "%d", &pid );
-    
-    pclose( pidPipe );
+        pclose( pidPipe );
 
-    if( numRead != 1 ) {
-        printf( "Failed to read PID of debugged app\n" );
-        fclose( logFile );
-        logFile = NULL;
-        return 1;
+        if( numRead != 1 ) {
+            printf( "Failed to read PID of debugged app\n" );
+            fclose( logFile );
+            logFile = NULL;
+            return 1;
+            }
+    
+        printf( "PID of debugged process = %d\n", pid );
+        
+        // pprof profiles list the target's mappings
+        if( lazySymbols || pprofFileName != NULL ) {
+            targetPID = pid;
+            readTargetMaps();
+            }
         }
     
-    printf( "PID of debugged process = %d\n", pid );
+    if( usePerf ) {
+        if( startPerfSampling() ) {
+            printf( "Collecting on-CPU samples with perf_event_open\n" );
+            }
+        else {
+            printf( "Continuing without on-CPU samples\n" );
+            usePerf = false;
+            }
+        }
     
 
+    logStartRecord( samplesPerSecond, sampleAllThreads, usePerf );
+    
     printf( "Sampling stack while program runs...\n" );
 
     
@@ -1685,7 +11348,15 @@ int main( int inNumArgs, char **inArgs ) {
     printf( "Sampling %.2f times per second, for %d usec between samples\n",
             samplesPerSecond, usPerSample );
     
+    if( jitterMode != JITTER_NONE ) {
+        printf( "Using %s jitter, so that is only the average time\n",
+                getOptionValue( "jitter" ) );
+        }
+    
     time_t startTime = time( NULL );
+    samplingStartTime = startTime;
+    
+    double samplingStart = getMonotonicTime();
     
     int detatchSeconds = -1;
     
@@ -1697,45 +11368,126 @@ int main( int inNumArgs, char **inArgs ) {
                 detatchSeconds );
         }
     
+    double samplePeriod = 1.0 / samplesPerSecond;
+    
+    double nextDeadline = getNextSampleDeadline( samplingStart, 
+                                                 samplePeriod );
+    
+    double lastSampleTime = samplingStart;
+    
 
     while( !programExited &&
            ( detatchSeconds == -1 ||
              time( NULL ) < startTime + detatchSeconds ) ) {
-        usleep( usPerSample );
-    
-        // interrupt
-        if( inNumArgs == 3 ) {
-            // we ran our program with run above to redirect output
-            // thus -exec-interrupt won't work
-            log( "Sending SIGINT to target process", inArgs[2] );
+
+        if( usePerf ) {
+            drainPerfSamples();
+            updatePerfThreads();
+            }
         
-            kill( pid, SIGINT );
+        if( useNativeBackend ) {
+            nativeSleepUntil( nextDeadline );
             }
         else {
-            sendCommand( "-exec-interrupt" );
+            sleepUntil( nextDeadline );
             }
         
-        waitForGDBInterruptResponse();
+        // this sample stands for all the time since the last one
+        double sampleTime = getMonotonicTime();
+        currentSampleWeight = sampleTime - lastSampleTime;
+        
+        char sampled = false;
+        
+        if( useNativeBackend ) {
+            if( !programExited ) {
+                sampled = takeNativeSamples();
+                }
+            }
+        else {
+            currentPause.interrupted = getMonotonicTime();
+            
+            countGDBPipeWaits = true;
+            
+            // interrupt
+            if( inNumArgs == 3 ) {
+                // we ran our program with run above to redirect output
+                // thus -exec-interrupt won't work
+                log( "Sending SIGINT to target process", inArgs[2] );
+        
+                kill( pid, SIGINT );
+                }
+            else {
+                sendCommand( "-exec-interrupt" );
+                }
+        
+            waitForGDBInterruptResponse();
+            
+            currentPause.stopped = getMonotonicTime();
         
 
-        if( !programExited ) {
-            // sample stack
-            sendCommand( "-stack-list-frames" );
-            logGDBStackResponse();
-            numSamples++;
+            if( !programExited ) {
+                // sample stacks and continue running
+                sampled = sampleGDBStacks();
+                }
+            else {
+                currentPause.captured = currentPause.resumed =
+                    currentPause.stopped;
+                }
+            
+            countGDBPipeWaits = false;
+
+            if( targetMapsStale && lazySymbols ) {
+                // saw addresses we can't place, target running again
+                readTargetMaps();
+                }
             }
         
-        if( !programExited ) {
-            // continue running
+        if( sampled ) {
+            SampleRecord r = { 
+                sampleTime - samplingStart, 
+                currentSampleWeight,
+                currentPause.stopped - currentPause.interrupted,
+                currentPause.captured - currentPause.stopped,
+                currentPause.resumed - currentPause.captured };
             
-            sendCommand( "-exec-continue" );
-            skipGDBResponse();
+            sampleRecords.push_back( r );
+            logStopRecord( &r );
+            addTimelineStop( &r );
+            
+            lastSampleTime = sampleTime;
+            numSamples++;
+            
+            if( pauseBudget > 0 ) {
+                // samples are weighted by their intervals, so changing
+                // the rate doesn't skew the report
+                samplePeriod = 
+                    getBudgetedPeriod( 1.0 / samplesPerSecond,
+                                       currentPause.resumed - 
+                                       currentPause.interrupted );
+                }
             }
+        
+        nextDeadline = getNextSampleDeadline( nextDeadline, samplePeriod );
         }
 
+    double samplingSeconds = getMonotonicTime() - samplingStart;
+    
+    if( usePerf ) {
+        stopPerfSampling();
+        }
+    
+    logEndRecord( numSamples, samplingSeconds, perfLostCount );
+    
+    finishStackLogs();
+    
     if( programExited ) {
         printf( "Program exited normally\n" );
         }
+    else if( useNativeBackend ) {
+        printf( "Detatching from program\n" );
+
+        nativeDetach();
+        }
     else {
         printf( "Detatching from program\n" );
         
@@ -1759,164 +11511,7 @@ int main( int inNumArgs, char **inArgs ) {
         detatchJustSent = false;
         }
     
-    printf( "%d stack samples taken\n", numSamples );
-
-    printf( "%d unique stacks sampled\n", stackLog.size() );
-
-
-    SimpleVector<FunctionRecord> functions;
-    
-    for( int i=0; i<stackLog.size(); i++ ) {
-        Stack *s = stackLog.getElement( i );
-        
-        int sampleCount = s->sampleCount;
-        
-        for( int f=0; f< s->frames.size(); f++ ) {
-            char *funcName = s->frames.getElement( f )->funcName;
-            
-            char found = false;
-            for( int r=0; r<functions.size(); r++ ) {
-                if( strcmp( functions.getElement( r )->funcName,
-                            funcName ) == 0 ) {
-                    // hit
-                    found = true;
-                    functions.getElement( r )->sampleCount += sampleCount;
-                    break;
-                    }
-                }
-            if( !found ) {
-                FunctionRecord newFunc = { funcName, sampleCount };
-                functions.push_back( newFunc );
-                }
-            }
-        }
-    
-    SimpleVector<FunctionRecord> sortedFunctions;
-    while( functions.size() > 0 ) {
-        int max = 1;
-        FunctionRecord maxFunc;
-        int maxInd = -1;
-        for( int i=0; i<functions.size(); i++ ) {
-            FunctionRecord r = functions.getElementDirect( i );
-            
-            if( r.sampleCount > max ) {
-                maxFunc = r;
-                max = r.sampleCount;
-                maxInd = i;
-                }
-            }  
-        if( maxInd >= 0 ) {
-            sortedFunctions.push_back( maxFunc );
-            functions.deleteElement( maxInd );
-            }
-        else {
-            break;
-            }
-        }
-    
-    
-    
-    // simple insertion sort
-    SimpleVector<Stack> sortedStacks;
-    
-    while( stackLog.size() > 0 ) {
-        int max = 0;
-        Stack maxStack;
-        int maxInd = -1;
-        for( int i=0; i<stackLog.size(); i++ ) {
-            Stack s = stackLog.getElementDirect( i );
-            
-            if( s.sampleCount > max ) {
-                maxStack = s;
-                max = s.sampleCount;
-                maxInd = i;
-                }
-            }  
-        if( maxInd >= 0 ) {
-            sortedStacks.push_back( maxStack );
-            stackLog.deleteElement( maxInd );
-            }
-        else {
-            break;
-            }
-        }
-
-
-    SimpleVector<Stack> sortedRootStacks[ NUM_ROOT_STACKS_TO_TRACK ];
-    
-    for( int r=1; r<NUM_ROOT_STACKS_TO_TRACK; r++ ) {
-        
-        while( stackRootLog[r].size() > 0 ) {
-            int max = 1;
-            Stack maxStack;
-            int maxInd = -1;
-            for( int i=0; i<stackRootLog[r].size(); i++ ) {
-                Stack s = stackRootLog[r].getElementDirect( i );
-            
-                if( s.sampleCount > max ) {
-                    maxStack = s;
-                    max = s.sampleCount;
-                    maxInd = i;
-                    }
-                }  
-            if( maxInd >= 0 ) {        
-                sortedRootStacks[r].push_back( maxStack );
-                stackRootLog[r].deleteElement( maxInd );
-                }
-            else {
-                break;
-                }
-            }
-        
-        }
-    
-    
-    printf( "\n\n\nReport:\n\n" );
-
-    printf( "\n\n\nFunctions "
-            "with more than one sample:\n\n" );
-
-    for( int i=0; i<sortedFunctions.size(); i++ ) {
-        FunctionRecord f = sortedFunctions.getElementDirect( i );
-        
-        printf( "%7.3f%% ===================================== (%d samples)\n"
-                "         %s\n\n\n",
-                100 * f.sampleCount / (float )numSamples,
-                f.sampleCount,
-                f.funcName );
-        }
-                
-
-
-    for( int r=1; r<NUM_ROOT_STACKS_TO_TRACK; r++ ) {
-        if( sortedRootStacks[r].size() > 0 ) {
-            
-            printf( "\n\n\nPartial stacks of depth [%d] "
-                    "with more than one sample:\n\n", r );
-            
-            for( int i=0; i<sortedRootStacks[r].size(); i++ ) {
-                Stack s = sortedRootStacks[r].getElementDirect( i );
-                printStack( s, numSamples );
-                }
-            }
-        }
-    
-    
-    printf( "\n\n\nFull stacks "
-            "with at least one sample:\n\n" );
-    
-    for( int i=0; i<sortedStacks.size(); i++ ) {
-        Stack s = sortedStacks.getElementDirect( i );
-        printStack( s, numSamples );
-        
-        freeStack( &s );
-        }
-
-    // stacks that had only one sample
-    for( int i=0; i<stackLog.size(); i++ ) {
-        Stack s = stackLog.getElementDirect( i );
-        freeStack( &s );
-        }
+    printReport( numSamples, samplesPerSecond, samplingSeconds );
     
     fclose( logFile );
     logFile = NULL;